@@ -40,7 +40,12 @@ LOCAL_SRC_FILES := \
 ./EchoCanceller.cpp \
 ./CongestionControl.cpp \
 ./VoIPServerConfig.cpp \
+./VoIPEngine.cpp \
+./FecController.cpp \
+./Clock.cpp \
+./crypto/AES.cpp \
 ./audio/Resampler.cpp \
+./audio/TimeStretcher.cpp \
 ./NetworkSocket.cpp \
 ./os/posix/NetworkSocketPosix.cpp \
 ./PacketReassembler.cpp \
@@ -8,7 +8,10 @@
 #define LIBTGVOIP_BLOCKINGQUEUE_H
 
 #include <stdlib.h>
-#include <list>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <type_traits>
 #include "threading.h"
 #include "utils.h"
 
@@ -16,11 +19,130 @@ using namespace std;
 
 namespace tgvoip{
 
+/**
+ * Bounded lock-free multi-producer multi-consumer FIFO on a ring of preallocated cells (D. Vyukov's algorithm).
+ * Never allocates after construction and never blocks; the caller decides what to do when it's full or empty.
+ */
+template<typename T>
+class LockFreeQueue{
+public:
+	TGVOIP_DISALLOW_COPY_AND_ASSIGN(LockFreeQueue);
+	/**
+	 * @param capacity The minimum number of items, rounded up to a power of 2
+	 */
+	LockFreeQueue(size_t capacity){
+		size=1;
+		while(size<capacity)
+			size<<=1;
+		mask=size-1;
+		cells=new Cell[size];
+		for(size_t i=0;i<size;i++){
+			cells[i].sequence.store(i, memory_order_relaxed);
+		}
+		head.store(0, memory_order_relaxed);
+		tail.store(0, memory_order_relaxed);
+	}
+
+	~LockFreeQueue(){
+		typename aligned_storage<sizeof(T), alignof(T)>::type storage;
+		T* item=reinterpret_cast<T*>(&storage);
+		while(TryGet(item)){
+			item->~T();
+		}
+		delete[] cells;
+	}
+
+	/**
+	 * Moves the item into the queue
+	 * @return false if the queue is full, thing is left untouched in that case
+	 */
+	bool TryPut(T& thing){
+		size_t pos=tail.load(memory_order_relaxed);
+		Cell* cell;
+		while(true){
+			cell=&cells[pos & mask];
+			size_t seq=cell->sequence.load(memory_order_acquire);
+			intptr_t diff=(intptr_t)seq-(intptr_t)pos;
+			if(diff==0){
+				if(tail.compare_exchange_weak(pos, pos+1, memory_order_relaxed))
+					break;
+			}else if(diff<0){
+				return false;
+			}else{
+				pos=tail.load(memory_order_relaxed);
+			}
+		}
+		new (&cell->storage) T(std::move(thing));
+		cell->sequence.store(pos+1, memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Takes the oldest item out of the queue
+	 * @param out Uninitialized memory the item gets move-constructed into
+	 * @return false if the queue is empty
+	 */
+	bool TryGet(T* out){
+		size_t pos=head.load(memory_order_relaxed);
+		Cell* cell;
+		while(true){
+			cell=&cells[pos & mask];
+			size_t seq=cell->sequence.load(memory_order_acquire);
+			intptr_t diff=(intptr_t)seq-(intptr_t)(pos+1);
+			if(diff==0){
+				if(head.compare_exchange_weak(pos, pos+1, memory_order_relaxed))
+					break;
+			}else if(diff<0){
+				return false;
+			}else{
+				pos=head.load(memory_order_relaxed);
+			}
+		}
+		T* item=reinterpret_cast<T*>(&cell->storage);
+		new (out) T(std::move(*item));
+		item->~T();
+		cell->sequence.store(pos+mask+1, memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @return the number of items, only approximate while other threads are using the queue
+	 */
+	size_t Size(){
+		size_t h=head.load(memory_order_acquire);
+		size_t t=tail.load(memory_order_acquire);
+		return t>h ? t-h : 0;
+	}
+
+	size_t Capacity(){
+		return size;
+	}
+
+private:
+	struct Cell{
+		atomic<size_t> sequence;
+		typename aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
+
+	Cell* cells;
+	size_t size;
+	size_t mask;
+	// producers and consumers shouldn't be bouncing the same cache line
+	char pad0[64];
+	atomic<size_t> head;
+	char pad1[64];
+	atomic<size_t> tail;
+	char pad2[64];
+};
+
+/**
+ * A LockFreeQueue with blocking reads. When full, Put drops the oldest item through the overflow callback.
+ */
 template<typename T>
 class BlockingQueue{
 public:
 	TGVOIP_DISALLOW_COPY_AND_ASSIGN(BlockingQueue);
-	BlockingQueue(size_t capacity) : semaphore(capacity, 0){
+	BlockingQueue(size_t capacity) : queue(capacity), semaphore((unsigned int)queue.Capacity(), 0){
 		this->capacity=capacity;
 		overflowCallback=NULL;
 	};
@@ -30,37 +152,46 @@ public:
 	}
 
 	void Put(T thing){
-		MutexGuard sync(mutex);
-		queue.push_back(std::move(thing));
-		bool didOverflow=false;
-		while(queue.size()>capacity){
-			didOverflow=true;
-			if(overflowCallback){
-				overflowCallback(std::move(queue.front()));
-				queue.pop_front();
-			}else{
-				abort();
+		while(true){
+			if(queue.Size()<capacity && queue.TryPut(thing)){
+				semaphore.Release();
+				return;
+			}
+			// only drop an item that no consumer has claimed yet, otherwise the semaphore goes out of sync
+			if(!semaphore.TryAcquire()){
+				// everything left is about to be taken out
+				std::this_thread::yield();
+				continue;
 			}
+			if(!overflowCallback)
+				abort();
+			typename aligned_storage<sizeof(T), alignof(T)>::type storage;
+			T* oldest=reinterpret_cast<T*>(&storage);
+			TakeClaimed(oldest);
+			overflowCallback(std::move(*oldest));
+			oldest->~T();
 		}
-		if(!didOverflow)
-			semaphore.Release();
 	}
 
 	T GetBlocking(){
 		semaphore.Acquire();
-		MutexGuard sync(mutex);
-		return GetInternal();
+		typename aligned_storage<sizeof(T), alignof(T)>::type storage;
+		T* item=reinterpret_cast<T*>(&storage);
+		TakeClaimed(item);
+		T r=std::move(*item);
+		item->~T();
+		return r;
 	}
 
+	/**
+	 * Only call this when Size()>0, it waits for an item otherwise
+	 */
 	T Get(){
-		MutexGuard sync(mutex);
-		if(queue.size()>0)
-			semaphore.Acquire();
-		return GetInternal();
+		return GetBlocking();
 	}
 
 	size_t Size(){
-		return queue.size();
+		return queue.Size();
 	}
 
 	void PrepareDealloc(){
@@ -72,19 +203,19 @@ public:
 	}
 
 private:
-	T GetInternal(){
-		//if(queue.size()==0)
-		//	return NULL;
-		T r=std::move(queue.front());
-		queue.pop_front();
-		return r;
+	/**
+	 * Takes out an item after a successful semaphore acquire. The producer that released the semaphore
+	 * has already put its item in, but another consumer may be holding an older cell for a moment.
+	 */
+	void TakeClaimed(T* out){
+		while(!queue.TryGet(out)){
+			std::this_thread::yield();
+		}
 	}
 
-	list<T> queue;
+	LockFreeQueue<T> queue;
 	size_t capacity;
-	//tgvoip_lock_t lock;
 	Semaphore semaphore;
-	Mutex mutex;
 	void (*overflowCallback)(T);
 };
 }
@@ -10,6 +10,7 @@
 #include <exception>
 #include <stdexcept>
 #include <stdlib.h>
+#include <new>
 #include "logging.h"
 
 using namespace tgvoip;
@@ -234,3 +235,188 @@ void BufferOutputStream::Rewind(size_t numBytes){
 		throw std::out_of_range("buffer underflow");
 	offset-=numBytes;
 }
+
+#pragma mark - PacketBuffer
+
+class PacketBuffer::Storage : public BufferAllocator{
+public:
+	static Storage* Create(size_t capacity){
+		void* mem=malloc(sizeof(Storage)+capacity);
+		if(!mem)
+			throw std::bad_alloc();
+		return new (mem) Storage(capacity);
+	}
+
+	void Ref(){
+		refCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void Unref(){
+		if(refCount.fetch_sub(1, std::memory_order_acq_rel)==1){
+			this->~Storage();
+			free(this);
+		}
+	}
+
+	unsigned char* Data(){
+		return reinterpret_cast<unsigned char*>(this+1);
+	}
+
+	virtual void Free(unsigned char* data) override{
+		Unref();
+	}
+
+	virtual unsigned char* Realloc(unsigned char* data, size_t newSize) override{
+		if(data+newSize>Data()+capacity)
+			throw std::invalid_argument("newSize is beyond the end of the storage");
+		return data;
+	}
+
+	const size_t capacity;
+
+private:
+	Storage(size_t capacity) : capacity(capacity){
+		refCount.store(1, std::memory_order_relaxed);
+	}
+
+	std::atomic<unsigned int> refCount;
+};
+
+PacketBuffer::PacketBuffer(size_t headroom, size_t capacity){
+	storage=Storage::Create(headroom+capacity);
+	offset=(uint32_t)headroom;
+	length=0;
+}
+
+PacketBuffer::PacketBuffer(const PacketBuffer& other) : storage(other.storage), offset(other.offset), length(other.length){
+	if(storage)
+		storage->Ref();
+}
+
+PacketBuffer::~PacketBuffer(){
+	if(storage)
+		storage->Unref();
+}
+
+PacketBuffer& PacketBuffer::operator=(const PacketBuffer& other){
+	if(other.storage)
+		other.storage->Ref();
+	if(storage)
+		storage->Unref();
+	storage=other.storage;
+	offset=other.offset;
+	length=other.length;
+	return *this;
+}
+
+PacketBuffer& PacketBuffer::operator=(PacketBuffer&& other){
+	if(this!=&other){
+		if(storage)
+			storage->Unref();
+		storage=other.storage;
+		offset=other.offset;
+		length=other.length;
+		other.storage=NULL;
+		other.offset=other.length=0;
+	}
+	return *this;
+}
+
+unsigned char* PacketBuffer::Data(){
+	return storage ? storage->Data()+offset : NULL;
+}
+
+const unsigned char* PacketBuffer::Data() const{
+	return storage ? storage->Data()+offset : NULL;
+}
+
+size_t PacketBuffer::Tailroom() const{
+	return storage ? storage->capacity-offset-length : 0;
+}
+
+unsigned char* PacketBuffer::Prepend(size_t count){
+	if(count>offset)
+		throw std::out_of_range("not enough headroom");
+	offset-=(uint32_t)count;
+	length+=(uint32_t)count;
+	return storage->Data()+offset;
+}
+
+unsigned char* PacketBuffer::Append(size_t count){
+	if(count>Tailroom())
+		throw std::out_of_range("not enough tailroom");
+	unsigned char* end=storage->Data()+offset+length;
+	length+=(uint32_t)count;
+	return end;
+}
+
+void PacketBuffer::TrimFront(size_t count){
+	if(count>length)
+		throw std::out_of_range("count>length");
+	offset+=(uint32_t)count;
+	length-=(uint32_t)count;
+}
+
+void PacketBuffer::TrimBack(size_t count){
+	if(count>length)
+		throw std::out_of_range("count>length");
+	length-=(uint32_t)count;
+}
+
+void PacketBuffer::EnsureRoom(size_t headroom, size_t tailroom){
+	if(storage && offset>=headroom && Tailroom()>=tailroom)
+		return;
+	Storage* newStorage=Storage::Create(headroom+length+tailroom);
+	if(length)
+		memcpy(newStorage->Data()+headroom, Data(), length);
+	if(storage)
+		storage->Unref();
+	storage=newStorage;
+	offset=(uint32_t)headroom;
+}
+
+PacketBuffer PacketBuffer::Slice(size_t offset, size_t length) const{
+	if(offset+length>this->length)
+		throw std::out_of_range("offset+length out of bounds");
+	PacketBuffer slice(*this);
+	slice.offset+=(uint32_t)offset;
+	slice.length=(uint32_t)length;
+	return slice;
+}
+
+PacketBuffer PacketBuffer::Tail() const{
+	PacketBuffer tail(*this);
+	tail.offset+=length;
+	tail.length=0;
+	return tail;
+}
+
+Buffer PacketBuffer::ToBuffer(){
+	if(!storage)
+		return Buffer();
+	Buffer buf=Buffer::Wrap(Data(), length, storage);
+	// the reference now belongs to the Buffer
+	storage=NULL;
+	offset=length=0;
+	return buf;
+}
+
+PacketBuffer PacketBuffer::FromBuffer(Buffer&& buffer, size_t headroom, size_t tailroom){
+	PacketBuffer pb;
+	Storage* storage=dynamic_cast<Storage*>(buffer.allocator);
+	if(storage && buffer.data){
+		pb.storage=storage;
+		pb.offset=(uint32_t)(buffer.data-storage->Data());
+		pb.length=(uint32_t)buffer.length;
+		buffer.data=NULL;
+		buffer.length=0;
+		buffer.allocator=NULL;
+	}else{
+		pb=PacketBuffer(headroom, buffer.Length()+tailroom);
+		if(!buffer.IsEmpty())
+			memcpy(pb.Append(buffer.Length()), *buffer, buffer.Length());
+		buffer=Buffer();
+	}
+	pb.EnsureRoom(headroom, tailroom);
+	return pb;
+}
@@ -15,7 +15,7 @@
 #include <stdexcept>
 #include <array>
 #include <limits>
-#include <bitset>
+#include <atomic>
 #include <stddef.h>
 #include "threading.h"
 #include "utils.h"
@@ -89,7 +89,18 @@ namespace tgvoip{
 		bool bufferProvided;
 	};
 
+	/**
+	 * Owner of the memory of a Buffer that wants it back instead of having it free()'d
+	 */
+	class BufferAllocator{
+	public:
+		virtual ~BufferAllocator(){};
+		virtual void Free(unsigned char* data)=0;
+		virtual unsigned char* Realloc(unsigned char* data, size_t newSize)=0;
+	};
+
 	class Buffer{
+	friend class PacketBuffer;
 	public:
 		Buffer(size_t capacity){
 			if(capacity>0){
@@ -105,8 +116,9 @@ namespace tgvoip{
 		Buffer(Buffer&& other) noexcept {
 			data=other.data;
 			length=other.length;
-			freeFn=other.freeFn;
-			reallocFn=other.reallocFn;
+			allocator=other.allocator;
+			freeFn=std::move(other.freeFn);
+			reallocFn=std::move(other.reallocFn);
 			other.data=NULL;
 		};
 		Buffer(BufferOutputStream&& stream){
@@ -119,27 +131,18 @@ namespace tgvoip{
 			length=0;
 		}
 		~Buffer(){
-			if(data){
-				if(freeFn)
-					freeFn(data);
-				else
-					free(data);
-			}
+			FreeData();
 			data=NULL;
 			length=0;
 		};
 		Buffer& operator=(Buffer&& other){
 			if(this!=&other){
-				if(data){
-					if(freeFn)
-						freeFn(data);
-					else
-						free(data);
-				}
+				FreeData();
 				data=other.data;
 				length=other.length;
-				freeFn=other.freeFn;
-				reallocFn=other.reallocFn;
+				allocator=other.allocator;
+				freeFn=std::move(other.freeFn);
+				reallocFn=std::move(other.reallocFn);
 				other.data=NULL;
 				other.length=0;
 			}
@@ -174,7 +177,9 @@ namespace tgvoip{
 			memcpy(data+dstOffset, ptr, count);
 		}
 		void Resize(size_t newSize){
-			if(reallocFn)
+			if(allocator)
+				data=allocator->Realloc(data, newSize);
+			else if(reallocFn)
 				data=(unsigned char *) reallocFn(data, newSize);
 			else
 				data=(unsigned char *) realloc(data, newSize);
@@ -210,13 +215,106 @@ namespace tgvoip{
 			b.reallocFn=reallocFn;
 			return b;
 		}
+		/**
+		 * Wraps memory that goes back to allocator when the buffer is destroyed. Unlike Wrap(), doesn't allocate anything.
+		 */
+		static Buffer Wrap(unsigned char* data, size_t size, BufferAllocator* allocator){
+			Buffer b=Buffer();
+			b.data=data;
+			b.length=size;
+			b.allocator=allocator;
+			return b;
+		}
 	private:
+		void FreeData(){
+			if(!data)
+				return;
+			if(allocator)
+				allocator->Free(data);
+			else if(freeFn)
+				freeFn(data);
+			else
+				free(data);
+		}
+
 		unsigned char* data;
 		size_t length;
+		BufferAllocator* allocator=NULL;
 		std::function<void(void*)> freeFn;
 		std::function<void*(void*, size_t)> reallocFn;
 	};
 
+	/**
+	 * Reference-counted view into one allocation that has free space before (headroom) and after (tailroom) the data,
+	 * so that headers, tags and padding can be added in place as a packet goes down the send pipeline.
+	 * Copies and slices share the memory. Views don't protect their bytes from each other: writing into the headroom
+	 * or tailroom of one may overwrite the data of another one that shares the same allocation.
+	 */
+	class PacketBuffer{
+	public:
+		PacketBuffer() : storage(NULL), offset(0), length(0){}
+		/**
+		 * Allocates headroom+capacity bytes, the view starts empty after the headroom
+		 */
+		PacketBuffer(size_t headroom, size_t capacity);
+		PacketBuffer(const PacketBuffer& other);
+		PacketBuffer(PacketBuffer&& other) noexcept : storage(other.storage), offset(other.offset), length(other.length){
+			other.storage=NULL;
+			other.offset=other.length=0;
+		}
+		~PacketBuffer();
+		PacketBuffer& operator=(const PacketBuffer& other);
+		PacketBuffer& operator=(PacketBuffer&& other);
+		unsigned char* Data();
+		const unsigned char* Data() const;
+		size_t Length() const{
+			return length;
+		}
+		bool IsEmpty() const{
+			return length==0;
+		}
+		size_t Headroom() const{
+			return offset;
+		}
+		size_t Tailroom() const;
+		/**
+		 * Grows the view into the headroom
+		 * @return pointer to the count bytes just added at the front
+		 */
+		unsigned char* Prepend(size_t count);
+		/**
+		 * Grows the view into the tailroom
+		 * @return pointer to the count bytes just added at the end
+		 */
+		unsigned char* Append(size_t count);
+		void TrimFront(size_t count);
+		void TrimBack(size_t count);
+		/**
+		 * Moves the data into a new allocation if there isn't at least this much room around it
+		 */
+		void EnsureRoom(size_t headroom, size_t tailroom);
+		PacketBuffer Slice(size_t offset, size_t length) const;
+		/**
+		 * @return an empty view that starts where this one ends, so that everything up to there is its headroom
+		 */
+		PacketBuffer Tail() const;
+		/**
+		 * Hands the view over to a Buffer without copying, this PacketBuffer becomes empty
+		 */
+		Buffer ToBuffer();
+		/**
+		 * Takes over a Buffer, without copying if it came from ToBuffer() and has enough room around it
+		 */
+		static PacketBuffer FromBuffer(Buffer&& buffer, size_t headroom, size_t tailroom);
+
+	private:
+		class Storage;
+		Storage* storage;
+		// 32 bits keep it small enough to be captured in a MessageThread callback along with a couple of other things
+		uint32_t offset;
+		uint32_t length;
+	};
+
 	template <typename T, size_t size, typename AVG_T=T> class HistoricBuffer{
 	public:
 		HistoricBuffer(){
@@ -307,50 +405,298 @@ namespace tgvoip{
 		ptrdiff_t offset=0;
 	};
 
-	template <size_t bufSize, size_t bufCount> class BufferPool{
+	/**
+	 * Like HistoricBuffer, but keeps a running sum, sum of squares and count of non-zero elements along with monotonic queues
+	 * for the minimum and maximum, so all the whole-window aggregates are O(1). Elements can't be modified in place.
+	 */
+	template <typename T, size_t size, typename AVG_T=T> class AggregatingHistoricBuffer{
+	public:
+		AggregatingHistoricBuffer(){
+			Reset();
+		}
+
+		AVG_T Average() const {
+			return sum/(AVG_T)size;
+		}
+
+		AVG_T Average(size_t firstN) const {
+			AVG_T avg=(AVG_T)0;
+			for(size_t i=0;i<firstN;i++){
+				avg+=(*this)[i];
+			}
+			return avg/(AVG_T)firstN;
+		}
+
+		AVG_T NonZeroAverage() const {
+			if(nonZeroCount==0)
+				return (AVG_T)0;
+			return sum/(AVG_T)nonZeroCount;
+		}
+
+		/**
+		 * Population variance of the whole window
+		 */
+		AVG_T Variance() const {
+			AVG_T avg=Average();
+			AVG_T variance=sumOfSquares/(AVG_T)size-avg*avg;
+			return variance<(AVG_T)0 ? (AVG_T)0 : variance;
+		}
+
+		void Add(T el){
+			T old=data[offset];
+			data[offset]=el;
+			offset=(offset+1)%size;
+			if(offset==0){
+				// floating point sums drift when the same values are added and then subtracted, so start over once per round
+				Recalculate();
+			}else{
+				sum+=(AVG_T)el-(AVG_T)old;
+				sumOfSquares+=(AVG_T)el*(AVG_T)el-(AVG_T)old*(AVG_T)old;
+				nonZeroCount+=(el!=0 ? 1 : 0)-(old!=0 ? 1 : 0);
+			}
+			addCount++;
+			minQueue.Push(el, addCount);
+			maxQueue.Push(el, addCount);
+		}
+
+		T Min() const {
+			return minQueue.Front();
+		}
+
+		T Max() const {
+			return maxQueue.Front();
+		}
+
+		void Reset(){
+			std::fill(data.begin(), data.end(), (T)0);
+			offset=0;
+			sum=sumOfSquares=(AVG_T)0;
+			nonZeroCount=0;
+			addCount=0;
+			minQueue.Reset();
+			maxQueue.Reset();
+		}
+
+		T operator[](size_t i) const {
+			assert(i<size);
+			// [0] should return the most recent entry, [1] the one before it, and so on
+			ptrdiff_t _i=offset-i-1;
+			if(_i<0)
+				_i=size+_i;
+			return data[_i];
+		}
+
+		size_t Size() const {
+			return size;
+		}
+	private:
+		/**
+		 * Candidates for the minimum (or maximum) in the order they were added. Anything that can never be the extremum
+		 * again, because a newer element is at least as small (or large), is dropped, so the front is always the answer.
+		 */
+		template<bool isMax> class ExtremumQueue{
+		public:
+			void Push(T value, uint64_t index){
+				// the window is the last `size` elements, index is the newest one
+				while(count>0 && entries[head].index+size<=index){
+					head=(head+1)%size;
+					count--;
+				}
+				while(count>0 && (isMax ? entries[(head+count-1)%size].value<=value : entries[(head+count-1)%size].value>=value)){
+					count--;
+				}
+				entries[(head+count)%size]=Entry{value, index};
+				count++;
+			}
+			T Front() const {
+				return entries[head].value;
+			}
+			void Reset(){
+				// a freshly reset buffer is full of zeros
+				head=0;
+				count=1;
+				entries[0]=Entry{(T)0, 0};
+			}
+		private:
+			struct Entry{
+				T value;
+				uint64_t index;
+			};
+			std::array<Entry, size> entries;
+			size_t head;
+			size_t count;
+		};
+
+		void Recalculate(){
+			sum=sumOfSquares=(AVG_T)0;
+			nonZeroCount=0;
+			for(T i:data){
+				sum+=(AVG_T)i;
+				sumOfSquares+=(AVG_T)i*(AVG_T)i;
+				if(i!=0)
+					nonZeroCount++;
+			}
+		}
+
+		std::array<T, size> data;
+		ptrdiff_t offset=0;
+		AVG_T sum;
+		AVG_T sumOfSquares;
+		int nonZeroCount;
+		uint64_t addCount;
+		ExtremumQueue<false> minQueue;
+		ExtremumQueue<true> maxQueue;
+	};
+
+	/**
+	 * Fixed-size buffers carved out of one allocation. Get and release are O(1) and lock-free: free buffers form a stack
+	 * whose head carries a tag that changes on every update, so a stale pop can't succeed (the ABA problem).
+	 * @tparam threadCacheSize If nonzero, each thread keeps up to this many free buffers for itself, so a thread that both
+	 * gets and releases buffers rarely touches the shared stack. Only for pools that live forever and are the only instance
+	 * of their type, because the caches are thread_local and outlive any particular pool. It's slower than the shared stack
+	 * alone when buffers are taken on one thread and released on another, like the socket receive buffers are.
+	 */
+	template <size_t bufSize, size_t bufCount, size_t threadCacheSize=0> class BufferPool : public BufferAllocator{
 	public:
 		TGVOIP_DISALLOW_COPY_AND_ASSIGN(BufferPool);
 		BufferPool(){
+			static_assert(bufCount<0xFFFFFFFF, "too many buffers");
 			bufferStart=(unsigned char*)malloc(bufSize*bufCount);
 			if(!bufferStart)
 				throw std::bad_alloc();
+			for(size_t i=0;i<bufCount;i++){
+				next[i].store((uint32_t)(i+1), std::memory_order_relaxed);
+#ifndef NDEBUG
+				inUse[i].store(false, std::memory_order_relaxed);
+#endif
+			}
+			freeHead.store(0, std::memory_order_release);
 		};
-		~BufferPool(){
-			assert(usedBuffers.none());
+		virtual ~BufferPool(){
+#ifndef NDEBUG
+			if(threadCacheSize==0){
+				size_t freeCount=0;
+				for(uint32_t i=(uint32_t)freeHead.load();i!=NO_BUFFER;i=next[i].load()){
+					freeCount++;
+				}
+				assert(freeCount==bufCount);
+			}
+#endif
 			free(bufferStart);
 		};
 		Buffer Get(){
-			auto freeFn=[this](void* _buf){
-                assert(_buf!=NULL);
-				unsigned char* buf=(unsigned char*)_buf;
-				size_t offset=buf-bufferStart;
-				assert(offset%bufSize==0);
-				size_t index=offset/bufSize;
-				assert(index<bufCount);
-
-				MutexGuard m(mutex);
-				assert(usedBuffers.test(index));
-				usedBuffers[index]=0;
-			};
-			auto resizeFn=[](void* buf, size_t newSize)->void*{
-				if(newSize>bufSize)
-					throw std::invalid_argument("newSize>bufferSize");
-				return buf;
-			};
-			MutexGuard m(mutex);
-			for(size_t i=0;i<bufCount;i++){
-				if(!usedBuffers[i]){
-					usedBuffers[i]=1;
-					return Buffer::Wrap(bufferStart+(bufSize*i), bufSize, freeFn, resizeFn);
+			uint32_t index=NO_BUFFER;
+			if(threadCacheSize>0){
+				ThreadCache& cache=GetThreadCache();
+				if(cache.count==0)
+					cache.count=PopMany(cache.indices, threadCacheSize/2+1);
+				if(cache.count>0)
+					index=cache.indices[--cache.count];
+			}else{
+				index=Pop();
+			}
+			if(index==NO_BUFFER)
+				throw std::bad_alloc();
+#ifndef NDEBUG
+			bool wasInUse=inUse[index].exchange(true, std::memory_order_relaxed);
+			assert(!wasInUse);
+#endif
+			return Buffer::Wrap(bufferStart+(bufSize*index), bufSize, this);
+		}
+
+		virtual void Free(unsigned char* buf) override{
+			assert(buf!=NULL);
+			size_t offset=buf-bufferStart;
+			assert(offset%bufSize==0);
+			uint32_t index=(uint32_t)(offset/bufSize);
+			assert(index<bufCount);
+#ifndef NDEBUG
+			// catches double frees, even if they race with each other
+			bool wasInUse=inUse[index].exchange(false, std::memory_order_relaxed);
+			assert(wasInUse);
+#endif
+			if(threadCacheSize>0){
+				ThreadCache& cache=GetThreadCache();
+				if(cache.count==threadCacheSize){
+					// give half back so that threads that only release don't sit on too many buffers
+					while(cache.count>threadCacheSize/2){
+						Push(cache.indices[--cache.count]);
+					}
 				}
+				cache.indices[cache.count++]=index;
+			}else{
+				Push(index);
 			}
-			throw std::bad_alloc();
+		}
+
+		virtual unsigned char* Realloc(unsigned char* buf, size_t newSize) override{
+			if(newSize>bufSize)
+				throw std::invalid_argument("newSize>bufferSize");
+			return buf;
 		}
 
 	private:
-		std::bitset<bufCount> usedBuffers;
+		static const uint32_t NO_BUFFER=(uint32_t)bufCount;
+
+		struct ThreadCache{
+			BufferPool* pool=NULL;
+			size_t count=0;
+			uint32_t indices[threadCacheSize>0 ? threadCacheSize : 1];
+
+			~ThreadCache(){
+				while(count>0){
+					pool->Push(indices[--count]);
+				}
+			}
+		};
+
+		ThreadCache& GetThreadCache(){
+			static thread_local ThreadCache cache;
+			assert(!cache.pool || cache.pool==this);
+			cache.pool=this;
+			return cache;
+		}
+
+		uint32_t Pop(){
+			uint64_t head=freeHead.load(std::memory_order_acquire);
+			while(true){
+				uint32_t index=(uint32_t)head;
+				if(index==NO_BUFFER)
+					return NO_BUFFER;
+				// may read a stale value if someone else pops this one first, but then the tag won't match
+				uint32_t nextIndex=next[index].load(std::memory_order_relaxed);
+				uint64_t newHead=(((head >> 32)+1) << 32) | nextIndex;
+				if(freeHead.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire))
+					return index;
+			}
+		}
+
+		size_t PopMany(uint32_t* indices, size_t count){
+			size_t i=0;
+			for(;i<count;i++){
+				indices[i]=Pop();
+				if(indices[i]==NO_BUFFER)
+					break;
+			}
+			return i;
+		}
+
+		void Push(uint32_t index){
+			uint64_t head=freeHead.load(std::memory_order_relaxed);
+			uint64_t newHead;
+			do{
+				next[index].store((uint32_t)head, std::memory_order_relaxed);
+				newHead=(((head >> 32)+1) << 32) | index;
+			}while(!freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+		}
+
 		unsigned char* bufferStart;
-		Mutex mutex;
+		// tag in the upper 32 bits, index of the first free buffer in the lower 32
+		std::atomic<uint64_t> freeHead;
+		std::array<std::atomic<uint32_t>, bufCount> next;
+#ifndef NDEBUG
+		std::array<std::atomic<bool>, bufCount> inUse;
+#endif
 	};
 }
 
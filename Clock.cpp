@@ -0,0 +1,70 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <atomic>
+#include <chrono>
+#include "Clock.h"
+
+using namespace tgvoip;
+
+// how often threads waiting on a manually advanced clock check whether it has moved
+#define SIMULATED_CLOCK_POLL_INTERVAL 0.001
+
+static std::atomic<Clock*> currentClock(NULL);
+
+static double GetRealTime(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Clock::~Clock(){
+
+}
+
+double Clock::GetRealDuration(double duration){
+	return duration;
+}
+
+void Clock::SetCurrent(Clock* clock){
+	currentClock=clock;
+}
+
+Clock* Clock::GetCurrent(){
+	return currentClock;
+}
+
+double Clock::ToRealDuration(double duration){
+	Clock* clock=currentClock;
+	return clock ? clock->GetRealDuration(duration) : duration;
+}
+
+#pragma mark - SimulatedClock
+
+SimulatedClock::SimulatedClock(double speed, double startTime) : speed(speed), baseTime(startTime){
+	realBaseTime=GetRealTime();
+}
+
+SimulatedClock::~SimulatedClock(){
+	if(currentClock==this)
+		currentClock=NULL;
+}
+
+double SimulatedClock::GetTime(){
+	MutexGuard m(mutex);
+	if(speed==0.0)
+		return baseTime;
+	return baseTime+(GetRealTime()-realBaseTime)*speed;
+}
+
+double SimulatedClock::GetRealDuration(double duration){
+	if(speed==0.0)
+		return duration>0.0 ? SIMULATED_CLOCK_POLL_INTERVAL : 0.0;
+	return duration/speed;
+}
+
+void SimulatedClock::Advance(double seconds){
+	MutexGuard m(mutex);
+	baseTime+=seconds;
+}
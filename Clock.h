@@ -0,0 +1,68 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_CLOCK_H
+#define LIBTGVOIP_CLOCK_H
+
+#include "threading.h"
+
+namespace tgvoip{
+	/**
+	 * A source of time for VoIPController::GetCurrentTime() and everything that schedules by it.
+	 * Normally none is installed and the monotonic system clock is used. Tests and benchmarks can install
+	 * a SimulatedClock to run calls faster than real time.
+	 */
+	class Clock{
+	public:
+		virtual ~Clock();
+		/**
+		 * @return the current time in seconds
+		 */
+		virtual double GetTime()=0;
+		/**
+		 * How long to actually wait, in real seconds, for this clock to advance by the given amount.
+		 * Threads sleeping on timers use this to convert their timeouts.
+		 */
+		virtual double GetRealDuration(double duration);
+
+		/**
+		 * Installs the clock used by the whole library, or removes it if clock is NULL.
+		 * The caller keeps the ownership. Do this before any calls are started and don't change it while they're running.
+		 */
+		static void SetCurrent(Clock* clock);
+		static Clock* GetCurrent();
+		/**
+		 * Same as GetCurrent()->GetRealDuration(), or the duration itself if no clock is installed.
+		 */
+		static double ToRealDuration(double duration);
+	};
+
+	/**
+	 * A clock that either runs at a multiple of real time or only moves when told to.
+	 */
+	class SimulatedClock : public Clock{
+	public:
+		/**
+		 * @param speed how many simulated seconds pass per real second, or 0 for the time to only change with Advance()
+		 * @param startTime the initial time; a lot of code uses 0 for "never", so don't start near it
+		 */
+		SimulatedClock(double speed=0.0, double startTime=1000.0);
+		virtual ~SimulatedClock();
+		virtual double GetTime();
+		virtual double GetRealDuration(double duration);
+		/**
+		 * Moves the time forward. Works in both modes.
+		 */
+		void Advance(double seconds);
+	private:
+		Mutex mutex;
+		double speed;
+		double baseTime;
+		double realBaseTime;
+	};
+}
+
+#endif //LIBTGVOIP_CLOCK_H
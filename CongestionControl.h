@@ -44,8 +44,8 @@ public:
 	uint32_t GetSendLossCount();
 
 private:
-	HistoricBuffer<double, 100> rttHistory;
-	HistoricBuffer<size_t, 30> inflightHistory;
+	AggregatingHistoricBuffer<double, 100> rttHistory;
+	AggregatingHistoricBuffer<size_t, 30> inflightHistory;
 	tgvoip_congestionctl_packet_t inflightPackets[100];
 	uint32_t lossCount;
 	double tmpRtt;
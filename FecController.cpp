@@ -0,0 +1,225 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "FecController.h"
+#include "VoIPServerConfig.h"
+#include "PrivateDefines.h"
+#include "logging.h"
+
+// below this many packets the statistics aren't trusted and the fixed defaults are used
+#define FEC_MIN_PACKETS 200
+// applied to the statistics on every Update(), i.e. about once a second
+#define FEC_STATS_DECAY 0.95
+// the receiver can only keep this many frames around for FEC
+#define FEC_MAX_FRAMES_PER_GROUP 3
+#define FEC_MAX_AUDIO_REDUNDANCY 4
+
+using namespace tgvoip;
+
+FecController::FecController(){
+	memset(burstCounts, 0, sizeof(burstCounts));
+	targetResidualLoss=ServerConfig::GetSharedInstance()->GetDouble("fec_target_residual_loss", 0.002);
+	audioTargetResidualLoss=ServerConfig::GetSharedInstance()->GetDouble("audio_ec_target_residual_loss", 0.005);
+	maxOverhead=ServerConfig::GetSharedInstance()->GetDouble("video_fec_max_overhead", 0.5);
+	defaultCM256Overhead=ServerConfig::GetSharedInstance()->GetDouble("video_fec_cm256_overhead", 0.25);
+}
+
+FecController::~FecController(){
+}
+
+void FecController::PacketReceived(){
+	if(currentBurst>0){
+		burstCounts[std::min(currentBurst, (unsigned int)FEC_MAX_BURST_LENGTH)-1]+=1.0;
+		currentBurst=0;
+	}
+	packetCount+=1.0;
+	totalPacketCount++;
+}
+
+void FecController::PacketLost(){
+	currentBurst++;
+	packetCount+=1.0;
+	lostCount+=1.0;
+	totalPacketCount++;
+}
+
+void FecController::Update(){
+	for(double& count:burstCounts){
+		count*=FEC_STATS_DECAY;
+	}
+	packetCount*=FEC_STATS_DECAY;
+	lostCount*=FEC_STATS_DECAY;
+
+	unsigned int prevFramesPerGroup=videoFramesPerGroup;
+	int prevAudioRedundancy=audioRedundancy;
+	if(!HasEnoughData()){
+		videoFramesPerGroup=FEC_MAX_FRAMES_PER_GROUP;
+		audioRedundancy=-1;
+		return;
+	}
+
+	// bigger groups need less redundancy for the same protection but take longer to recover; prefer the smaller one if it's as cheap
+	if(avgVideoPacketsPerFrame>0.0){
+		double bestOverhead=INFINITY, bestResidual=INFINITY;
+		bool bestMeetsTarget=false;
+		for(unsigned int frames=1;frames<=FEC_MAX_FRAMES_PER_GROUP;frames++){
+			unsigned int dataCount=std::max(1U, (unsigned int)round(avgVideoPacketsPerFrame*frames));
+			double residual;
+			VideoFecParams params=ChooseVideoFec(dataCount, cm256WasAvailable, residual);
+			double overhead=(double)params.recoveryCount/dataCount;
+			bool meetsTarget=residual<=targetResidualLoss;
+			if((meetsTarget && (!bestMeetsTarget || overhead<bestOverhead)) || (!meetsTarget && !bestMeetsTarget && residual<bestResidual)){
+				bestOverhead=overhead;
+				bestResidual=residual;
+				bestMeetsTarget=meetsTarget;
+				videoFramesPerGroup=frames;
+			}
+		}
+	}
+
+	// with extra EC, a frame is only lost if its own packet and the next N ones that carry it are all lost,
+	// which the burst histogram tells directly
+	audioRedundancy=FEC_MAX_AUDIO_REDUNDANCY;
+	for(int redundancy=0;redundancy<FEC_MAX_AUDIO_REDUNDANCY;redundancy++){
+		double lostFrames=0.0;
+		for(int len=redundancy+1;len<=FEC_MAX_BURST_LENGTH;len++){
+			lostFrames+=burstCounts[len-1]*(len-redundancy);
+		}
+		if(lostFrames/packetCount<=audioTargetResidualLoss){
+			audioRedundancy=redundancy;
+			break;
+		}
+	}
+
+	if(prevFramesPerGroup!=videoFramesPerGroup || prevAudioRedundancy!=audioRedundancy){
+		LOGD("FEC: loss %.2f%%, mean burst %.2f; video frames per group %u, audio redundancy %d", GetLossRate()*100.0, GetMeanBurstLength(), videoFramesPerGroup, audioRedundancy);
+	}
+}
+
+void FecController::VideoFrameSent(unsigned int packetCount){
+	if(avgVideoPacketsPerFrame==0.0)
+		avgVideoPacketsPerFrame=packetCount;
+	else
+		avgVideoPacketsPerFrame=avgVideoPacketsPerFrame*0.9+packetCount*0.1;
+}
+
+unsigned int FecController::GetVideoFramesPerGroup(){
+	return videoFramesPerGroup;
+}
+
+FecController::VideoFecParams FecController::GetVideoFecParams(unsigned int dataPacketCount, bool cm256Available){
+	cm256WasAvailable=cm256Available;
+	double residual;
+	VideoFecParams params=ChooseVideoFec(dataPacketCount, cm256Available, residual);
+	lastVideoFec=params;
+	lastVideoDataCount=dataPacketCount;
+	lastVideoResidualLoss=residual;
+	return params;
+}
+
+int FecController::GetAudioRedundancy(){
+	return audioRedundancy;
+}
+
+double FecController::GetLossRate(){
+	return packetCount>0.0 ? lostCount/packetCount : 0.0;
+}
+
+double FecController::GetMeanBurstLength(){
+	double bursts=0.0;
+	for(double count:burstCounts){
+		bursts+=count;
+	}
+	return bursts>0.0 ? lostCount/bursts : 0.0;
+}
+
+std::string FecController::GetDebugString(){
+	char buffer[256];
+	if(!HasEnoughData()){
+		snprintf(buffer, sizeof(buffer), "FEC: collecting loss statistics (%u packets)", totalPacketCount);
+		return std::string(buffer);
+	}
+	snprintf(buffer, sizeof(buffer), "FEC: loss %.2f%%, mean burst %.2f, audio EC %d", GetLossRate()*100.0, GetMeanBurstLength(), audioRedundancy);
+	std::string r=buffer;
+	if(lastVideoDataCount){
+		snprintf(buffer, sizeof(buffer), "\nVideo FEC: %s %u/%u, %u frames/group, residual loss %.3f%%", lastVideoFec.recoveryCount==0 ? "none" : (lastVideoFec.scheme==FEC_SCHEME_CM256 ? "CM256" : "XOR"),
+				 lastVideoFec.recoveryCount, lastVideoDataCount, videoFramesPerGroup, lastVideoResidualLoss*100.0);
+		r+=buffer;
+	}
+	return r;
+}
+
+bool FecController::HasEnoughData(){
+	return totalPacketCount>=FEC_MIN_PACKETS && packetCount>0.0;
+}
+
+double FecController::GetResidualLoss(unsigned int dataCount, unsigned int recoveryCount){
+	// Gilbert model: good and bad states, every packet sent in the bad state is lost.
+	// pGoodToBad is how often a burst starts after a received packet, pBadToGood is 1/mean burst length
+	double lossRate=GetLossRate();
+	double bursts=0.0;
+	for(double count:burstCounts){
+		bursts+=count;
+	}
+	if(lossRate==0.0 || bursts==0.0)
+		return 0.0;
+	double pBadToGood=std::min(1.0, bursts/lostCount);
+	double pGoodToBad=std::min(1.0, bursts/std::max(1.0, packetCount-lostCount));
+
+	// probabilities of being in each state after i packets with k of them lost, k capped at recoveryCount+1
+	unsigned int maxLost=recoveryCount+1;
+	std::vector<double> good(maxLost+1, 0.0), bad(maxLost+1, 0.0), nextGood(maxLost+1), nextBad(maxLost+1);
+	good[0]=1.0-lossRate;
+	bad[1]=lossRate;
+	for(unsigned int i=1;i<dataCount+recoveryCount;i++){
+		std::fill(nextGood.begin(), nextGood.end(), 0.0);
+		std::fill(nextBad.begin(), nextBad.end(), 0.0);
+		for(unsigned int k=0;k<=maxLost;k++){
+			nextGood[k]+=good[k]*(1.0-pGoodToBad)+bad[k]*pBadToGood;
+			unsigned int lost=std::min(k+1, maxLost);
+			nextBad[lost]+=good[k]*pGoodToBad+bad[k]*(1.0-pBadToGood);
+		}
+		good.swap(nextGood);
+		bad.swap(nextBad);
+	}
+	return good[maxLost]+bad[maxLost];
+}
+
+FecController::VideoFecParams FecController::ChooseVideoFec(unsigned int dataPacketCount, bool cm256Available, double& residualLoss){
+	VideoFecParams params;
+	params.scheme=FEC_SCHEME_XOR;
+	params.recoveryCount=1;
+	if(!HasEnoughData()){
+		residualLoss=-1.0;
+		if(cm256Available){
+			unsigned int recoveryCount=std::max(1U, (unsigned int)ceil(dataPacketCount*defaultCM256Overhead));
+			if(dataPacketCount+recoveryCount<=256){
+				params.scheme=FEC_SCHEME_CM256;
+				params.recoveryCount=recoveryCount;
+			}
+		}
+		return params;
+	}
+
+	unsigned int maxRecoveryCount=1;
+	if(cm256Available && dataPacketCount<256)
+		maxRecoveryCount=std::max(1U, std::min(256-dataPacketCount, (unsigned int)ceil(dataPacketCount*maxOverhead)));
+	// the residual loss only goes down with more recovery packets, so the first count that meets the target is the cheapest
+	for(unsigned int recoveryCount=0;recoveryCount<=maxRecoveryCount;recoveryCount++){
+		residualLoss=GetResidualLoss(dataPacketCount, recoveryCount);
+		params.recoveryCount=recoveryCount;
+		if(residualLoss<=targetResidualLoss)
+			break;
+	}
+	// any single loss can be repaired with parity, which every peer supports
+	params.scheme=params.recoveryCount>1 ? FEC_SCHEME_CM256 : FEC_SCHEME_XOR;
+	return params;
+}
@@ -0,0 +1,104 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_FECCONTROLLER_H
+#define LIBTGVOIP_FECCONTROLLER_H
+
+#include <stdint.h>
+#include <string>
+
+// burst lengths from 1 to this are counted separately, longer ones go into the last bucket
+#define FEC_MAX_BURST_LENGTH 16
+
+namespace tgvoip{
+
+/**
+ * Decides how much redundancy to send based on how the outgoing packets get lost.
+ * It keeps a decaying histogram of loss burst lengths, fits a two-state (Gilbert) loss model to it, and picks
+ * the cheapest FEC setting that keeps the residual loss under a target: the scheme, group size and recovery packet count
+ * for video, and the number of redundant frames for audio extra EC.
+ * Everything except the debug getters must be called on the message thread.
+ */
+class FecController{
+public:
+	struct VideoFecParams{
+		/**
+		 * FEC_SCHEME_XOR or FEC_SCHEME_CM256
+		 */
+		unsigned int scheme;
+		/**
+		 * How many recovery packets to send for the group, 0 for none
+		 */
+		unsigned int recoveryCount;
+	};
+
+	FecController();
+	~FecController();
+
+	/**
+	 * Report the fate of every outgoing packet, in the order of sequence numbers.
+	 */
+	void PacketReceived();
+	void PacketLost();
+	/**
+	 * Call about once a second. Ages the statistics and reconsiders the decisions.
+	 */
+	void Update();
+	/**
+	 * Report how many packets a video frame was split into.
+	 */
+	void VideoFrameSent(unsigned int packetCount);
+
+	/**
+	 * @return how many video frames should share one FEC group
+	 */
+	unsigned int GetVideoFramesPerGroup();
+	/**
+	 * @param dataPacketCount how many data packets the group has
+	 * @param cm256Available whether both sides can use CM256
+	 */
+	VideoFecParams GetVideoFecParams(unsigned int dataPacketCount, bool cm256Available);
+	/**
+	 * @return how many previous audio frames to attach to each packet in extra EC mode, or -1 if there's not enough data yet
+	 */
+	int GetAudioRedundancy();
+
+	double GetLossRate();
+	double GetMeanBurstLength();
+	std::string GetDebugString();
+
+private:
+	bool HasEnoughData();
+	/**
+	 * @return the probability that more than recoveryCount of dataCount+recoveryCount consecutive packets are lost
+	 */
+	double GetResidualLoss(unsigned int dataCount, unsigned int recoveryCount);
+	VideoFecParams ChooseVideoFec(unsigned int dataPacketCount, bool cm256Available, double& residualLoss);
+
+	double burstCounts[FEC_MAX_BURST_LENGTH];
+	double packetCount=0.0;
+	double lostCount=0.0;
+	unsigned int currentBurst=0;
+	uint32_t totalPacketCount=0;
+
+	double avgVideoPacketsPerFrame=0.0;
+	unsigned int videoFramesPerGroup=3;
+	bool cm256WasAvailable=false;
+	int audioRedundancy=-1;
+
+	// the last decision, for the debug string
+	VideoFecParams lastVideoFec={};
+	unsigned int lastVideoDataCount=0;
+	double lastVideoResidualLoss=0.0;
+
+	double targetResidualLoss;
+	double audioTargetResidualLoss;
+	double maxOverhead;
+	double defaultCM256Overhead;
+};
+}
+
+#endif //LIBTGVOIP_FECCONTROLLER_H
@@ -9,9 +9,34 @@
 #include "logging.h"
 #include "VoIPServerConfig.h"
 #include <math.h>
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 using namespace tgvoip;
 
+static_assert(JITTER_SLOT_COUNT<=64 && (JITTER_SLOT_COUNT & (JITTER_SLOT_COUNT-1))==0, "JITTER_SLOT_COUNT must be a power of 2 not greater than 64");
+
+static inline unsigned int LowestSetBit(uint64_t mask){
+#if defined(__GNUC__) || defined(__clang__)
+	return (unsigned int)__builtin_ctzll(mask);
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if(_BitScanForward(&index, (unsigned long)mask))
+		return (unsigned int)index;
+	_BitScanForward(&index, (unsigned long)(mask >> 32));
+	return (unsigned int)index+32;
+#else
+	unsigned int index=0;
+	while(!(mask & 1)){
+		mask>>=1;
+		index++;
+	}
+	return index;
+#endif
+}
+
 JitterBuffer::JitterBuffer(MediaStreamItf *out, uint32_t step){
 	if(out)
 		out->SetCallback(JitterBuffer::CallbackOut, this);
@@ -32,6 +57,7 @@ JitterBuffer::JitterBuffer(MediaStreamItf *out, uint32_t step){
 	}
 	lossesToReset=(uint32_t) ServerConfig::GetSharedInstance()->GetInt("jitter_losses_to_reset", 20);
 	resyncThreshold=ServerConfig::GetSharedInstance()->GetDouble("jitter_resync_threshold", 1.0);
+	maxTimeStretch=ServerConfig::GetSharedInstance()->GetDouble("jitter_max_time_stretch", 0.1);
 #ifdef TGVOIP_DUMP_JITTER_STATS
 #ifdef TGVOIP_JITTER_DUMP_FILE
 	dump=fopen(TGVOIP_JITTER_DUMP_FILE, "w");
@@ -86,11 +112,8 @@ void JitterBuffer::Reset(){
 	wasReset=true;
 	needBuffering=true;
 	lastPutTimestamp=0;
-	int i;
-	for(i=0;i<JITTER_SLOT_COUNT;i++){
-		if(!slots[i].buffer.IsEmpty()){
-			slots[i].buffer=Buffer();
-		}
+	while(usedSlots){
+		FreeSlot(LowestSetBit(usedSlots));
 	}
 	delayHistory.Reset();
 	lateHistory.Reset();
@@ -115,13 +138,9 @@ size_t JitterBuffer::HandleOutput(unsigned char *buffer, size_t len, int offsetI
 		if(GetCurrentDelay()>5){
 			LOGW("jitter: delay too big upon start (%u), dropping packets", delay);
 			while(delay>GetMinPacketCount()){
-				for(int i=0;i<JITTER_SLOT_COUNT;i++){
-					if(slots[i].timestamp==nextTimestamp){
-						if(!slots[i].buffer.IsEmpty()){
-    						slots[i].buffer=Buffer();
-						}
-						break;
-					}
+				unsigned int i=SlotForTimestamp(nextTimestamp);
+				if(IsSlotUsed(i) && slots[i].timestamp==nextTimestamp){
+					FreeSlot(i);
 				}
 				Advance();
 				delay--;
@@ -130,19 +149,17 @@ size_t JitterBuffer::HandleOutput(unsigned char *buffer, size_t len, int offsetI
 	}
 	int result=GetInternal(&pkt, offsetInSteps, advance);
 	if(outstandingDelayChange!=0){
-		if(outstandingDelayChange<0){
-			playbackScaledDuration=40;
-			outstandingDelayChange+=20;
-		}else{
-			playbackScaledDuration=80;
-			outstandingDelayChange-=20;
-		}
+		// the decoder time-stretches the frame, so the delay can move by a few ms per frame instead of whole packets
+		int maxChange=std::max(1, (int)round(step*maxTimeStretch));
+		int change=std::max(-maxChange, std::min(maxChange, outstandingDelayChange));
+		playbackScaledDuration=(int)step+change;
+		outstandingDelayChange-=change;
 		//LOGV("outstanding delay change: %d", outstandingDelayChange);
 	}else if(advance && GetCurrentDelay()==0){
 		//LOGV("stretching packet because the next one is late");
-		playbackScaledDuration=80;
+		playbackScaledDuration=(int)(step+step/3);
 	}else{
-		playbackScaledDuration=60;
+		playbackScaledDuration=(int)step;
 	}
 	if(result==JR_OK){
 		isEC=pkt.isEC;
@@ -164,14 +181,9 @@ int JitterBuffer::GetInternal(jitter_packet_t* pkt, int offset, bool advance){
 
 	int64_t timestampToGet=nextTimestamp+offset*(int32_t)step;
 
-	int i;
-	for(i=0;i<JITTER_SLOT_COUNT;i++){
-		if(!slots[i].buffer.IsEmpty() && slots[i].timestamp==timestampToGet){
-			break;
-		}
-	}
+	unsigned int i=SlotForTimestamp(timestampToGet);
 
-	if(i<JITTER_SLOT_COUNT){
+	if(IsSlotUsed(i) && slots[i].timestamp==timestampToGet){
 		if(pkt && pkt->size<slots[i].size){
 			LOGE("jitter: packet won't fit into provided buffer of %d (need %d)", int(slots[i].size), int(pkt->size));
 		}else{
@@ -182,7 +194,7 @@ int JitterBuffer::GetInternal(jitter_packet_t* pkt, int offset, bool advance){
 				pkt->isEC=slots[i].isEC;
 			}
 		}
-		slots[i].buffer=Buffer();
+		FreeSlot(i);
 		if(offset==0)
 			Advance();
 		lostCount=0;
@@ -223,17 +235,15 @@ void JitterBuffer::PutInternal(jitter_packet_t* pkt, bool overwriteExisting){
 		return;
 	}
 
-	int i;
-	for(i=0;i<JITTER_SLOT_COUNT;i++){
-		if(!slots[i].buffer.IsEmpty() && slots[i].timestamp==pkt->timestamp){
-			//LOGV("Found existing packet for timestamp %u, overwrite %d", pkt->timestamp, overwriteExisting);
-			if(overwriteExisting){
-				slots[i].buffer.CopyFrom(pkt->buffer, pkt->size);
-				slots[i].size=pkt->size;
-				slots[i].isEC=pkt->isEC;
-			}
-			return;
+	unsigned int i=SlotForTimestamp(pkt->timestamp);
+	if(IsSlotUsed(i) && slots[i].timestamp==pkt->timestamp){
+		//LOGV("Found existing packet for timestamp %u, overwrite %d", pkt->timestamp, overwriteExisting);
+		if(overwriteExisting){
+			slots[i].buffer.CopyFrom(pkt->buffer, pkt->size);
+			slots[i].size=pkt->size;
+			slots[i].isEC=pkt->isEC;
 		}
+		return;
 	}
 	gotSinceReset++;
 	if(wasReset){
@@ -244,11 +254,10 @@ void JitterBuffer::PutInternal(jitter_packet_t* pkt, bool overwriteExisting){
 		LOGI("jitter: resyncing, next timestamp = %lld (step=%d, minDelay=%f)", (long long int)nextTimestamp, step, minDelay);
 	}
 	
-	for(i=0;i<JITTER_SLOT_COUNT;i++){
-		if(!slots[i].buffer.IsEmpty()){
-			if(slots[i].timestamp<nextTimestamp-1){
-				slots[i].buffer=Buffer();
-			}
+	for(uint64_t used=usedSlots;used;used&=used-1){
+		unsigned int j=LowestSetBit(used);
+		if(slots[j].timestamp<nextTimestamp-1){
+			FreeSlot(j);
 		}
 	}
 
@@ -283,23 +292,28 @@ void JitterBuffer::PutInternal(jitter_packet_t* pkt, bool overwriteExisting){
 	if(pkt->timestamp>lastPutTimestamp)
 		lastPutTimestamp=pkt->timestamp;
 
-	for(i=0;i<JITTER_SLOT_COUNT;i++){
-		if(slots[i].buffer.IsEmpty())
-			break;
+	// checked before making room below, so that a packet that's dropped here doesn't cost another one too
+	if(IsSlotUsed(i)){
+		// the slot holds a packet JITTER_SLOT_COUNT steps away from this one; keep the one that's due first
+		if(slots[i].timestamp<pkt->timestamp)
+			return;
+		FreeSlot(i);
 	}
-	if(i==JITTER_SLOT_COUNT || GetCurrentDelay()>=maxUsedSlots){
-		int toRemove=JITTER_SLOT_COUNT;
+	if(usedSlotCount>=maxUsedSlots){
+		unsigned int toRemove=0;
 		uint32_t bestTimestamp=0xFFFFFFFF;
-		for(i=0;i<JITTER_SLOT_COUNT;i++){
-			if(!slots[i].buffer.IsEmpty() && slots[i].timestamp<bestTimestamp){
-				toRemove=i;
-				bestTimestamp=slots[i].timestamp;
+		for(uint64_t used=usedSlots;used;used&=used-1){
+			unsigned int j=LowestSetBit(used);
+			if(slots[j].timestamp<bestTimestamp){
+				toRemove=j;
+				bestTimestamp=slots[j].timestamp;
 			}
 		}
 		Advance();
-		slots[toRemove].buffer=Buffer();
-		i=toRemove;
+		FreeSlot(toRemove);
 	}
+	usedSlots|=1ULL << i;
+	usedSlotCount++;
 	slots[i].timestamp=pkt->timestamp;
 	slots[i].size=pkt->size;
 	slots[i].buffer=bufferPool.Get();
@@ -318,19 +332,26 @@ void JitterBuffer::Advance(){
 }
 
 
+unsigned int JitterBuffer::SlotForTimestamp(int64_t timestamp){
+	return (unsigned int)((uint64_t)(timestamp/(int64_t)step) & (JITTER_SLOT_COUNT-1));
+}
+
+bool JitterBuffer::IsSlotUsed(unsigned int i){
+	return (usedSlots & (1ULL << i))!=0;
+}
+
+void JitterBuffer::FreeSlot(unsigned int i){
+	slots[i].buffer=Buffer();
+	usedSlots&=~(1ULL << i);
+	usedSlotCount--;
+}
+
 unsigned int JitterBuffer::GetCurrentDelay(){
-	unsigned int delay=0;
-	int i;
-	for(i=0;i<JITTER_SLOT_COUNT;i++){
-		if(!slots[i].buffer.IsEmpty())
-			delay++;
-	}
-	return delay;
+	return usedSlotCount;
 }
 
 void JitterBuffer::Tick(){
 	MutexGuard m(mutex);
-	int i;
 
 	lateHistory.Add(latePacketCount);
 	latePacketCount=0;
@@ -351,13 +372,7 @@ void JitterBuffer::Tick(){
 	delayHistory.Add(GetCurrentDelay());
 	avgDelay=delayHistory.Average(32);
 
-	double stddev=0;
-	double avgdev=deviationHistory.Average();
-	for(i=0;i<64;i++){
-		double d=(deviationHistory[i]-avgdev);
-		stddev+=(d*d);
-	}
-	stddev=sqrt(stddev/64);
+	double stddev=sqrt(deviationHistory.Variance());
 	uint32_t stddevDelay=(uint32_t)ceil(stddev*2*1000/step);
 	if(stddevDelay<minMinDelay)
 		stddevDelay=minMinDelay;
@@ -375,7 +390,7 @@ void JitterBuffer::Tick(){
 		if((diff>0 && dontIncMinDelay==0) || (diff<0 && dontDecMinDelay==0)){
 			//nextTimestamp+=diff*(int32_t)step;
 			minDelay+=diff;
-			outstandingDelayChange+=diff*60;
+			outstandingDelayChange+=diff*(int32_t)step;
 			dontChangeDelay+=32;
 			//LOGD("new delay from stddev %f", minDelay);
 			if(diff<0){
@@ -390,11 +405,10 @@ void JitterBuffer::Tick(){
 	lastMeasuredDelay=stddevDelay;
 	//LOGV("stddev=%.3f, avg=%.3f, ndelay=%d, dontDec=%u", stddev, avgdev, stddevDelay, dontDecMinDelay);
 	if(dontChangeDelay==0){
-		if(avgDelay>minDelay+0.5){
-			outstandingDelayChange-=avgDelay>minDelay+2 ? 60 : 20;
-			dontChangeDelay+=10;
-		}else if(avgDelay<minDelay-0.3){
-			outstandingDelayChange+=20;
+		if(avgDelay>minDelay+0.5 || avgDelay<minDelay-0.3){
+			// correct by the actual difference, up to one packet at a time
+			int32_t correction=(int32_t)round((minDelay-avgDelay)*step);
+			outstandingDelayChange+=std::max(-(int32_t)step, std::min((int32_t)step, correction));
 			dontChangeDelay+=10;
 		}
 	}
@@ -15,6 +15,7 @@
 #include "Buffers.h"
 #include "threading.h"
 
+// packets are stored in slot (timestamp/step)%JITTER_SLOT_COUNT; must be a power of 2 that fits into the occupancy mask
 #define JITTER_SLOT_COUNT 64
 #define JITTER_SLOT_SIZE 1024
 #define JR_OK 1
@@ -53,10 +54,15 @@ private:
 	void PutInternal(jitter_packet_t* pkt, bool overwriteExisting);
 	int GetInternal(jitter_packet_t* pkt, int offset, bool advance);
 	void Advance();
+	unsigned int SlotForTimestamp(int64_t timestamp);
+	bool IsSlotUsed(unsigned int i);
+	void FreeSlot(unsigned int i);
 
 	BufferPool<JITTER_SLOT_SIZE, JITTER_SLOT_COUNT> bufferPool;
 	Mutex mutex;
 	jitter_packet_t slots[JITTER_SLOT_COUNT];
+	uint64_t usedSlots=0; // bit i is set when slots[i] holds a packet
+	unsigned int usedSlotCount=0;
 	int64_t nextTimestamp=0;
 	uint32_t step;
 	double minDelay=6;
@@ -66,13 +72,14 @@ private:
 	uint32_t lastPutTimestamp;
 	uint32_t lossesToReset;
 	double resyncThreshold;
+	double maxTimeStretch;
 	unsigned int lostCount=0;
 	unsigned int lostSinceReset=0;
 	unsigned int gotSinceReset=0;
 	bool wasReset=true;
 	bool needBuffering=true;
 	HistoricBuffer<int, 64, double> delayHistory;
-	HistoricBuffer<int, 64, double> lateHistory;
+	AggregatingHistoricBuffer<int, 64, double> lateHistory;
 	bool adjustingDelay=false;
 	unsigned int tickCount=0;
 	unsigned int latePacketCount=0;
@@ -81,7 +88,7 @@ private:
 	int lostPackets=0;
 	double prevRecvTime=0;
 	double expectNextAtTime=0;
-	HistoricBuffer<double, 64> deviationHistory;
+	AggregatingHistoricBuffer<double, 64> deviationHistory;
 	double lastMeasuredJitter=0;
 	double lastMeasuredDelay=0;
 	int outstandingDelayChange=0;
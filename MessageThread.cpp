@@ -7,19 +7,26 @@
 #include <math.h>
 #include <float.h>
 #include <stdint.h>
+#include <algorithm>
 
 #ifndef _WIN32
 #include <sys/time.h>
 #endif
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define TGVOIP_MESSAGE_THREAD_MONOTONIC_CLOCK
+#endif
+
 #include "MessageThread.h"
 #include "VoIPController.h"
+#include "Clock.h"
 #include "logging.h"
 
 using namespace tgvoip;
 
 MessageThread::MessageThread() : Thread(std::bind(&MessageThread::Run, this)){
 	running=true;
+	currentPoolThread=NULL;
 	SetName("MessageThread");
 
 #ifdef _WIN32
@@ -29,7 +36,7 @@ MessageThread::MessageThread() : Thread(std::bind(&MessageThread::Run, this)){
 	event=CreateEventEx(NULL, NULL, 0, EVENT_ALL_ACCESS);
 #endif
 #else
-	pthread_cond_init(&cond, NULL);
+	InitCondition(&cond);
 #endif
 }
 
@@ -42,9 +49,32 @@ MessageThread::~MessageThread(){
 #endif
 }
 
+void MessageThread::SetPool(MessageThreadPool* pool){
+	this->pool=pool;
+}
+
+void MessageThread::Start(){
+	if(pool)
+		pool->Add(this);
+	else
+		Thread::Start();
+}
+
+bool MessageThread::IsCurrent(){
+	if(pool){
+		Thread* worker=currentPoolThread;
+		return worker && worker->IsCurrent();
+	}
+	return Thread::IsCurrent();
+}
+
 void MessageThread::Stop(){
 	if(running){
 		running=false;
+		if(pool){
+			pool->Remove(this);
+			return;
+		}
 #ifdef _WIN32
 		SetEvent(event);
 #else
@@ -57,8 +87,9 @@ void MessageThread::Stop(){
 void MessageThread::Run(){
 	queueMutex.Lock();
 	while(running){
-		double currentTime=VoIPController::GetCurrentTime();
-		double waitTimeout=queue.empty() ? DBL_MAX : (queue[0].deliverAt-currentTime);
+		double waitTimeout=GetNextDeliveryTime();
+		if(waitTimeout!=DBL_MAX)
+			waitTimeout=Clock::ToRealDuration(waitTimeout-VoIPController::GetCurrentTime());
 		//LOGW("MessageThread wait timeout %f", waitTimeout);
 		if(waitTimeout>0.0){
 #ifdef _WIN32
@@ -73,63 +104,95 @@ void MessageThread::Run(){
 			// since any new no-delay messages will get delivered on this iteration anyway
 			queueMutex.Lock();
 #else
-			if(waitTimeout!=DBL_MAX){
-				struct timeval now;
-				struct timespec timeout;
-				gettimeofday(&now, NULL);
-				waitTimeout+=now.tv_sec;
-				waitTimeout+=(now.tv_usec/1000000.0);
-				timeout.tv_sec=(time_t)(floor(waitTimeout));
-				timeout.tv_nsec=(long)((waitTimeout-floor(waitTimeout))*1000000000.0);
-				pthread_cond_timedwait(&cond, queueMutex.NativeHandle(), &timeout);
-			}else{
-				pthread_cond_wait(&cond, queueMutex.NativeHandle());
-			}
+			WaitOnCondition(&cond, queueMutex, waitTimeout);
 #endif
 		}
 		if(!running){
 			queueMutex.Unlock();
 			return;
 		}
-		currentTime=VoIPController::GetCurrentTime();
-		std::vector<Message> msgsToDeliverNow;
-		for(std::vector<Message>::iterator m=queue.begin();m!=queue.end();){
-			if(m->deliverAt==0.0 || currentTime>=m->deliverAt){
-				msgsToDeliverNow.push_back(*m);
-				m=queue.erase(m);
-				continue;
-			}
-			++m;
-		}
+		DeliverMessages();
+	}
+	queueMutex.Unlock();
+}
 
-		for(Message& m:msgsToDeliverNow){
-			//LOGI("MessageThread delivering %u", m.msg);
-			cancelCurrent=false;
-			if(m.deliverAt==0.0)
-				m.deliverAt=VoIPController::GetCurrentTime();
-			if(m.func!=nullptr){
-				m.func();
-			}
-			if(!cancelCurrent && m.interval>0.0){
-				m.deliverAt+=m.interval;
-				InsertMessageInternal(m);
-			}
+void MessageThread::DeliverMessages(){
+	double currentTime=VoIPController::GetCurrentTime();
+	// messages posted from the callbacks, including repeating ones, wait until the next pass, just like they always did
+	uint32_t orderLimit=nextOrder;
+	while(!queue.empty()){
+		const QueueEntry& top=queue[0];
+		if((top.deliverAt!=0.0 && top.deliverAt>currentTime) || (int32_t)(top.order-orderLimit)>=0)
+			break;
+		uint16_t slot=top.slot;
+		std::pop_heap(queue.begin(), queue.end(), QueueEntryComparator());
+		queue.pop_back();
+		Message& m=messages[slot];
+		if(m.canceled){
+			FreeSlot(slot);
+			continue;
+		}
+		//LOGI("MessageThread delivering %u", m.id);
+		cancelCurrent=false;
+		if(m.deliverAt==0.0)
+			m.deliverAt=VoIPController::GetCurrentTime();
+		if(m.func){
+			m.func();
+		}
+		// the callback could've canceled itself with either method
+		if(!cancelCurrent && !m.canceled && m.interval>0.0){
+			m.deliverAt+=m.interval;
+			InsertMessageInternal(slot);
+		}else{
+			FreeSlot(slot);
 		}
-
 	}
+}
+
+double MessageThread::RunInPool(Thread* worker){
+	queueMutex.Lock();
+	currentPoolThread=worker;
+	DeliverMessages();
+	currentPoolThread=NULL;
+	double next=GetNextDeliveryTime();
 	queueMutex.Unlock();
+	return next;
 }
 
-uint32_t MessageThread::Post(std::function<void()> func, double delay, double interval){
+double MessageThread::GetNextDeliveryTime(){
+	// canceled messages are removed lazily, drop the ones at the top so they don't cause useless wakeups
+	while(!queue.empty() && messages[queue[0].slot].canceled){
+		uint16_t slot=queue[0].slot;
+		std::pop_heap(queue.begin(), queue.end(), QueueEntryComparator());
+		queue.pop_back();
+		FreeSlot(slot);
+	}
+	return queue.empty() ? DBL_MAX : queue[0].deliverAt;
+}
+
+uint32_t MessageThread::Post(Callback func, double delay, double interval){
 	assert(delay>=0);
 	//LOGI("MessageThread post [function] delay %f", delay);
-	if(!IsCurrent()){
+	bool isCurrent=IsCurrent();
+	if(!isCurrent){
 		queueMutex.Lock();
 	}
 	double currentTime=VoIPController::GetCurrentTime();
-	Message m{lastMessageID++, delay==0.0 ? 0.0 : (currentTime+delay), interval, func};
-	InsertMessageInternal(m);
-	if(!IsCurrent()){
+	uint16_t slot=AllocateSlot();
+	Message& m=messages[slot];
+	m.deliverAt=delay==0.0 ? 0.0 : (currentTime+delay);
+	m.interval=interval;
+	m.func=std::move(func);
+	InsertMessageInternal(slot);
+	uint32_t id=m.id;
+	double deliverAt=m.deliverAt;
+	if(!isCurrent){
+		if(pool){
+			queueMutex.Unlock();
+			// if it's current, the pool will reschedule it after the running message returns
+			pool->Schedule(this, deliverAt);
+			return id;
+		}
 #ifdef _WIN32
 		SetEvent(event);
 #else
@@ -137,42 +200,61 @@ uint32_t MessageThread::Post(std::function<void()> func, double delay, double in
 #endif
 		queueMutex.Unlock();
 	}
-	return m.id;
+	return id;
+}
+
+void MessageThread::InsertMessageInternal(uint16_t slot){
+	queue.push_back(QueueEntry{messages[slot].deliverAt, nextOrder++, slot});
+	std::push_heap(queue.begin(), queue.end(), QueueEntryComparator());
 }
 
-void MessageThread::InsertMessageInternal(MessageThread::Message &m){
-	if(queue.empty()){
-		queue.push_back(m);
+uint16_t MessageThread::AllocateSlot(){
+	uint16_t slot;
+	// reuse the least recently freed slot so that generations wrap around as slowly as possible
+	if(!freeSlots.empty()){
+		slot=freeSlots.front();
+		freeSlots.pop_front();
 	}else{
-		if(queue[0].deliverAt>m.deliverAt){
-			queue.insert(queue.begin(), m);
-		}else{
-			std::vector<Message>::iterator insertAfter=queue.begin();
-			for(; insertAfter!=queue.end(); ++insertAfter){
-				std::vector<Message>::iterator next=std::next(insertAfter);
-				if(next==queue.end() || (next->deliverAt>m.deliverAt && insertAfter->deliverAt<=m.deliverAt)){
-					queue.insert(next, m);
-					break;
-				}
-			}
-		}
+		assert(messages.size()<=0xFFFF);
+		slot=(uint16_t)messages.size();
+		messages.emplace_back();
+		messages.back().generation=0;
 	}
+	Message& m=messages[slot];
+	m.generation++;
+	if(m.generation==0) // 0 would make the ID of slot 0 equal INVALID_ID
+		m.generation=1;
+	m.id=((uint32_t)m.generation << 16) | slot;
+	m.canceled=false;
+	return slot;
+}
+
+void MessageThread::FreeSlot(uint16_t slot){
+	Message& m=messages[slot];
+	m.id=0;
+	m.func.Reset();
+	freeSlots.push_back(slot);
 }
 
 void MessageThread::Cancel(uint32_t id){
-	if(!IsCurrent()){
+	if(id==INVALID_ID)
+		return;
+	bool isCurrent=IsCurrent();
+	if(!isCurrent){
 		queueMutex.Lock();
 	}
 
-	for(std::vector<Message>::iterator m=queue.begin();m!=queue.end();){
-		if(m->id==id){
-			m=queue.erase(m);
-		}else{
-			++m;
-		}
+	uint16_t slot=(uint16_t)(id & 0xFFFF);
+	if(slot<messages.size() && messages[slot].id==id && !messages[slot].canceled){
+		Message& m=messages[slot];
+		m.canceled=true;
+		// the heap entry is removed when it reaches the top, but whatever the callback holds on to can go now.
+		// If it's the message that's being delivered right now, it's destroyed after it returns.
+		if(!isCurrent || (m.deliverAt!=0.0 && m.deliverAt>VoIPController::GetCurrentTime()))
+			m.func.Reset();
 	}
 
-	if(!IsCurrent()){
+	if(!isCurrent){
 		queueMutex.Unlock();
 	}
 }
@@ -181,3 +263,205 @@ void MessageThread::CancelSelf(){
 	assert(IsCurrent());
 	cancelCurrent=true;
 }
+
+#ifndef _WIN32
+void MessageThread::WaitOnCondition(pthread_cond_t* cond, Mutex& mutex, double timeout){
+	if(timeout==DBL_MAX){
+		pthread_cond_wait(cond, mutex.NativeHandle());
+		return;
+	}
+	struct timespec deadline;
+#ifdef TGVOIP_MESSAGE_THREAD_MONOTONIC_CLOCK
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timeout+=deadline.tv_sec;
+	timeout+=(deadline.tv_nsec/1000000000.0);
+#else
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	timeout+=now.tv_sec;
+	timeout+=(now.tv_usec/1000000.0);
+#endif
+	deadline.tv_sec=(time_t)(floor(timeout));
+	deadline.tv_nsec=(long)((timeout-floor(timeout))*1000000000.0);
+	pthread_cond_timedwait(cond, mutex.NativeHandle(), &deadline);
+}
+
+void MessageThread::InitCondition(pthread_cond_t* cond){
+#ifdef TGVOIP_MESSAGE_THREAD_MONOTONIC_CLOCK
+	// wall clock adjustments shouldn't shift timers
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+#else
+	pthread_cond_init(cond, NULL);
+#endif
+}
+#endif
+
+#pragma mark - MessageThreadPool
+
+MessageThreadPool::MessageThreadPool(unsigned int threadCount){
+#ifdef _WIN32
+#if !defined(WINAPI_FAMILY) || WINAPI_FAMILY!=WINAPI_FAMILY_PHONE_APP
+	event=CreateEvent(NULL, false, false, NULL);
+	runDoneEvent=CreateEvent(NULL, true, false, NULL);
+#else
+	event=CreateEventEx(NULL, NULL, 0, EVENT_ALL_ACCESS);
+	runDoneEvent=CreateEventEx(NULL, NULL, CREATE_EVENT_MANUAL_RESET, EVENT_ALL_ACCESS);
+#endif
+#else
+	MessageThread::InitCondition(&cond);
+	MessageThread::InitCondition(&runDoneCond);
+#endif
+	for(unsigned int i=0;i<threadCount;i++){
+		threads.push_back(new Thread([this, i]{
+			RunWorker(threads[i]);
+		}));
+	}
+	for(Thread* thread:threads){
+		thread->SetName("MessageThreadPool");
+		thread->Start();
+	}
+}
+
+MessageThreadPool::~MessageThreadPool(){
+	mutex.Lock();
+	running=false;
+#ifdef _WIN32
+	SetEvent(event);
+#else
+	pthread_cond_broadcast(&cond);
+#endif
+	mutex.Unlock();
+	for(Thread* thread:threads){
+		thread->Join();
+		delete thread;
+	}
+#ifdef _WIN32
+	CloseHandle(event);
+	CloseHandle(runDoneEvent);
+#else
+	pthread_cond_destroy(&cond);
+	pthread_cond_destroy(&runDoneCond);
+#endif
+}
+
+void MessageThreadPool::Add(MessageThread* mt){
+	MutexGuard m(mutex);
+	mt->inPool=true;
+	mt->scheduledInPool=false;
+	mt->runningInPool=false;
+	// run it once to pick up whatever was posted before it was started
+	ScheduleInternal(mt, 0.0);
+}
+
+void MessageThreadPool::Remove(MessageThread* mt){
+	mutex.Lock();
+	mt->inPool=false;
+	if(mt->scheduledInPool){
+		scheduled.erase(std::make_pair(mt->poolDeliverAt, mt));
+		mt->scheduledInPool=false;
+	}
+	// wait for the message that's being delivered right now, if any
+	while(mt->runningInPool){
+#ifdef _WIN32
+		// the worker sets it with the mutex held, so it can't be missed between here and the wait
+		ResetEvent(runDoneEvent);
+		mutex.Unlock();
+#if !defined(WINAPI_FAMILY) || WINAPI_FAMILY!=WINAPI_FAMILY_PHONE_APP
+		WaitForSingleObject(runDoneEvent, INFINITE);
+#else
+		WaitForSingleObjectEx(runDoneEvent, INFINITE, false);
+#endif
+		mutex.Lock();
+#else
+		MessageThread::WaitOnCondition(&runDoneCond, mutex, DBL_MAX);
+#endif
+	}
+	mutex.Unlock();
+}
+
+void MessageThreadPool::Schedule(MessageThread* mt, double deliverAt){
+	MutexGuard m(mutex);
+	if(!mt->inPool)
+		return;
+	if(mt->runningInPool){
+		mt->poolPendingDeliverAt=std::min(mt->poolPendingDeliverAt, deliverAt);
+		return;
+	}
+	ScheduleInternal(mt, deliverAt);
+}
+
+void MessageThreadPool::ScheduleInternal(MessageThread* mt, double deliverAt){
+	if(mt->scheduledInPool){
+		if(mt->poolDeliverAt<=deliverAt)
+			return;
+		scheduled.erase(std::make_pair(mt->poolDeliverAt, mt));
+	}
+	mt->poolDeliverAt=deliverAt;
+	mt->scheduledInPool=true;
+	bool isFirst=scheduled.empty() || deliverAt<scheduled.begin()->first;
+	scheduled.insert(std::make_pair(deliverAt, mt));
+	if(isFirst){
+#ifdef _WIN32
+		SetEvent(event);
+#else
+		pthread_cond_signal(&cond);
+#endif
+	}
+}
+
+void MessageThreadPool::RunWorker(Thread* self){
+	mutex.Lock();
+	while(running){
+		double currentTime=VoIPController::GetCurrentTime();
+		double waitTimeout=scheduled.empty() ? DBL_MAX : Clock::ToRealDuration(scheduled.begin()->first-currentTime);
+		if(scheduled.empty() || (scheduled.begin()->first!=0.0 && waitTimeout>0.0)){
+#ifdef _WIN32
+			mutex.Unlock();
+			DWORD actualWaitTimeout=waitTimeout==DBL_MAX ? INFINITE : ((DWORD)round(waitTimeout*1000.0));
+#if !defined(WINAPI_FAMILY) || WINAPI_FAMILY!=WINAPI_FAMILY_PHONE_APP
+			WaitForSingleObject(event, actualWaitTimeout);
+#else
+			WaitForSingleObjectEx(event, actualWaitTimeout, false);
+#endif
+			mutex.Lock();
+#else
+			MessageThread::WaitOnCondition(&cond, mutex, waitTimeout);
+#endif
+			continue;
+		}
+		MessageThread* mt=scheduled.begin()->second;
+		scheduled.erase(scheduled.begin());
+		mt->scheduledInPool=false;
+		mt->runningInPool=true;
+		mt->poolPendingDeliverAt=DBL_MAX;
+		// there may be more work for the other threads
+		if(!scheduled.empty()){
+#ifdef _WIN32
+			SetEvent(event);
+#else
+			pthread_cond_signal(&cond);
+#endif
+		}
+		mutex.Unlock();
+		double next=mt->RunInPool(self);
+		mutex.Lock();
+		mt->runningInPool=false;
+#ifdef _WIN32
+		SetEvent(runDoneEvent);
+#else
+		pthread_cond_broadcast(&runDoneCond);
+#endif
+		next=std::min(next, mt->poolPendingDeliverAt);
+		if(mt->inPool && next!=DBL_MAX)
+			ScheduleInternal(mt, next);
+	}
+#ifdef _WIN32
+	// auto-reset event only wakes one thread, pass it on
+	SetEvent(event);
+#endif
+	mutex.Unlock();
+}
@@ -8,44 +8,228 @@
 #include "threading.h"
 #include "utils.h"
 #include <vector>
+#include <deque>
+#include <set>
 #include <functional>
 #include <atomic>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <stddef.h>
+
+#define MESSAGE_CALLBACK_INLINE_SIZE 48
 
 namespace tgvoip{
+	class MessageThreadPool;
+
 	class MessageThread : public Thread{
 	public:
+		/**
+		 * A move-only void() callable that keeps small functors (up to MESSAGE_CALLBACK_INLINE_SIZE bytes,
+		 * which covers lambdas capturing a few pointers or a shared_ptr) inline instead of on the heap.
+		 */
+		class Callback{
+		public:
+			TGVOIP_DISALLOW_COPY_AND_ASSIGN(Callback);
+			Callback() : ops(NULL){}
+			Callback(std::nullptr_t) : ops(NULL){}
+			template<typename F, typename=typename std::enable_if<!std::is_same<typename std::decay<F>::type, Callback>::value>::type>
+			Callback(F&& func){
+				typedef typename std::decay<F>::type T;
+				Init<T>(std::forward<F>(func), std::integral_constant<bool, sizeof(T)<=MESSAGE_CALLBACK_INLINE_SIZE && alignof(T)<=alignof(Storage) && std::is_nothrow_move_constructible<T>::value>());
+			}
+			Callback(Callback&& other) : ops(other.ops){
+				if(ops){
+					ops->move(&other.storage, &storage);
+					other.ops=NULL;
+				}
+			}
+			Callback& operator=(Callback&& other){
+				if(this!=&other){
+					Reset();
+					ops=other.ops;
+					if(ops){
+						ops->move(&other.storage, &storage);
+						other.ops=NULL;
+					}
+				}
+				return *this;
+			}
+			~Callback(){
+				Reset();
+			}
+			void operator()(){
+				ops->invoke(&storage);
+			}
+			explicit operator bool() const{
+				return ops!=NULL;
+			}
+			void Reset(){
+				if(ops){
+					ops->destroy(&storage);
+					ops=NULL;
+				}
+			}
+
+		private:
+			typedef typename std::aligned_storage<MESSAGE_CALLBACK_INLINE_SIZE, alignof(void*)*2>::type Storage;
+			struct Ops{
+				void (*invoke)(void*);
+				void (*move)(void*, void*);
+				void (*destroy)(void*);
+			};
+			template<typename T> struct InlineOps{
+				static void Invoke(void* p){
+					(*reinterpret_cast<T*>(p))();
+				}
+				static void Move(void* from, void* to){
+					new (to) T(std::move(*reinterpret_cast<T*>(from)));
+					reinterpret_cast<T*>(from)->~T();
+				}
+				static void Destroy(void* p){
+					reinterpret_cast<T*>(p)->~T();
+				}
+			};
+			template<typename T> struct HeapOps{
+				static void Invoke(void* p){
+					(**reinterpret_cast<T**>(p))();
+				}
+				static void Move(void* from, void* to){
+					*reinterpret_cast<T**>(to)=*reinterpret_cast<T**>(from);
+				}
+				static void Destroy(void* p){
+					delete *reinterpret_cast<T**>(p);
+				}
+			};
+			template<typename T, typename F> void Init(F&& func, std::true_type){
+				static const Ops inlineOps={&InlineOps<T>::Invoke, &InlineOps<T>::Move, &InlineOps<T>::Destroy};
+				new (&storage) T(std::forward<F>(func));
+				ops=&inlineOps;
+			}
+			template<typename T, typename F> void Init(F&& func, std::false_type){
+				static const Ops heapOps={&HeapOps<T>::Invoke, &HeapOps<T>::Move, &HeapOps<T>::Destroy};
+				*reinterpret_cast<T**>(&storage)=new T(std::forward<F>(func));
+				ops=&heapOps;
+			}
+
+			Storage storage;
+			const Ops* ops;
+		};
+
 		TGVOIP_DISALLOW_COPY_AND_ASSIGN(MessageThread);
 		MessageThread();
 		virtual ~MessageThread();
-		uint32_t Post(std::function<void()> func, double delay=0, double interval=0);
+		/**
+		 * Schedule func to run on this thread
+		 * @param delay Seconds from now, or 0 to run as soon as possible
+		 * @param interval If greater than 0, func will keep running with this period until canceled
+		 * @return An ID that can be passed to Cancel(). Only valid until the message is delivered, unless it's repeating.
+		 */
+		uint32_t Post(Callback func, double delay=0, double interval=0);
 		void Cancel(uint32_t id);
 		void CancelSelf();
+		void Start();
 		void Stop();
+		bool IsCurrent();
+		/**
+		 * Run the messages on the threads of a shared pool instead of a dedicated thread.
+		 * Messages are still delivered one at a time, in the same order. Must be called before Start().
+		 */
+		void SetPool(MessageThreadPool* pool);
 
 		enum{
 			INVALID_ID=0
 		};
 	private:
+		friend class MessageThreadPool;
+		// Messages live in slots that are reused, the ID has the slot index in its lower 16 bits and
+		// the slot's generation in the upper 16, so Cancel() is O(1) and stale IDs don't match anything.
 		struct Message{
-			uint32_t id;
+			uint32_t id; // 0 when the slot is free
 			double deliverAt;
 			double interval;
-			std::function<void()> func;
+			Callback func;
+			uint16_t generation;
+			bool canceled;
+		};
+		struct QueueEntry{
+			double deliverAt;
+			uint32_t order;
+			uint16_t slot;
+		};
+		struct QueueEntryComparator{
+			// the heap is a max-heap, so "later" entries compare as less
+			bool operator()(const QueueEntry& a, const QueueEntry& b) const{
+				if(a.deliverAt!=b.deliverAt)
+					return a.deliverAt>b.deliverAt;
+				return (int32_t)(a.order-b.order)>0;
+			}
 		};
 
 		void Run();
-		void InsertMessageInternal(Message& m);
+		void DeliverMessages();
+		double RunInPool(Thread* worker);
+		double GetNextDeliveryTime();
+		void InsertMessageInternal(uint16_t slot);
+		uint16_t AllocateSlot();
+		void FreeSlot(uint16_t slot);
+#ifndef _WIN32
+		static void InitCondition(pthread_cond_t* cond);
+		static void WaitOnCondition(pthread_cond_t* cond, Mutex& mutex, double timeout);
+#endif
 
 		std::atomic<bool> running;
-		std::vector<Message> queue;
+		std::deque<Message> messages; // a deque because callbacks may post while holding a reference to their own slot
+		std::deque<uint16_t> freeSlots;
+		std::vector<QueueEntry> queue; // binary heap, earliest first
 		Mutex queueMutex;
-		uint32_t lastMessageID=1;
+		uint32_t nextOrder=0;
 		bool cancelCurrent=false;
 
+		MessageThreadPool* pool=NULL;
+		std::atomic<Thread*> currentPoolThread;
+		// these are protected by the pool mutex
+		bool inPool=false;
+		bool scheduledInPool=false;
+		bool runningInPool=false;
+		double poolDeliverAt;
+		double poolPendingDeliverAt;
+
+#ifdef _WIN32
+		HANDLE event;
+#else
+		pthread_cond_t cond;
+#endif
+	};
+
+	/**
+	 * A fixed set of threads that runs the messages of any number of MessageThreads.
+	 * Each MessageThread is only ever run by one pool thread at a time.
+	 */
+	class MessageThreadPool{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(MessageThreadPool);
+		MessageThreadPool(unsigned int threadCount);
+		~MessageThreadPool();
+
+	private:
+		friend class MessageThread;
+		void Add(MessageThread* mt);
+		void Remove(MessageThread* mt);
+		void Schedule(MessageThread* mt, double deliverAt);
+		void ScheduleInternal(MessageThread* mt, double deliverAt);
+		void RunWorker(Thread* self);
+
+		std::vector<Thread*> threads;
+		std::set<std::pair<double, MessageThread*>> scheduled;
+		Mutex mutex;
+		bool running=true;
 #ifdef _WIN32
 		HANDLE event;
+		HANDLE runDoneEvent; // manual reset, Remove() resets it before waiting
 #else
 		pthread_cond_t cond;
+		pthread_cond_t runDoneCond; // signaled whenever a worker is done running a MessageThread
 #endif
 	};
 }
@@ -6,12 +6,18 @@
 #include <algorithm>
 #include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
 #if defined(_WIN32)
 #include <winsock2.h>
 #include "os/windows/NetworkSocketWinsock.h"
 #else
 #include "os/posix/NetworkSocketPosix.h"
 #endif
+#ifdef TGVOIP_USE_IO_URING
+#include "os/linux/NetworkSocketIOUring.h"
+#endif
 #include "logging.h"
 #include "VoIPServerConfig.h"
 #include "VoIPController.h"
@@ -51,6 +57,10 @@ bool NetworkSocket::IsFailed(){
 }
 
 NetworkSocket *NetworkSocket::Create(NetworkProtocol protocol){
+#ifdef TGVOIP_USE_IO_URING
+	if(protocol==NetworkProtocol::UDP && ServerConfig::GetSharedInstance()->GetBoolean("use_io_uring", true))
+		return new NetworkSocketIOUring(protocol);
+#endif
 #ifndef _WIN32
 	return new NetworkSocketPosix(protocol);
 #else
@@ -99,6 +109,67 @@ void NetworkSocket::EncryptForTCPO2(unsigned char *buffer, size_t len, TCPO2Stat
 	VoIPController::crypto.aes_ctr_encrypt(buffer, len, state->key, state->iv, state->ecount, &state->num);
 }
 
+Buffer NetworkSocket::GetReceiveBuffer(size_t size){
+	// These are intentionally never destroyed because buffers taken from them can outlive any particular socket or controller.
+	// No thread caches: the buffers are taken on the receive thread and released wherever the packets end up.
+	static BufferPool<SMALL_RECV_BUFFER_SIZE, 512>* smallPool=new BufferPool<SMALL_RECV_BUFFER_SIZE, 512>();
+	static BufferPool<LARGE_RECV_BUFFER_SIZE, 256>* largePool=new BufferPool<LARGE_RECV_BUFFER_SIZE, 256>();
+	try{
+		if(size<=SMALL_RECV_BUFFER_SIZE)
+			return smallPool->Get();
+		if(size<=LARGE_RECV_BUFFER_SIZE)
+			return largePool->Get();
+	}catch(std::bad_alloc& x){
+		LOGW("Receive buffer pool exhausted, allocating %u bytes", (unsigned int)size);
+	}
+	return Buffer(size);
+}
+
+NetworkSocketPoller* NetworkSocketPoller::Create(SocketSelectCanceller* canceller){
+#if defined(__linux__)
+	NetworkSocketPollerEpoll* poller=new NetworkSocketPollerEpoll(canceller);
+	if(!poller->IsFailed())
+		return poller;
+	delete poller;
+	LOGW("epoll poller failed to initialize, falling back to select");
+#endif
+	return new NetworkSocketPollerSelect(canceller);
+}
+
+bool NetworkSocketPoller::NeedsWriteReadiness(NetworkSocket* socket, bool isProxy){
+	if(socket->IsReadyToSend())
+		return false;
+	return !isProxy || static_cast<NetworkSocketSOCKS5Proxy*>(socket)->NeedSelectForSending();
+}
+
+NetworkSocketPollerSelect::NetworkSocketPollerSelect(SocketSelectCanceller* canceller) : canceller(canceller){
+
+}
+
+void NetworkSocketPollerSelect::AddSocket(NetworkSocket* socket, int flags){
+	sockets.push_back(Registration{socket, flags, dynamic_cast<NetworkSocketSOCKS5Proxy*>(socket)!=NULL});
+}
+
+void NetworkSocketPollerSelect::RemoveAllSockets(){
+	sockets.clear();
+}
+
+bool NetworkSocketPollerSelect::Poll(std::vector<NetworkSocket*>& readFds, std::vector<NetworkSocket*>& writeFds, std::vector<NetworkSocket*>& errorFds){
+	readFds.clear();
+	writeFds.clear();
+	errorFds.clear();
+	for(Registration& r:sockets){
+		if(r.flags & POLL_READ)
+			readFds.push_back(r.socket);
+		if(r.flags & POLL_WRITE_AND_ERROR){
+			errorFds.push_back(r.socket);
+			if(NeedsWriteReadiness(r.socket, r.isProxy))
+				writeFds.push_back(r.socket);
+		}
+	}
+	return NetworkSocket::Select(readFds, writeFds, errorFds, canceller);
+}
+
 size_t NetworkSocket::Receive(unsigned char *buffer, size_t len){
 	NetworkPacket pkt=Receive(len);
 	if(pkt.IsEmpty())
@@ -108,6 +179,22 @@ size_t NetworkSocket::Receive(unsigned char *buffer, size_t len){
 	return actualLen;
 }
 
+void NetworkSocket::SendBatch(std::vector<NetworkPacket>& packets){
+	for(NetworkPacket& pkt:packets){
+		Send(std::move(pkt));
+	}
+}
+
+size_t NetworkSocket::ReceiveBatch(std::vector<NetworkPacket>& packets, size_t maxCount){
+	if(maxCount==0)
+		return 0;
+	NetworkPacket pkt=Receive();
+	if(pkt.data.IsEmpty())
+		return 0;
+	packets.push_back(std::move(pkt));
+	return 1;
+}
+
 bool NetworkAddress::operator==(const NetworkAddress &other) const{
 	if(isIPv6!=other.isIPv6)
 		return false;
@@ -13,6 +13,11 @@
 #include "utils.h"
 #include "Buffers.h"
 
+#define MAX_RECV_BATCH_SIZE 16
+#define MAX_SEND_BATCH_SIZE 64
+#define SMALL_RECV_BUFFER_SIZE 512
+#define LARGE_RECV_BUFFER_SIZE 2048
+
 namespace tgvoip {
 
 	enum class NetworkProtocol{
@@ -75,17 +80,56 @@ namespace tgvoip {
 		static SocketSelectCanceller* Create();
 	};
 
+	class NetworkSocket;
+
+	/**
+	 * Keeps a persistent set of sockets to wait on, as opposed to NetworkSocket::Select that takes the whole set on every call.
+	 */
+	class NetworkSocketPoller{
+	public:
+		enum{
+			// socket is returned in readFds when it has something to receive
+			POLL_READ=1,
+			// socket is returned in writeFds when it becomes writable while not ready to send, and in errorFds when it fails or times out
+			POLL_WRITE_AND_ERROR=2
+		};
+		virtual ~NetworkSocketPoller(){};
+		virtual void AddSocket(NetworkSocket* socket, int flags)=0;
+		virtual void RemoveAllSockets()=0;
+		/**
+		 * Waits for events on the registered sockets. Same semantics as NetworkSocket::Select.
+		 * The vectors are cleared first.
+		 * @return false if the wait was canceled through the canceller
+		 */
+		virtual bool Poll(std::vector<NetworkSocket*>& readFds, std::vector<NetworkSocket*>& writeFds, std::vector<NetworkSocket*>& errorFds)=0;
+		static NetworkSocketPoller* Create(SocketSelectCanceller* canceller);
+	protected:
+		static bool NeedsWriteReadiness(NetworkSocket* socket, bool isProxy);
+	};
+
 	class NetworkSocket{
 	public:
 		friend class NetworkSocketPosix;
+		friend class NetworkSocketPollerEpoll;
 		friend class NetworkSocketWinsock;
 
 		TGVOIP_DISALLOW_COPY_AND_ASSIGN(NetworkSocket);
 		NetworkSocket(NetworkProtocol protocol);
 		virtual ~NetworkSocket();
 		virtual void Send(NetworkPacket packet)=0;
+		/**
+		 * Sends all packets, possibly with fewer system calls than one Send() per packet.
+		 * The packets are moved out of the vector. The default implementation calls Send() for each packet.
+		 */
+		virtual void SendBatch(std::vector<NetworkPacket>& packets);
 		virtual NetworkPacket Receive(size_t maxLen=0)=0;
 		size_t Receive(unsigned char* buffer, size_t len);
+		/**
+		 * Receives up to maxCount packets that are ready to be read without blocking and appends them to packets.
+		 * The default implementation does a single Receive().
+		 * @return the number of packets appended
+		 */
+		virtual size_t ReceiveBatch(std::vector<NetworkPacket>& packets, size_t maxCount);
 		virtual void Open()=0;
 		virtual void Close()=0;
 		virtual uint16_t GetLocalPort(){ return 0; };
@@ -114,6 +158,12 @@ namespace tgvoip {
 		virtual uint16_t GenerateLocalPort();
 		virtual void SetMaxPriority();
 
+		/**
+		 * Returns a buffer for an incoming packet of up to size bytes from a process-wide pool of the matching size class.
+		 * Falls back to a heap allocation if the pool is exhausted or size is too large.
+		 * The returned buffer might be larger than requested, use Resize() to set the actual length.
+		 */
+		static Buffer GetReceiveBuffer(size_t size);
 		static void GenerateTCPO2States(unsigned char* buffer, TCPO2State* recvState, TCPO2State* sendState);
 		static void EncryptForTCPO2(unsigned char* buffer, size_t len, TCPO2State* state);
 		double ipv6Timeout;
@@ -196,6 +246,27 @@ namespace tgvoip {
 		ConnectionState state=ConnectionState::Initial;
 	};
 
+	/**
+	 * Generic poller implementation on top of NetworkSocket::Select
+	 */
+	class NetworkSocketPollerSelect : public NetworkSocketPoller{
+	public:
+		NetworkSocketPollerSelect(SocketSelectCanceller* canceller);
+		virtual ~NetworkSocketPollerSelect(){};
+		virtual void AddSocket(NetworkSocket* socket, int flags) override;
+		virtual void RemoveAllSockets() override;
+		virtual bool Poll(std::vector<NetworkSocket*>& readFds, std::vector<NetworkSocket*>& writeFds, std::vector<NetworkSocket*>& errorFds) override;
+
+	private:
+		struct Registration{
+			NetworkSocket* socket;
+			int flags;
+			bool isProxy;
+		};
+		std::vector<Registration> sockets;
+		SocketSelectCanceller* canceller;
+	};
+
 }
 
 #endif //LIBTGVOIP_NETWORKSOCKET_H
@@ -5,7 +5,7 @@
 //
 
 #include "OpusDecoder.h"
-#include "audio/Resampler.h"
+#include "audio/TimeStretcher.h"
 #include "logging.h"
 #include <assert.h>
 #include <math.h>
@@ -62,8 +62,8 @@ void tgvoip::OpusDecoder::Initialize(bool isAsync, bool needEC){
 	levelMeter=NULL;
 	nextLen=0;
 	running=false;
-	remainingDataLen=0;
-	processedBuffer=NULL;
+	playoutSamples=0;
+	stretchDebt=0;
 	prevWasEC=false;
 	prevLastSample=0;
 }
@@ -125,23 +125,18 @@ size_t tgvoip::OpusDecoder::HandleCallback(unsigned char *data, size_t len){
 			abort();
 		}
 	}else{
-		if(remainingDataLen==0 && silentPacketCount==0){
-			int duration=DecodeNextFrame();
-			remainingDataLen=(size_t) (duration/20*960*2);
+		while(playoutSamples<960){
+			DecodeNextFrame();
 		}
-		if(silentPacketCount>0 || remainingDataLen==0 || !processedBuffer){
-			if(silentPacketCount>0)
-				silentPacketCount--;
-			memset(data, 0, 960*2);
+		memcpy(data, playoutBuffer, 960*2);
+		playoutSamples-=960;
+		memmove(playoutBuffer, playoutBuffer+960, playoutSamples*2);
+		if(silentPacketCount>0){
+			silentPacketCount--;
 			if(levelMeter)
 				levelMeter->Update(reinterpret_cast<int16_t *>(data), 0);
 			return 0;
 		}
-		memcpy(data, processedBuffer, 960*2);
-		remainingDataLen-=960*2;
-		if(remainingDataLen>0){
-			memmove(processedBuffer, processedBuffer+960*2, remainingDataLen);
-		}
 	}
 	if(levelMeter)
 		levelMeter->Update(reinterpret_cast<int16_t *>(data), len/2);
@@ -169,36 +164,32 @@ void tgvoip::OpusDecoder::Stop(){
 }
 
 void tgvoip::OpusDecoder::RunThread(){
-	int i;
 	LOGI("decoder: packets per frame %d", packetsPerFrame);
 	while(running){
-		int playbackDuration=DecodeNextFrame();
-		for(i=0;i<playbackDuration/20;i++){
-			semaphore->Acquire();
-			if(!running){
-				LOGI("==== decoder exiting ====");
-				return;
-			}
-			try{
-				Buffer buf=bufferPool.Get();
-				if(remainingDataLen>0){
-					for(effects::AudioEffect*& effect:postProcEffects){
-						effect->Process(reinterpret_cast<int16_t*>(processedBuffer+(PACKET_SIZE*i)), 960);
-					}
-					buf.CopyFrom(processedBuffer+(PACKET_SIZE*i), 0, PACKET_SIZE);
-				}else{
-					//LOGE("Error decoding, result=%d", size);
-					memset(*buf, 0, PACKET_SIZE);
-				}
-				decodedQueue->Put(std::move(buf));
-			}catch(std::bad_alloc& x){
-				LOGW("decoder: no buffers left!");
+		while(playoutSamples<960){
+			DecodeNextFrame();
+		}
+		semaphore->Acquire();
+		if(!running){
+			LOGI("==== decoder exiting ====");
+			return;
+		}
+		try{
+			Buffer buf=bufferPool.Get();
+			for(effects::AudioEffect*& effect:postProcEffects){
+				effect->Process(playoutBuffer, 960);
 			}
+			buf.CopyFrom(playoutBuffer, 0, PACKET_SIZE);
+			decodedQueue->Put(std::move(buf));
+		}catch(std::bad_alloc& x){
+			LOGW("decoder: no buffers left!");
 		}
+		playoutSamples-=960;
+		memmove(playoutBuffer, playoutBuffer+960, playoutSamples*2);
 	}
 }
 
-int tgvoip::OpusDecoder::DecodeNextFrame(){
+void tgvoip::OpusDecoder::DecodeNextFrame(){
 	int playbackDuration=0;
 	bool isEC=false;
 	size_t len=jitterBuffer->HandleOutput(buffer, 8192, 0, true, playbackDuration, isEC);
@@ -235,6 +226,7 @@ int tgvoip::OpusDecoder::DecodeNextFrame(){
 		if(consecutiveLostPackets>2 && enableDTX){
 			silentPacketCount+=packetsPerFrame;
 			size=packetsPerFrame*960;
+			memset(decodeBuffer, 0, size*2);
 		}else{
 			size=opus_decode(prevWasEC ? ecDec : dec, NULL, 0, (opus_int16 *) decodeBuffer, packetsPerFrame*960, 0);
 			//LOGV("PLC");
@@ -242,17 +234,21 @@ int tgvoip::OpusDecoder::DecodeNextFrame(){
 	}
 	if(size<0)
 		LOGW("decoder: opus_decode error %d", size);
-	remainingDataLen=size;
-	if(playbackDuration==80){
-		processedBuffer=buffer;
-		audio::Resampler::Rescale60To80((int16_t*) decodeBuffer, (int16_t*) processedBuffer);
-	}else if(playbackDuration==40){
-		processedBuffer=buffer;
-		audio::Resampler::Rescale60To40((int16_t*) decodeBuffer, (int16_t*) processedBuffer);
+	int16_t* out=playoutBuffer+playoutSamples;
+	if(size>0){
+		// the jitter buffer asks for a longer or shorter playback to change its delay; that's done in whole pitch periods,
+		// so whatever doesn't fit into this frame is carried over to the next ones
+		stretchDebt+=(ptrdiff_t)(playbackDuration-(int)frameDuration)*48;
+		size_t outLen=audio::TimeStretcher::Stretch(reinterpret_cast<int16_t*>(decodeBuffer), (size_t)size, out, stretchDebt);
+		stretchDebt-=(ptrdiff_t)outLen-size;
+		stretchDebt=std::max((ptrdiff_t)-size/2, std::min((ptrdiff_t)size/2, stretchDebt));
+		playoutSamples+=outLen;
 	}else{
-		processedBuffer=decodeBuffer;
+		//LOGE("Error decoding, result=%d", size);
+		size_t len=(size_t)playbackDuration*48;
+		memset(out, 0, len*2);
+		playoutSamples+=len;
 	}
-	return playbackDuration;
 }
 
 
@@ -47,14 +47,13 @@ private:
 	void Initialize(bool isAsync, bool needEC);
 	static size_t Callback(unsigned char* data, size_t len, void* param);
 	void RunThread();
-	int DecodeNextFrame();
+	void DecodeNextFrame();
 	::OpusDecoder* dec;
 	::OpusDecoder* ecDec;
 	BlockingQueue<Buffer>* decodedQueue;
 	BufferPool<960*2, 32> bufferPool;
 	unsigned char* buffer;
 	unsigned char* lastDecoded;
-	unsigned char* processedBuffer;
 	size_t outputBufferSize;
 	std::atomic<bool> running;
     Thread* thread;
@@ -72,7 +71,9 @@ private:
 	unsigned char decodeBuffer[8192];
 	size_t nextLen;
 	unsigned int packetsPerFrame;
-	ptrdiff_t remainingDataLen;
+	int16_t playoutBuffer[8192]; // decoded and time-stretched samples waiting to be played, in 960-sample chunks
+	size_t playoutSamples;
+	ptrdiff_t stretchDebt; // time-stretching the jitter buffer asked for but that couldn't be done yet, in samples
 	bool prevWasEC;
 	int16_t prevLastSample;
 };
@@ -8,15 +8,24 @@
 #include "video/VideoFEC.h"
 
 #include <assert.h>
-#include <sstream>
+#include <algorithm>
 
-#define NUM_OLD_PACKETS 3
+// must be a power of 2 and hold the pending frames plus the ones before them that share FEC groups with them
+#define FRAME_RING_SIZE 16
 #define NUM_FEC_PACKETS 10
+// an incomplete frame is given up on (or FEC is waited for) once there are more pending frames than this
+#define MAX_PENDING_FRAMES 3
+// how far behind the newest frame the first fragment of a frame may still arrive
+#define MAX_LATE_FRAMES 3
+// the most frames one FEC group spans, with either scheme
+#define MAX_FEC_GROUP_FRAMES 3
 
 using namespace tgvoip;
 using namespace tgvoip::video;
 
 PacketReassembler::PacketReassembler(){
+	packets.resize(FRAME_RING_SIZE);
+	fecPackets.resize(NUM_FEC_PACKETS);
 }
 
 PacketReassembler::~PacketReassembler(){
@@ -26,31 +35,41 @@ void PacketReassembler::Reset(){
 
 }
 
-void PacketReassembler::AddFragment(Buffer pkt, unsigned int fragmentIndex, unsigned int fragmentCount, uint32_t pts, uint8_t _fseq, bool keyframe, uint16_t rotation){
-	for(std::unique_ptr<Packet>& packet:packets){
-		if(packet->timestamp==pts){
-			if(fragmentCount!=packet->partCount){
-				LOGE("Received fragment total count %u inconsistent with previous %u", fragmentCount, packet->partCount);
-				return;
-			}
-			if(fragmentIndex>=packet->partCount){
-				LOGE("Received fragment index %u is greater than total %u", fragmentIndex, fragmentCount);
-				return;
-			}
-			packet->AddFragment(std::move(pkt), fragmentIndex);
+void PacketReassembler::AddFragment(const unsigned char* data, size_t length, unsigned int fragmentIndex, unsigned int fragmentCount, uint32_t pts, uint8_t _fseq, bool keyframe, uint16_t rotation){
+	uint32_t fseq=ExpandFrameSeq(_fseq);
+	//LOGV("fseq: %u", (unsigned int)fseq);
+	Packet* packet=GetPacket(fseq);
+	if(packet && packet->state==Packet::STATE_PENDING){
+		if(packet->timestamp!=pts){
+			LOGE("Received fragment timestamp %u inconsistent with previous %u for frame %u", pts, packet->timestamp, fseq);
 			return;
 		}
+		if(fragmentCount!=packet->partCount){
+			LOGE("Received fragment total count %u inconsistent with previous %u", fragmentCount, packet->partCount);
+			return;
+		}
+		if(fragmentIndex>=packet->partCount){
+			LOGE("Received fragment index %u is greater than total %u", fragmentIndex, fragmentCount);
+			return;
+		}
+		if(fragmentIndex==0)
+			packet->rotation=rotation;
+		packet->AddFragment(data, length, fragmentIndex);
+		// a retransmission can complete the frame that's held back waiting for FEC
+		if(waitingForFEC && packet==GetFirstPendingPacket() && packet->receivedPartCount==packet->partCount){
+			waitingForFEC=false;
+			DeliverFirstPacket();
+		}
+		return;
 	}
-	uint32_t fseq=(lastFrameSeq & 0xFFFFFF00) | (uint32_t)_fseq;
-	if((uint8_t)lastFrameSeq>_fseq)
-		fseq+=256;
-	//LOGV("fseq: %u", (unsigned int)fseq);
 
 	/*if(pts<maxTimestamp){
 		LOGW("Received fragment doesn't belong here (ts=%u < maxTs=%u)", pts, maxTimestamp);
 		return;
 	}*/
-	if(lastFrameSeq>3 && fseq<lastFrameSeq-3){
+	// the first fragment of a frame may arrive after fragments of the next few; it's only too late once
+	// the frame itself or a newer one was delivered or dropped, since frames are delivered in order
+	if(lastFrameSeq!=0 && (int32_t)(fseq-lastFrameSeq)<=0 && (packet || (int32_t)(lastFrameSeq-fseq)>MAX_LATE_FRAMES || !CanInsertLateFrame(fseq))){
 		LOGW("Packet too late (fseq=%u, lastFseq=%u)", fseq, lastFrameSeq);
 		return;
 	}
@@ -65,59 +84,50 @@ void PacketReassembler::AddFragment(Buffer pkt, unsigned int fragmentIndex, unsi
 
 	maxTimestamp=std::max(maxTimestamp, pts);
 
-	packets.push_back(std::unique_ptr<Packet>(new Packet(fseq, pts, fragmentCount, 0, keyframe, rotation)));
-	packets[packets.size()-1]->AddFragment(std::move(pkt), fragmentIndex);
-	while(packets.size()>3){
-		std::unique_ptr<Packet>& _old=packets[0];
-		if(_old->receivedPartCount==_old->partCount){
-			std::unique_ptr<Packet> old=std::move(packets[0]);
-			packets.erase(packets.begin());
-
-			Buffer buffer=old->Reassemble();
-			callback(std::move(buffer), old->seq, old->isKeyframe, old->rotation);
-			oldPackets.push_back(std::move(old));
-			while(oldPackets.size()>NUM_OLD_PACKETS)
-				oldPackets.erase(oldPackets.begin());
+	// after a long gap, pending frames that are too old to wait for anyway may be in the way
+	while(pendingPacketCount>0){
+		Packet* first=GetFirstPendingPacket();
+		if((int32_t)(fseq-first->seq)<FRAME_RING_SIZE)
+			break;
+		waitingForFEC=false;
+		if(first->receivedPartCount==first->partCount || TryDecodeFEC()){
+			DeliverFirstPacket();
 		}else{
-			LOGW("Packet %u not reassembled (%u of %u)", packets[0]->seq, packets[0]->receivedPartCount, packets[0]->partCount);
-			if(packets[0]->partCount-packets[0]->receivedPartCount==1 && !waitingForFEC){
-				bool found=false;
-				for(FecPacket& fec:fecPackets){
-					if(packets[0]->seq<=fec.seq && packets[0]->seq>fec.seq-fec.prevFrameCount){
-						LOGI("Found FEC packet: %u %u", fec.seq, fec.prevFrameCount);
-						found=true;
-						TryDecodeFEC(fec);
-						packets.erase(packets.begin());
-						break;
-					}
-				}
-				if(!found){
+			LOGE("unrecoverable packet loss");
+			DropFirstPacket();
+		}
+	}
+	packet=&packets[fseq & (FRAME_RING_SIZE-1)];
+	packet->Init(fseq, pts, fragmentCount, keyframe, fragmentIndex==0 ? rotation : 0);
+	packet->AddFragment(data, length, fragmentIndex);
+	pendingPacketCount++;
+	if(lastFrameSeq==0 || (int32_t)(fseq-lastFrameSeq)>0)
+		lastFrameSeq=fseq;
+
+	while(pendingPacketCount>MAX_PENDING_FRAMES){
+		Packet* first=GetFirstPendingPacket();
+		if(first->receivedPartCount==first->partCount){
+			DeliverFirstPacket();
+		}else{
+			LOGW("Packet %u not reassembled (%u of %u)", first->seq, first->receivedPartCount, first->partCount);
+			if(!waitingForFEC){
+				if(TryDecodeFEC())
+					continue;
+				if(CanStillRecover()){
 					waitingForFEC=true;
 					break;
 				}
-			}else{
-				waitingForFEC=false;
-				LOGE("unrecoverable packet loss");
-				std::unique_ptr<Packet> old=std::move(packets[0]);
-				packets.erase(packets.begin());
-				oldPackets.push_back(std::move(old));
-				while(oldPackets.size()>NUM_OLD_PACKETS)
-					oldPackets.erase(oldPackets.begin());
 			}
+			waitingForFEC=false;
+			LOGE("unrecoverable packet loss");
+			DropFirstPacket();
 		}
 	}
-
-	lastFrameSeq=fseq;
 }
 
 void PacketReassembler::AddFEC(Buffer data, uint8_t _fseq, unsigned int frameCount, unsigned int fecScheme){
-	uint32_t fseq=(lastFrameSeq & 0xFFFFFF00) | (uint32_t)_fseq;
-	std::ostringstream _s;
-	for(unsigned int i=0;i<frameCount;i++){
-		_s << (fseq-i);
-		_s << " ";
-	}
-	//LOGV("Received FEC packet: len %u, scheme %u, frames %s", (unsigned int)data.Length(), fecScheme, _s.str().c_str());
+	uint32_t fseq=ExpandFrameSeq(_fseq);
+	//LOGV("Received FEC packet: len %u, scheme %u, frames %u-%u", (unsigned int)data.Length(), fecScheme, fseq-frameCount+1, fseq);
 	FecPacket fec{
 		fseq,
 		frameCount,
@@ -125,102 +135,334 @@ void PacketReassembler::AddFEC(Buffer data, uint8_t _fseq, unsigned int frameCou
 		std::move(data)
 	};
 
-	if(waitingForFEC){
-		if(packets[0]->seq<=fec.seq && packets[0]->seq>fec.seq-fec.prevFrameCount){
-			LOGI("Found FEC packet: %u %u", fec.seq, fec.prevFrameCount);
-			TryDecodeFEC(fec);
-			packets.erase(packets.begin());
+	bool forWaitingPacket=waitingForFEC && fec.Covers(GetFirstPendingPacket()->seq);
+	fecPackets[nextFecPacket]=std::move(fec);
+	nextFecPacket=(nextFecPacket+1)%NUM_FEC_PACKETS;
+
+	if(forWaitingPacket){
+		LOGI("Found FEC packet: %u %u", fseq, frameCount);
+		if(TryDecodeFEC()){
+			waitingForFEC=false;
+			DeliverFirstPacket();
+		}else if(!CanStillRecover()){
 			waitingForFEC=false;
+			LOGE("unrecoverable packet loss");
+			DropFirstPacket();
 		}
 	}
-	fecPackets.push_back(std::move(fec));
-	while(fecPackets.size()>NUM_FEC_PACKETS)
-		fecPackets.erase(fecPackets.begin());
+}
+
+uint32_t PacketReassembler::ExpandFrameSeq(uint8_t fseq){
+	if(lastFrameSeq==0)
+		return fseq;
+	// the closest one to the last frame, in either direction
+	return lastFrameSeq+(uint32_t)(int32_t)(int8_t)(fseq-(uint8_t)lastFrameSeq);
 }
 
 void PacketReassembler::SetCallback(std::function<void(Buffer packet, uint32_t pts, bool keyframe, uint16_t rotation)> callback){
 	this->callback=callback;
 }
 
-bool PacketReassembler::TryDecodeFEC(PacketReassembler::FecPacket &fec){
+PacketReassembler::Packet* PacketReassembler::GetPacket(uint32_t seq){
+	Packet& packet=packets[seq & (FRAME_RING_SIZE-1)];
+	if(packet.state==Packet::STATE_EMPTY || packet.seq!=seq)
+		return NULL;
+	return &packet;
+}
+
+PacketReassembler::Packet* PacketReassembler::GetFirstPendingPacket(){
+	// all pending frames are within the ring size of the last one, older slots were taken over
+	for(uint32_t seq=lastFrameSeq-(FRAME_RING_SIZE-1);(int32_t)(lastFrameSeq-seq)>=0;seq++){
+		Packet* packet=GetPacket(seq);
+		if(packet && packet->state==Packet::STATE_PENDING)
+			return packet;
+	}
+	return NULL;
+}
+
+bool PacketReassembler::CanInsertLateFrame(uint32_t seq){
+	for(uint32_t s=seq+1;(int32_t)(lastFrameSeq-s)>=0;s++){
+		Packet* packet=GetPacket(s);
+		if(packet && packet->state==Packet::STATE_DONE)
+			return false;
+	}
+	return true;
+}
+
+bool PacketReassembler::TryDecodeFEC(){
+	Packet* pkt=GetFirstPendingPacket();
+	std::vector<FecPacket*> cm256Packets;
+	for(FecPacket& fec:fecPackets){
+		if(fec.data.IsEmpty() || !fec.Covers(pkt->seq))
+			continue;
+		if(fec.fecScheme==FEC_SCHEME_XOR){
+			if(DecodeParityFEC(fec))
+				return true;
+		}else if(fec.fecScheme==FEC_SCHEME_CM256){
+			cm256Packets.push_back(&fec);
+		}
+	}
+	if(!cm256Packets.empty())
+		return DecodeCM256FEC(cm256Packets);
+	return false;
+}
+
+bool PacketReassembler::CanStillRecover(){
+	// parity FEC is one packet per group; with CM256, more recovery packets for the same group may be on their way
+	Packet* pkt=GetFirstPendingPacket();
+	unsigned int missing=pkt->partCount-pkt->receivedPartCount;
+	bool foundFEC=false;
+	for(FecPacket& fec:fecPackets){
+		if(!fec.data.IsEmpty() && fec.Covers(pkt->seq)){
+			if(fec.fecScheme==FEC_SCHEME_CM256)
+				return true;
+			foundFEC=true;
+		}
+	}
+	return !foundFEC && (missing==1 || CM256FEC::IsSupported());
+}
+
+bool PacketReassembler::MayBeNeededForFEC(Packet* pkt){
+	// an FEC packet that covers this frame tells which frames are in its group; otherwise, it's any group of
+	// consecutive frames this one can be in, and the ones before it are all delivered or dropped by now
+	uint32_t firstSeq=pkt->seq+1, lastSeq=pkt->seq+MAX_FEC_GROUP_FRAMES-1;
+	for(FecPacket& fec:fecPackets){
+		if(!fec.data.IsEmpty() && fec.Covers(pkt->seq)){
+			firstSeq=fec.seq-fec.prevFrameCount+1;
+			lastSeq=fec.seq;
+			break;
+		}
+	}
+	for(uint32_t seq=firstSeq;(int32_t)(lastSeq-seq)>=0;seq++){
+		if(seq==pkt->seq)
+			continue;
+		Packet* p=GetPacket(seq);
+		if(p ? (p->state==Packet::STATE_PENDING && p->receivedPartCount<p->partCount) : (int32_t)(seq-pkt->seq)>0)
+			return true;
+	}
+	return false;
+}
+
+void PacketReassembler::DeliverFirstPacket(){
+	Packet* pkt=GetFirstPendingPacket();
+	pkt->state=Packet::STATE_DONE;
+	pendingPacketCount--;
+	callback(pkt->Reassemble(MayBeNeededForFEC(pkt)), pkt->seq, pkt->isKeyframe, pkt->rotation);
+}
+
+void PacketReassembler::DropFirstPacket(){
+	Packet* pkt=GetFirstPendingPacket();
+	pkt->state=Packet::STATE_DONE;
+	pendingPacketCount--;
+}
+
+bool PacketReassembler::DecodeParityFEC(PacketReassembler::FecPacket &fec){
 	LOGI("Decoding FEC");
 
+	// parity only repairs a single missing fragment in the whole group; with a frame missing entirely, its fragments can't even be counted
+	Packet* pkt=GetFirstPendingPacket();
+	if(pkt->partCount-pkt->receivedPartCount!=1)
+		return false;
+	uint32_t firstSeq=fec.seq-fec.prevFrameCount+1;
+	unsigned int missing=0;
+	for(uint32_t i=0;i<fec.prevFrameCount;i++){
+		Packet* p=GetPacket(firstSeq+i);
+		if(!p || p->released){
+			LOGW("Can't decode parity FEC: frame %u is %s", firstSeq+i, p ? "already released" : "missing");
+			return false;
+		}
+		missing+=p->partCount-p->receivedPartCount;
+	}
+	if(missing!=1){
+		LOGW("Can't decode parity FEC: %u fragments missing", missing);
+		return false;
+	}
+
 	std::vector<Buffer> packetsForRecovery;
-	for(std::unique_ptr<Packet>& p:oldPackets){
-		if(p->seq<=fec.seq && p->seq>fec.seq-fec.prevFrameCount){
-			LOGD("Adding frame %u from old", p->seq);
-			for(uint32_t i=0;i<p->partCount;i++){
-				packetsForRecovery.push_back(i<p->parts.size() ? Buffer::CopyOf(p->parts[i]) : Buffer());
-			}
+	for(uint32_t i=0;i<fec.prevFrameCount;i++){
+		Packet* p=GetPacket(firstSeq+i);
+		for(uint32_t j=0;j<p->partCount;j++){
+			packetsForRecovery.push_back(p->GetFragment(j));
 		}
 	}
 
-	for(std::unique_ptr<Packet>& p:packets){
-		if(p->seq<=fec.seq && p->seq>fec.seq-fec.prevFrameCount){
-			LOGD("Adding frame %u from pending", p->seq);
-			for(uint32_t i=0;i<p->partCount;i++){
-				//LOGV("[%u] size %u", i, p.parts[i].Length());
-				packetsForRecovery.push_back(i<p->parts.size() ? Buffer::CopyOf(p->parts[i]) : Buffer());
-			}
+	Buffer recovered=ParityFEC::Decode(packetsForRecovery, fec.data);
+	LOGI("Recovered packet size %u", (unsigned int)recovered.Length());
+	if(recovered.IsEmpty())
+		return false;
+	for(uint32_t j=0;j<pkt->partCount;j++){
+		if(!pkt->receivedParts[j])
+			return pkt->AddFragment(*recovered, recovered.Length(), j);
+	}
+	return true;
+}
+
+bool PacketReassembler::DecodeCM256FEC(std::vector<FecPacket*>& fecs){
+	// all recovery packets of a group have the same header: recovery index, recovery count, fragment count of every frame
+	FecPacket& first=*fecs[0];
+	if(first.data.Length()<2+first.prevFrameCount)
+		return false;
+	unsigned int recoveryCount=first.data[1];
+	std::vector<uint32_t> partCounts;
+	for(uint32_t i=0;i<first.prevFrameCount;i++){
+		partCounts.push_back(first.data[2+i]);
+	}
+	size_t headerSize=2+first.prevFrameCount;
+
+	std::vector<Buffer> recoveryBlocks;
+	std::vector<std::pair<unsigned int, Buffer*>> recoveryPackets;
+	recoveryBlocks.reserve(fecs.size());
+	for(FecPacket* fec:fecs){
+		if(fec->seq!=first.seq || fec->prevFrameCount!=first.prevFrameCount || fec->data.Length()<=headerSize || fec->data[1]!=recoveryCount)
+			continue;
+		Buffer block(fec->data.Length()-headerSize);
+		block.CopyFrom(*fec->data+headerSize, 0, block.Length());
+		recoveryBlocks.push_back(std::move(block));
+		recoveryPackets.push_back(std::make_pair((unsigned int)fec->data[0], &recoveryBlocks.back()));
+	}
+
+	// fragments of all frames in the group, oldest first, with empty buffers for the missing ones
+	std::vector<Buffer> packetsForRecovery;
+	std::vector<Packet*> frames;
+	for(uint32_t i=0;i<first.prevFrameCount;i++){
+		uint32_t seq=first.seq-first.prevFrameCount+1+i;
+		Packet* frame=GetPacket(seq);
+		if(frame && frame->partCount!=partCounts[i]){
+			LOGE("CM256 FEC: frame %u has %u fragments, FEC packet says %u", seq, frame->partCount, partCounts[i]);
+			return false;
+		}
+		frames.push_back(frame);
+		for(uint32_t j=0;j<partCounts[i];j++){
+			packetsForRecovery.push_back(frame ? frame->GetFragment(j) : Buffer());
 		}
 	}
+	LOGI("Decoding CM256 FEC: %u recovery packets of %u for %u fragments", (unsigned int)recoveryPackets.size(), recoveryCount, (unsigned int)packetsForRecovery.size());
+	if(!CM256FEC::Decode(packetsForRecovery, recoveryPackets, recoveryCount))
+		return false;
 
-	if(fec.fecScheme==FEC_SCHEME_XOR){
-		Buffer recovered=ParityFEC::Decode(packetsForRecovery, fec.data);
-		LOGI("Recovered packet size %u", (unsigned int)recovered.Length());
-		if(!recovered.IsEmpty()){
-			std::unique_ptr<Packet>& pkt=packets[0];
-			if(pkt->parts.size()<pkt->partCount){
-				pkt->parts.push_back(std::move(recovered));
-			}else{
-				for(Buffer &b:pkt->parts){
-					if(b.IsEmpty()){
-						b=std::move(recovered);
-						break;
-					}
-				}
+	// fill in the pending frames; the ones that become complete will be delivered as usual
+	size_t offset=0;
+	for(uint32_t i=0;i<frames.size();i++){
+		Packet* frame=frames[i];
+		if(frame && frame->state==Packet::STATE_PENDING){
+			for(uint32_t j=0;j<frame->partCount;j++){
+				Buffer& recovered=packetsForRecovery[offset+j];
+				if(!frame->receivedParts[j])
+					frame->AddFragment(*recovered, recovered.Length(), j);
 			}
-			pkt->receivedPartCount++;
-			callback(pkt->Reassemble(), pkt->seq, pkt->isKeyframe, pkt->rotation);
 		}
+		offset+=partCounts[i];
 	}
-
-	return false;
+	Packet* pkt=GetFirstPendingPacket();
+	return pkt->receivedPartCount==pkt->partCount;
 }
 
 #pragma mark - Packet
 
-void PacketReassembler::Packet::AddFragment(Buffer pkt, uint32_t fragmentIndex){
+void PacketReassembler::Packet::Init(uint32_t seq, uint32_t timestamp, uint32_t partCount, bool keyframe, uint16_t rotation){
+	this->seq=seq;
+	this->timestamp=timestamp;
+	this->partCount=partCount;
+	receivedPartCount=0;
+	isKeyframe=keyframe;
+	this->rotation=rotation;
+	state=STATE_PENDING;
+	receivedParts.reset();
+	fragmentSize=0;
+	lastFragmentSize=0;
+	earlyLastFragment=Buffer();
+	parts.clear();
+	released=false;
+}
+
+bool PacketReassembler::Packet::AddFragment(const unsigned char* fragment, size_t length, uint32_t fragmentIndex){
 	//LOGV("Add fragment %u/%u to packet %u", fragmentIndex, partCount, timestamp);
-	if(parts.size()==fragmentIndex){
-		parts.push_back(std::move(pkt));
-		//LOGV("add1");
-	}else if(parts.size()>fragmentIndex){
-		assert(parts[fragmentIndex].IsEmpty());
-		parts[fragmentIndex]=std::move(pkt);
-		//LOGV("add2");
+	if(receivedParts[fragmentIndex]) // already recovered by FEC or retransmitted
+		return false;
+	if(fragmentIndex<partCount-1 && parts.empty() && (length==0 || (fragmentSize!=0 && length!=fragmentSize))){
+		LOGW("Fragment %u of frame %u is %u bytes, expected %u; keeping the fragments separately", fragmentIndex, seq, (unsigned int)length, (unsigned int)fragmentSize);
+		SplitIntoParts();
+	}
+	if(!parts.empty()){
+		parts[fragmentIndex]=Buffer(length);
+		if(length>0)
+			parts[fragmentIndex].CopyFrom(fragment, 0, length);
+	}else if(fragmentIndex<partCount-1){
+		fragmentSize=length;
+		Write(fragmentIndex*fragmentSize, fragment, length);
+		if(!earlyLastFragment.IsEmpty()){
+			Write((partCount-1)*fragmentSize, *earlyLastFragment, lastFragmentSize);
+			earlyLastFragment=Buffer();
+		}
 	}else{
-		while(parts.size()<fragmentIndex)
-			parts.push_back(Buffer());
-		parts.push_back(std::move(pkt));
-		//LOGV("add3");
+		lastFragmentSize=length;
+		if(partCount==1 || fragmentSize!=0){
+			Write((partCount-1)*fragmentSize, fragment, length);
+		}else if(length>0){
+			earlyLastFragment=Buffer(length);
+			earlyLastFragment.CopyFrom(fragment, 0, length);
+		}
 	}
+	receivedParts.set(fragmentIndex);
 	receivedPartCount++;
-	//assert(parts.size()>=receivedPartCount);
-	if(parts.size()<receivedPartCount)
-		LOGW("Received %u parts but parts.size is %u", (unsigned int)receivedPartCount, (unsigned int)parts.size());
+	return true;
 }
 
-Buffer PacketReassembler::Packet::Reassemble(){
-	assert(partCount==receivedPartCount);
-	assert(parts.size()==partCount);
-	if(partCount==1){
-		return Buffer::CopyOf(parts[0]);
+void PacketReassembler::Packet::Write(size_t offset, const unsigned char* fragment, size_t length){
+	if(data.Length()<offset+length){
+		// enough for the whole frame if the rest of the fragments are like this one
+		data.Resize(std::max(offset+length, partCount*length));
 	}
-	BufferOutputStream out(10240);
-	for(unsigned int i=0;i<partCount;i++){
-		out.WriteBytes(parts[i]);
-		//parts[i]=Buffer();
+	data.CopyFrom(fragment, offset, length);
+}
+
+void PacketReassembler::Packet::SplitIntoParts(){
+	std::vector<Buffer> received(partCount);
+	for(uint32_t i=0;i<partCount;i++){
+		received[i]=GetFragment(i);
+	}
+	parts=std::move(received);
+	earlyLastFragment=Buffer();
+}
+
+Buffer PacketReassembler::Packet::GetFragment(uint32_t fragmentIndex){
+	if(!receivedParts[fragmentIndex] || released)
+		return Buffer();
+	if(!parts.empty())
+		return Buffer::CopyOf(parts[fragmentIndex]);
+	if(fragmentIndex<partCount-1)
+		return Buffer::CopyOf(data, fragmentIndex*fragmentSize, fragmentSize);
+	if(!earlyLastFragment.IsEmpty())
+		return Buffer::CopyOf(earlyLastFragment);
+	if(lastFragmentSize==0)
+		return Buffer();
+	return Buffer::CopyOf(data, (partCount-1)*fragmentSize, lastFragmentSize);
+}
+
+Buffer PacketReassembler::Packet::Reassemble(bool keepForFEC){
+	assert(partCount==receivedPartCount);
+	if(!parts.empty()){
+		size_t size=0;
+		for(Buffer& part:parts)
+			size+=part.Length();
+		Buffer frame(size);
+		size_t offset=0;
+		for(Buffer& part:parts){
+			if(!part.IsEmpty())
+				frame.CopyFrom(part, part.Length(), 0, offset);
+			offset+=part.Length();
+		}
+		return frame;
 	}
-	return Buffer(std::move(out));
+	size_t size=(partCount-1)*fragmentSize+lastFragmentSize;
+	if(size==0)
+		return Buffer();
+	if(keepForFEC)
+		return Buffer::CopyOf(data, 0, size);
+	// nothing needs the fragments anymore, so the frame goes as is and the next one that takes this slot gets a new buffer
+	released=true;
+	data.Resize(size);
+	Buffer frame=std::move(data);
+	data=Buffer();
+	return frame;
 }
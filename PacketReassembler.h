@@ -6,6 +6,7 @@
 #define TGVOIP_PACKETREASSEMBLER_H
 
 #include <vector>
+#include <bitset>
 #include <functional>
 #include <unordered_map>
 #include <memory>
@@ -20,41 +21,101 @@ namespace tgvoip {
 		virtual ~PacketReassembler();
 
 		void Reset();
-		void AddFragment(Buffer pkt, unsigned int fragmentIndex, unsigned int fragmentCount, uint32_t pts, uint8_t fseq, bool keyframe, uint16_t rotation);
+		/**
+		 * The data is copied straight into the frame, so it only has to stay valid for the duration of the call
+		 */
+		void AddFragment(const unsigned char* data, size_t length, unsigned int fragmentIndex, unsigned int fragmentCount, uint32_t pts, uint8_t fseq, bool keyframe, uint16_t rotation);
 		void AddFEC(Buffer data, uint8_t fseq, unsigned int frameCount, unsigned int fecScheme);
 		void SetCallback(std::function<void(Buffer packet, uint32_t pts, bool keyframe, uint16_t rotation)> callback);
 
 	private:
 		struct Packet{
-			uint32_t seq;
-			uint32_t timestamp;
-			uint32_t partCount;
-			uint32_t receivedPartCount;
-			bool isKeyframe;
-			uint16_t rotation;
+			enum{
+				STATE_EMPTY,
+				STATE_PENDING,
+				STATE_DONE // delivered or dropped, the parts are still kept for FEC unless released
+			};
+
+			uint32_t seq=0;
+			uint32_t timestamp=0;
+			uint32_t partCount=0;
+			uint32_t receivedPartCount=0;
+			bool isKeyframe=false;
+			uint16_t rotation=0;
+			int state=STATE_EMPTY;
+			std::bitset<256> receivedParts;
+			// The frame itself. As long as all fragments but the last one are the same size, each one goes to
+			// index*fragmentSize as soon as it arrives. Reused for the frames that take this slot later.
+			Buffer data;
+			size_t fragmentSize=0; // 0 until one of the fragments other than the last one arrives
+			size_t lastFragmentSize=0;
+			// the last fragment if it arrives before fragmentSize is known, its place in data isn't known until then
+			Buffer earlyLastFragment;
+			// the fragments one by one instead of data, for a frame whose fragments turn out to be of different sizes
 			std::vector<Buffer> parts;
-			
-			Packet(uint32_t seq, uint32_t timestamp, uint32_t partCount, uint32_t receivedPartCount, bool keyframe, uint16_t rotation)
-    			:seq(seq), timestamp(timestamp), partCount(partCount), receivedPartCount(receivedPartCount), isKeyframe(keyframe), rotation(rotation){
-			
-			}
+			// data went to the callback as is, so the fragments aren't there for FEC anymore
+			bool released=false;
 
-			void AddFragment(Buffer pkt, uint32_t fragmentIndex);
-			Buffer Reassemble();
+			void Init(uint32_t seq, uint32_t timestamp, uint32_t partCount, bool keyframe, uint16_t rotation);
+			/**
+			 * @return false if this fragment was already there
+			 */
+			bool AddFragment(const unsigned char* fragment, size_t length, uint32_t fragmentIndex);
+			/**
+			 * @return a copy of a fragment that has been received, or an empty buffer, for FEC
+			 */
+			Buffer GetFragment(uint32_t fragmentIndex);
+			/**
+			 * @param keepForFEC whether the fragments have to stay for FEC; if not, data itself is returned instead of a copy
+			 */
+			Buffer Reassemble(bool keepForFEC);
+
+		private:
+			void Write(size_t offset, const unsigned char* fragment, size_t length);
+			void SplitIntoParts();
 		};
 		struct FecPacket{
 			uint32_t seq;
 			uint32_t prevFrameCount;
 			uint32_t fecScheme;
 			Buffer data;
+
+			bool Covers(uint32_t frameSeq) const{
+				return (int32_t)(seq-frameSeq)>=0 && (uint32_t)(seq-frameSeq)<prevFrameCount;
+			}
 		};
 
-		bool TryDecodeFEC(FecPacket& fec);
+		/**
+		 * Restores the full frame seq from the 8 bits that are sent
+		 */
+		uint32_t ExpandFrameSeq(uint8_t fseq);
+		/**
+		 * @return the frame with this seq if it's still in the ring, or NULL
+		 */
+		Packet* GetPacket(uint32_t seq);
+		Packet* GetFirstPendingPacket();
+		/**
+		 * @return whether none of the frames after this one up to the last one has been delivered or dropped yet
+		 */
+		bool CanInsertLateFrame(uint32_t seq);
+		bool TryDecodeFEC();
+		bool DecodeParityFEC(FecPacket& fec);
+		bool DecodeCM256FEC(std::vector<FecPacket*>& fecs);
+		bool CanStillRecover();
+		/**
+		 * @return whether FEC for a frame that may share a group with this one can still need its fragments
+		 */
+		bool MayBeNeededForFEC(Packet* pkt);
+		void DeliverFirstPacket();
+		void DropFirstPacket();
 
 		std::function<void(Buffer, uint32_t, bool, uint16_t)> callback;
-		std::vector<std::unique_ptr<Packet>> packets;
-		std::vector<std::unique_ptr<Packet>> oldPackets; // for FEC
+		// frames by seq modulo the size, pending ones and the few before them that FEC may still need
+		std::vector<Packet> packets;
+		unsigned int pendingPacketCount=0;
+		// a ring too, the oldest one gets replaced
 		std::vector<FecPacket> fecPackets;
+		unsigned int nextFecPacket=0;
 		uint32_t maxTimestamp=0;
 		uint32_t lastFrameSeq=0;
 		bool waitingForFEC=false;
@@ -57,6 +57,10 @@ namespace tgvoip{
 			return controller->config;
 		}
 
+		FecController& GetFecController(){
+			return controller->fecController;
+		}
+
         VoIPController* controller;
 	};
 }
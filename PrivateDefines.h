@@ -54,6 +54,14 @@
 
 #define DEFAULT_MTU 1100
 
+// Room around outgoing packet payloads so that everything on the way to the socket can be added in place (see SendPacket).
+// The headroom fits the stream and packet headers, the length, and the 32 bytes of key hashed in front of the packet.
+// Whatever is in front of the packet also becomes the headroom of its encrypted copy, which needs up to 40 bytes of headers.
+#define OUTGOING_PACKET_HEADROOM 128
+#define PACKET_ENCRYPTION_HEADROOM 36
+// padding, plus the encrypted copy of the padded packet (length, len bytes of header and data, up to 31 bytes of padding)
+#define PACKET_ENCRYPTION_TAILROOM(len) (31+4+(len)+31)
+
 /*flags:# voice_call_id:flags.2?int128 in_seq_no:flags.4?int out_seq_no:flags.4?int
 	 * recent_received_mask:flags.5?int proto:flags.3?int extra:flags.1?string raw_data:flags.0?string*/
 #define PFLAG_HAS_DATA 1
@@ -86,6 +94,7 @@
 #define INIT_FLAG_GROUP_CALLS_SUPPORTED 2
 #define INIT_FLAG_VIDEO_SEND_SUPPORTED 4
 #define INIT_FLAG_VIDEO_RECV_SUPPORTED 8
+#define INIT_FLAG_VIDEO_FEC_CM256_SUPPORTED 16
 
 #define INIT_VIDEO_RES_NONE 0
 #define INIT_VIDEO_RES_240 1
@@ -14,14 +14,18 @@
 #include "VoIPController.h"
 #include "logging.h"
 #include "threading.h"
+#include "Clock.h"
 #include "Buffers.h"
 #include "OpusEncoder.h"
 #include "OpusDecoder.h"
 #include "VoIPServerConfig.h"
+#include "VoIPEngine.h"
+#include "crypto/AES.h"
 #include "PrivateDefines.h"
 #include "json11.hpp"
 #include "PacketSender.h"
 #include "video/VideoPacketSender.h"
+#include "video/VideoFEC.h"
 #include <assert.h>
 #include <time.h>
 #include <math.h>
@@ -79,13 +83,24 @@ extern "C" {
 #include <openssl/rand.h>
 }
 
+// The AES ones go to the built-in implementation when the CPU has AES instructions, mostly to skip
+// AES_set_encrypt_key on every call, which costs about as much as encrypting a whole packet.
+
 void tgvoip_openssl_aes_ige_encrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv){
+	if(tgvoip::AES::IsHardwareAccelerated()){
+		tgvoip::AES::IGEEncrypt(in, out, length, key, iv);
+		return;
+	}
 	AES_KEY akey;
 	AES_set_encrypt_key(key, 32*8, &akey);
 	AES_ige_encrypt(in, out, length, &akey, iv, AES_ENCRYPT);
 }
 
 void tgvoip_openssl_aes_ige_decrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv){
+	if(tgvoip::AES::IsHardwareAccelerated()){
+		tgvoip::AES::IGEDecrypt(in, out, length, key, iv);
+		return;
+	}
 	AES_KEY akey;
 	AES_set_decrypt_key(key, 32*8, &akey);
 	AES_ige_encrypt(in, out, length, &akey, iv, AES_DECRYPT);
@@ -104,18 +119,30 @@ void tgvoip_openssl_sha256(uint8_t* msg, size_t len, uint8_t* output){
 }
 
 void tgvoip_openssl_aes_ctr_encrypt(uint8_t* inout, size_t length, uint8_t* key, uint8_t* iv, uint8_t* ecount, uint32_t* num){
+	if(tgvoip::AES::IsHardwareAccelerated()){
+		tgvoip::AES::CTREncrypt(inout, length, key, iv, ecount, num);
+		return;
+	}
 	AES_KEY akey;
 	AES_set_encrypt_key(key, 32*8, &akey);
 	CRYPTO_ctr128_encrypt(inout, inout, length, &akey, iv, ecount, num, (block128_f) AES_encrypt);
 }
 
 void tgvoip_openssl_aes_cbc_encrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv){
+	if(tgvoip::AES::IsHardwareAccelerated()){
+		tgvoip::AES::CBCEncrypt(in, out, length, key, iv);
+		return;
+	}
 	AES_KEY akey;
 	AES_set_encrypt_key(key, 256, &akey);
 	AES_cbc_encrypt(in, out, length, &akey, iv, AES_ENCRYPT);
 }
 
 void tgvoip_openssl_aes_cbc_decrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv){
+	if(tgvoip::AES::IsHardwareAccelerated()){
+		tgvoip::AES::CBCDecrypt(in, out, length, key, iv);
+		return;
+	}
 	AES_KEY akey;
 	AES_set_decrypt_key(key, 256, &akey);
 	AES_cbc_encrypt(in, out, length, &akey, iv, AES_DECRYPT);
@@ -239,6 +266,10 @@ VoIPController::VoIPController() : activeNetItfName(""),
 	packetLossToEnableExtraEC=ServerConfig::GetSharedInstance()->GetDouble("packet_loss_for_extra_ec", 0.02);
 	maxUnsentStreamPackets=static_cast<uint32_t>(ServerConfig::GetSharedInstance()->GetInt("max_unsent_stream_packets", 2));
 	unackNopThreshold=static_cast<uint32_t>(ServerConfig::GetSharedInstance()->GetInt("unack_nop_threshold", 10));
+	sendBatching=ServerConfig::GetSharedInstance()->GetBoolean("use_udp_send_batching", true);
+
+	receivedPackets.reserve(MAX_RECV_BATCH_SIZE*4);
+	processingPackets.reserve(MAX_RECV_BATCH_SIZE*4);
 
 #ifdef __APPLE__
 	machTimestart=0;
@@ -310,10 +341,16 @@ void VoIPController::Stop(){
 	if(realUdpSocket!=udpSocket)
 		realUdpSocket->Close();
 	selectCanceller->CancelSelect();
-	//Buffer emptyBuf(0);
-	//PendingOutgoingPacket emptyPacket{0, 0, 0, move(emptyBuf), 0};
-	//sendQueue->Put(move(emptyPacket));
-	rawSendQueue.Put(RawPendingOutgoingPacket{NetworkPacket::Empty(), nullptr});
+	if(engine){
+		// after this, the engine threads won't touch this controller anymore
+		LOGD("before remove from engine");
+		engine->RemoveController(this);
+	}else{
+		//Buffer emptyBuf(0);
+		//PendingOutgoingPacket emptyPacket{0, 0, 0, move(emptyBuf), 0};
+		//sendQueue->Put(move(emptyPacket));
+		rawSendQueue.Put(RawPendingOutgoingPacket{NetworkPacket::Empty(), nullptr});
+	}
 	LOGD("before join sendThread");
 	if(sendThread){
 		sendThread->Join();
@@ -370,6 +407,7 @@ void VoIPController::SetRemoteEndpoints(vector<Endpoint> endpoints, bool allowP2
 			useTCP=false;
 		LOGV("Adding endpoint: %s:%d, %s", itrtr->address.ToString().c_str(), itrtr->port, itrtr->type==Endpoint::Type::UDP_RELAY ? "UDP" : "TCP");
 	}
+	RebuildEndpointIndex();
 	preferredRelay=currentEndpoint;
 	this->allowP2p=allowP2p;
 	this->connectionMaxLayer=connectionMaxLayer;
@@ -379,6 +417,18 @@ void VoIPController::SetRemoteEndpoints(vector<Endpoint> endpoints, bool allowP2
 	AddIPv6Relays();
 }
 
+void VoIPController::SetEngine(VoIPEngine* engine){
+	assert(!runReceiver);
+	this->engine=engine;
+	messageThread.SetPool(engine ? &engine->GetMessageThreadPool() : NULL);
+	if(engine){
+		// there's one send thread for all calls, so it can fall behind; drop the oldest packets instead of aborting
+		rawSendQueue.SetOverflowCallback([](RawPendingOutgoingPacket pkt){
+			LOGW("Send queue overflow, dropping packet");
+		});
+	}
+}
+
 void VoIPController::Start(){
 	LOGW("Starting voip controller");
 	udpSocket->Open();
@@ -388,9 +438,17 @@ void VoIPController::Start(){
 	}
 
 	runReceiver=true;
-	recvThread=new Thread(bind(&VoIPController::RunRecvThread, this));
-	recvThread->SetName("VoipRecv");
-	recvThread->Start();
+	// SOCKS5 needs a blocking handshake on the receive thread, so proxied calls keep their own
+	useEngineReceiver=engine && proxyProtocol!=PROXY_SOCKS5;
+	if(useEngineReceiver){
+		udpConnectivityState=UDP_PING_PENDING;
+		udpPingTimeoutID=messageThread.Post(std::bind(&VoIPController::SendUdpPings, this), 0.0, 0.5);
+		engine->AddController(this);
+	}else{
+		recvThread=new Thread(bind(&VoIPController::RunRecvThread, this));
+		recvThread->SetName("VoipRecv");
+		recvThread->Start();
+	}
 
 	messageThread.Start();
 }
@@ -406,6 +464,14 @@ void VoIPController::Connect(){
 
 	//InitializeTimers();
 	//SendInit();
+	if(engine){
+		messageThread.Post([this]{
+			InitializeAudio();
+			InitializeTimers();
+			SendInit();
+		});
+		return;
+	}
 	sendThread=new Thread(bind(&VoIPController::RunSendThread, this));
 	sendThread->SetName("VoipSend");
 	sendThread->Start();
@@ -454,6 +520,7 @@ void VoIPController::SetNetworkType(int type){
 					MutexGuard m(endpointsMutex);
 					constexpr int64_t lanID=(int64_t) (FOURCC('L', 'A', 'N', '4')) << 32;
 					endpoints.erase(lanID);
+					RebuildEndpointIndex();
 					for(pair<const int64_t, Endpoint> &e:endpoints){
 						Endpoint &endpoint=e.second;
 						if(endpoint.type==Endpoint::Type::UDP_RELAY && useTCP){
@@ -488,7 +555,7 @@ void VoIPController::SetNetworkType(int type){
 				SendExtra(buf, EXTRA_TYPE_NETWORK_CHANGED);
 			}
 			needReInitUdpProxy=true;
-			selectCanceller->CancelSelect();
+			CancelReceiverSelect();
 			didSendIPv6Endpoint=false;
 
 			AddIPv6Relays();
@@ -508,9 +575,11 @@ double VoIPController::GetAverageRTT(){
 		if(diff<32){
 			double res=0;
 			int count=0;
-			for(std::vector<RecentOutgoingPacket>::iterator itr=recentOutgoingPackets.begin();itr!=recentOutgoingPackets.end();++itr){
-				if(itr->ackTime>0){
-					res+=(itr->ackTime-itr->sendTime);
+			uint32_t newestSeq=recentOutgoingPackets.GetNewestSeq();
+			for(uint32_t i=0;i<MAX_RECENT_PACKETS;i++){
+				RecentOutgoingPacket* pkt=recentOutgoingPackets.Get(newestSeq-i);
+				if(pkt && pkt->ackTime>0){
+					res+=(pkt->ackTime-pkt->sendTime);
 					count++;
 				}
 			}
@@ -634,6 +703,7 @@ string VoIPController::GetDebugString(){
 			r+=buffer;
 		}
 	}
+	r+="\n"+fecController.GetDebugString();
 	if(!peerVideoDecoders.empty()){
 		r+="\nPeer codecs: ";
 		for(uint32_t codec:peerVideoDecoders){
@@ -1045,10 +1115,22 @@ void VoIPController::RunSendThread(){
 	InitializeTimers();
 	messageThread.Post(bind(&VoIPController::SendInit, this));
 
+	vector<NetworkPacket> udpBatch;
+	udpBatch.reserve(MAX_SEND_BATCH_SIZE);
+	while(SendRawPackets(rawSendQueue.GetBlocking(), udpBatch)){}
+
+	LOGI("=== send thread exiting ===");
+}
+
+// Sends pkt and, if batching, whatever else is already in rawSendQueue, up to MAX_SEND_BATCH_SIZE packets.
+// Returns false when it encounters the empty packet that stops the send thread.
+bool VoIPController::SendRawPackets(RawPendingOutgoingPacket pkt, vector<NetworkPacket>& udpBatch){
+	bool running=true;
 	while(true){
-		RawPendingOutgoingPacket pkt=rawSendQueue.GetBlocking();
-		if(pkt.packet.IsEmpty())
+		if(pkt.packet.IsEmpty()){
+			running=false;
 			break;
+		}
 
 		if(IS_MOBILE_NETWORK(networkType))
 			stats.bytesSentMobile+=(uint64_t)pkt.packet.data.Length();
@@ -1058,12 +1140,22 @@ void VoIPController::RunSendThread(){
 			if(pkt.socket && !pkt.socket->IsFailed()){
 				pkt.socket->Send(std::move(pkt.packet));
 			}
+		}else if(sendBatching){
+			udpBatch.push_back(std::move(pkt.packet));
 		}else{
 			udpSocket->Send(std::move(pkt.packet));
 		}
-	}
 
-	LOGI("=== send thread exiting ===");
+		// this is the only thread that takes packets out of the queue, so whatever's there can be taken without blocking
+		if(!sendBatching || udpBatch.size()>=MAX_SEND_BATCH_SIZE || rawSendQueue.Size()==0)
+			break;
+		pkt=rawSendQueue.Get();
+	}
+	if(!udpBatch.empty()){
+		udpSocket->SendBatch(udpBatch);
+		udpBatch.clear();
+	}
+	return running;
 }
 
 #pragma mark - Miscellaneous
@@ -1156,16 +1248,21 @@ void VoIPController::HandleAudioInput(unsigned char *data, size_t len, unsigned
 
 	// TODO make an AudioPacketSender
 
-	Buffer dataBuf=outgoingAudioBufferPool.Get();
-	Buffer secondaryDataBuf=secondaryLen && secondaryData ? outgoingAudioBufferPool.Get() : Buffer();
-	dataBuf.CopyFrom(data, 0, len);
+	// this is the only copy of the frame, the headers, the extra FEC data and the encryption all go around it in place
+	size_t maxPayloadLen=len+(secondaryLen ? 1+4*(1+secondaryLen) : 0);
+	PacketBuffer dataBuf(OUTGOING_PACKET_HEADROOM, maxPayloadLen+PACKET_ENCRYPTION_TAILROOM(OUTGOING_PACKET_HEADROOM+maxPayloadLen));
+	memcpy(dataBuf.Append(len), data, len);
+	PacketBuffer secondaryDataBuf;
 	if(secondaryLen && secondaryData){
-		secondaryDataBuf.CopyFrom(secondaryData, 0, secondaryLen);
+		secondaryDataBuf=PacketBuffer(0, secondaryLen);
+		memcpy(secondaryDataBuf.Append(secondaryLen), secondaryData, secondaryLen);
+	}else{
+		secondaryLen=0;
 	}
-	shared_ptr<Buffer> dataBufPtr=make_shared<Buffer>(move(dataBuf));
-	shared_ptr<Buffer> secondaryDataBufPtr=make_shared<Buffer>(move(secondaryDataBuf));
 
-	messageThread.Post([this, dataBufPtr, secondaryDataBufPtr, len, secondaryLen](){
+	messageThread.Post([this, dataBuf, secondaryDataBuf]() mutable{
+		size_t len=dataBuf.Length();
+		size_t secondaryLen=secondaryDataBuf.Length();
 		unsentStreamPacketsHistory.Add(static_cast<unsigned int>(unsentStreamPackets));
 		if(unsentStreamPacketsHistory.Average()>=maxUnsentStreamPackets && !videoPacketSender){
 			LOGW("Resetting stalled send queue");
@@ -1181,41 +1278,44 @@ void VoIPController::HandleAudioInput(unsigned char *data, size_t len, unsigned
 		if(!receivedInitAck)
 			return;
 
-		BufferOutputStream pkt(1500);
+		PacketBuffer pkt=move(dataBuf);
 
 		bool hasExtraFEC=peerVersion>=7 && secondaryLen && shittyInternetMode;
 		unsigned char flags=(unsigned char) (len>255 || hasExtraFEC ? STREAM_DATA_FLAG_LEN16 : 0);
-		pkt.WriteByte((unsigned char) (1 | flags)); // streamID + flags
+		unsigned char headerBuf[7];
+		BufferOutputStream header(headerBuf, sizeof(headerBuf));
+		header.WriteByte((unsigned char) (1 | flags)); // streamID + flags
 		if(len>255 || hasExtraFEC){
 			int16_t lenAndFlags=static_cast<int16_t>(len);
 			if(hasExtraFEC)
 				lenAndFlags|=STREAM_DATA_XFLAG_EXTRA_FEC;
-			pkt.WriteInt16(lenAndFlags);
+			header.WriteInt16(lenAndFlags);
 		}else{
-			pkt.WriteByte((unsigned char) len);
+			header.WriteByte((unsigned char) len);
 		}
-		pkt.WriteInt32(audioTimestampOut);
-		pkt.WriteBytes(*dataBufPtr, 0, len);
+		header.WriteInt32(audioTimestampOut);
+		memcpy(pkt.Prepend(header.GetLength()), headerBuf, header.GetLength());
 
 		if(hasExtraFEC){
-			Buffer ecBuf(secondaryLen);
-			ecBuf.CopyFrom(*secondaryDataBufPtr, 0, secondaryLen);
-			ecAudioPackets.push_back(move(ecBuf));
+			ecAudioPackets.push_back(secondaryDataBuf.ToBuffer());
 			while(ecAudioPackets.size()>4)
 				ecAudioPackets.erase(ecAudioPackets.begin());
-			pkt.WriteByte((unsigned char) std::min((int) ecAudioPackets.size(), extraEcLevel));
+			BufferOutputStream ec(pkt.Data()+pkt.Length(), pkt.Tailroom());
+			ec.WriteByte((unsigned char) std::min((int) ecAudioPackets.size(), extraEcLevel));
 			for(vector<Buffer>::iterator ecData=ecAudioPackets.begin()+std::max(0, (int) ecAudioPackets.size()-extraEcLevel); ecData!=ecAudioPackets.end(); ++ecData){
-				pkt.WriteByte((unsigned char) ecData->Length());
-				pkt.WriteBytes(*ecData);
+				ec.WriteByte((unsigned char) ecData->Length());
+				ec.WriteBytes(*ecData);
 			}
+			pkt.Append(ec.GetLength());
 		}
 
 		unsentStreamPackets++;
+		size_t pktLen=pkt.Length();
 		PendingOutgoingPacket p{
 				/*.seq=*/GenerateOutSeq(),
 				/*.type=*/PKT_STREAM_DATA,
-				/*.len=*/pkt.GetLength(),
-				/*.data=*/Buffer(move(pkt)),
+				/*.len=*/pktLen,
+				/*.data=*/pkt.ToBuffer(),
 				/*.endpoint=*/0,
 		};
 
@@ -1223,25 +1323,23 @@ void VoIPController::HandleAudioInput(unsigned char *data, size_t len, unsigned
 
 		SendOrEnqueuePacket(move(p));
 		if(peerVersion<7 && secondaryLen && shittyInternetMode){
-			Buffer ecBuf(secondaryLen);
-			ecBuf.CopyFrom(*secondaryDataBufPtr, 0, secondaryLen);
-			ecAudioPackets.push_back(move(ecBuf));
+			ecAudioPackets.push_back(secondaryDataBuf.ToBuffer());
 			while(ecAudioPackets.size()>4)
 				ecAudioPackets.erase(ecAudioPackets.begin());
-			pkt=BufferOutputStream(1500);
-			pkt.WriteByte(outgoingStreams[0]->id);
-			pkt.WriteInt32(audioTimestampOut);
-			pkt.WriteByte((unsigned char) std::min((int) ecAudioPackets.size(), extraEcLevel));
+			BufferOutputStream ecPkt(1500);
+			ecPkt.WriteByte(outgoingStreams[0]->id);
+			ecPkt.WriteInt32(audioTimestampOut);
+			ecPkt.WriteByte((unsigned char) std::min((int) ecAudioPackets.size(), extraEcLevel));
 			for(vector<Buffer>::iterator ecData=ecAudioPackets.begin()+std::max(0, (int) ecAudioPackets.size()-extraEcLevel); ecData!=ecAudioPackets.end(); ++ecData){
-				pkt.WriteByte((unsigned char) ecData->Length());
-				pkt.WriteBytes(*ecData);
+				ecPkt.WriteByte((unsigned char) ecData->Length());
+				ecPkt.WriteBytes(*ecData);
 			}
 
 			PendingOutgoingPacket p{
 					GenerateOutSeq(),
 					PKT_STREAM_EC,
-					pkt.GetLength(),
-					Buffer(move(pkt)),
+					ecPkt.GetLength(),
+					Buffer(move(ecPkt)),
 					0
 			};
 			SendOrEnqueuePacket(move(p));
@@ -1389,13 +1487,7 @@ uint32_t VoIPController::GenerateOutSeq(){
 }
 
 void VoIPController::WritePacketHeader(uint32_t pseq, BufferOutputStream *s, unsigned char type, uint32_t length, PacketSender* source){
-	uint32_t acks=0;
-	int i;
-	for(i=0;i<32;i++){
-		if(find(recentIncomingPackets.begin(), recentIncomingPackets.end(), lastRemoteSeq-(i+1))!=recentIncomingPackets.end()){
-			acks |= (1 << (31-i));
-		}
-	}
+	uint32_t acks=recentIncomingSeqs.GetAckMask();
 
 	if(peerVersion>=8 || (!peerVersion && connectionMaxLayer>=92)){
 		s->WriteByte(type);
@@ -1514,7 +1606,12 @@ void VoIPController::WritePacketHeader(uint32_t pseq, BufferOutputStream *s, uns
 
 
 	unacknowledgedIncomingPacketCount=0;
-	recentOutgoingPackets.push_back(RecentOutgoingPacket{
+	// The slot this packet goes into may still hold one that the loss check hasn't got to. Once overwritten it can't
+	// be looked up anymore, so it's settled now, as lost unless it has been acknowledged.
+	while((int32_t)(pseq-nextLossCheckSeq)>=RecentOutgoingPacketRing::SIZE){
+		CheckNextOutgoingPacketForLoss(0.0, 0.0, true);
+	}
+	recentOutgoingPackets.Add(RecentOutgoingPacket{
 			pseq,
 			0,
 			GetCurrentTime(),
@@ -1524,9 +1621,6 @@ void VoIPController::WritePacketHeader(uint32_t pseq, BufferOutputStream *s, uns
 			source,
 			false
 	});
-	while(recentOutgoingPackets.size()>MAX_RECENT_PACKETS){
-		recentOutgoingPackets.erase(recentOutgoingPackets.begin());
-	}
 	lastSentSeq=pseq;
 	//LOGI("packet header size %d", s->GetLength());
 }
@@ -1549,6 +1643,8 @@ void VoIPController::SendInit(){
 			flags|=INIT_FLAG_GROUP_CALLS_SUPPORTED;
 		if(config.enableVideoReceive)
 			flags|=INIT_FLAG_VIDEO_RECV_SUPPORTED;
+		if(config.enableVideoReceive && video::CM256FEC::IsSupported())
+			flags|=INIT_FLAG_VIDEO_FEC_CM256_SUPPORTED;
 		if(config.enableVideoSend)
 			flags|=INIT_FLAG_VIDEO_SEND_SUPPORTED;
 		if(dataSavingMode)
@@ -1671,82 +1767,48 @@ void VoIPController::RunRecvThread(){
 		udpConnectivityState=UDP_PING_PENDING;
 		udpPingTimeoutID=messageThread.Post(std::bind(&VoIPController::SendUdpPings, this), 0.0, 0.5);
 	}
+	vector<NetworkPacket> recvBatch;
+	recvBatch.reserve(MAX_RECV_BATCH_SIZE);
+	vector<NetworkSocket*> readSockets;
+	vector<NetworkSocket*> errorSockets;
+	vector<NetworkSocket*> writeSockets;
+	// Sockets stay registered with the poller until something cancels the wait or a socket fails.
+	// Everything that adds or replaces sockets cancels the wait, so that's when the set is rebuilt.
+	unique_ptr<NetworkSocketPoller> poller(NetworkSocketPoller::Create(selectCanceller));
+	vector<shared_ptr<NetworkSocket>> tcpSockets;
+	bool needUpdateSockets=true;
 	while(runReceiver){
 		
 		if(proxyProtocol==PROXY_SOCKS5 && needReInitUdpProxy){
 			InitUDPProxy();
 			needReInitUdpProxy=false;
+			needUpdateSockets=true;
 		}
 
-		vector<NetworkSocket*> readSockets;
-		vector<NetworkSocket*> errorSockets;
-		vector<NetworkSocket*> writeSockets;
-		readSockets.push_back(udpSocket);
-		errorSockets.push_back(realUdpSocket);
-		if(!realUdpSocket->IsReadyToSend())
-			writeSockets.push_back(realUdpSocket);
-		
-		{
-			MutexGuard m(endpointsMutex);
-			for(pair<const int64_t, Endpoint>& _e:endpoints){
-				const Endpoint& e=_e.second;
-				if(e.type==Endpoint::Type::TCP_RELAY){
-					if(e.socket){
-						readSockets.push_back(&*e.socket);
-						errorSockets.push_back(&*e.socket);
-						if(!e.socket->IsReadyToSend()){
-							NetworkSocketSOCKS5Proxy* proxy=dynamic_cast<NetworkSocketSOCKS5Proxy*>(&*e.socket);
-							if(!proxy || proxy->NeedSelectForSending())
-    							writeSockets.push_back(&*e.socket);
-						}
-					}
-				}
-			}
+		if(needUpdateSockets){
+			poller->RemoveAllSockets();
+			tcpSockets.clear();
+			AddSocketsToPoller(poller.get(), tcpSockets);
+			needUpdateSockets=false;
 		}
 
-		{
-			bool selRes=NetworkSocket::Select(readSockets, writeSockets, errorSockets, selectCanceller);
-			if(!selRes){
-				LOGV("Select canceled");
-				continue;
-			}
+		if(!poller->Poll(readSockets, writeSockets, errorSockets)){
+			LOGV("Select canceled");
+			needUpdateSockets=true;
+			continue;
 		}
 		if(!runReceiver)
 			return;
 
 		if(!errorSockets.empty()){
-			if(find(errorSockets.begin(), errorSockets.end(), realUdpSocket)!=errorSockets.end()){
-				LOGW("UDP socket failed");
-				SetState(STATE_FAILED);
+			if(!HandleSocketErrors(errorSockets))
 				return;
-			}
-			MutexGuard m(endpointsMutex);
-			for(NetworkSocket*& socket:errorSockets){
-				for(pair<const int64_t, Endpoint>& _e:endpoints){
-					Endpoint& e=_e.second;
-					if(e.socket && &*e.socket==socket){
-						e.socket->Close();
-						e.socket.reset();
-						LOGI("Closing failed TCP socket for %s:%u", e.GetAddress().ToString().c_str(), e.port);
-					}
-				}
-			}
+			needUpdateSockets=true;
 			continue;
 		}
 
 		for(NetworkSocket*& socket:readSockets){
-			//while(packet.length){
-            NetworkPacket packet=socket->Receive();
-			if(packet.address.IsEmpty()){
-				LOGE("Packet has null address. This shouldn't happen.");
-				continue;
-			}
-			if(packet.data.IsEmpty()){
-				LOGE("Packet has zero length.");
-				continue;
-			}
-			//LOGV("Received %d bytes from %s:%d at %.5lf", len, packet.address->ToString().c_str(), packet.port, GetCurrentTime());
-			messageThread.Post(bind(&VoIPController::NetworkPacketReceived, this, make_shared<NetworkPacket>(move(packet))));
+			ReceiveFromSocket(socket, recvBatch);
 		}
 
 		if(!writeSockets.empty()){
@@ -1756,6 +1818,80 @@ void VoIPController::RunRecvThread(){
 	LOGI("=== recv thread exiting ===");
 }
 
+void VoIPController::AddSocketsToPoller(NetworkSocketPoller* poller, vector<shared_ptr<NetworkSocket>>& tcpSockets){
+	poller->AddSocket(udpSocket, NetworkSocketPoller::POLL_READ);
+	poller->AddSocket(realUdpSocket, NetworkSocketPoller::POLL_WRITE_AND_ERROR);
+	MutexGuard m(endpointsMutex);
+	for(pair<const int64_t, Endpoint>& _e:endpoints){
+		const Endpoint& e=_e.second;
+		if(e.type==Endpoint::Type::TCP_RELAY && e.socket){
+			// keep a reference so the socket can't go away while it's registered
+			tcpSockets.push_back(e.socket);
+			poller->AddSocket(&*e.socket, NetworkSocketPoller::POLL_READ | NetworkSocketPoller::POLL_WRITE_AND_ERROR);
+		}
+	}
+}
+
+// Returns false if the UDP socket failed, in which case the call is failed too and the receiver should stop.
+bool VoIPController::HandleSocketErrors(vector<NetworkSocket*>& errorSockets){
+	if(find(errorSockets.begin(), errorSockets.end(), realUdpSocket)!=errorSockets.end()){
+		LOGW("UDP socket failed");
+		SetState(STATE_FAILED);
+		return false;
+	}
+	MutexGuard m(endpointsMutex);
+	for(NetworkSocket*& socket:errorSockets){
+		for(pair<const int64_t, Endpoint>& _e:endpoints){
+			Endpoint& e=_e.second;
+			if(e.socket && &*e.socket==socket){
+				e.socket->Close();
+				e.socket.reset();
+				LOGI("Closing failed TCP socket for %s:%u", e.GetAddress().ToString().c_str(), e.port);
+			}
+		}
+	}
+	return true;
+}
+
+void VoIPController::ReceiveFromSocket(NetworkSocket* socket, vector<NetworkPacket>& recvBatch){
+	// drain everything that's already queued on the socket before going back to select
+	size_t count;
+	do{
+		recvBatch.clear();
+		count=socket->ReceiveBatch(recvBatch, MAX_RECV_BATCH_SIZE);
+		if(count==0)
+			continue;
+		bool needPost;
+		{
+			MutexGuard m(receivedPacketsMutex);
+			// if there already are packets waiting, the message to process them is already posted too
+			needPost=receivedPackets.empty();
+			for(NetworkPacket& packet:recvBatch){
+				if(packet.address.IsEmpty()){
+					LOGE("Packet has null address. This shouldn't happen.");
+					continue;
+				}
+				if(packet.data.IsEmpty()){
+					LOGE("Packet has zero length.");
+					continue;
+				}
+				//LOGV("Received %d bytes from %s:%d at %.5lf", len, packet.address->ToString().c_str(), packet.port, GetCurrentTime());
+				receivedPackets.push_back(move(packet));
+			}
+			needPost=needPost && !receivedPackets.empty();
+		}
+		if(needPost)
+			messageThread.Post([this]{ ProcessReceivedPackets(); });
+	}while(count==MAX_RECV_BATCH_SIZE && runReceiver);
+}
+
+void VoIPController::CancelReceiverSelect(){
+	if(useEngineReceiver)
+		engine->UpdateSockets();
+	else
+		selectCanceller->CancelSelect();
+}
+
 void VoIPController::TrySendQueuedPackets(){
 	ENFORCE_MSG_THREAD;
 
@@ -1789,49 +1925,32 @@ bool VoIPController::WasOutgoingPacketAcknowledged(uint32_t seq){
 }
 
 VoIPController::RecentOutgoingPacket *VoIPController::GetRecentOutgoingPacket(uint32_t seq){
-	for(RecentOutgoingPacket& opkt:recentOutgoingPackets){
-		if(opkt.seq==seq){
-			return &opkt;
-		}
-	}
-	return NULL;
+	return recentOutgoingPackets.Get(seq);
 }
 
-void VoIPController::NetworkPacketReceived(shared_ptr<NetworkPacket> _packet){
+void VoIPController::ProcessReceivedPackets(){
 	ENFORCE_MSG_THREAD;
 
-	NetworkPacket& packet=*_packet;
+	{
+		MutexGuard m(receivedPacketsMutex);
+		processingPackets.swap(receivedPackets);
+	}
+	for(NetworkPacket& packet:processingPackets){
+		NetworkPacketReceived(packet);
+	}
+	processingPackets.clear();
+}
 
-	int64_t srcEndpointID=0;
+void VoIPController::NetworkPacketReceived(NetworkPacket& packet){
+	ENFORCE_MSG_THREAD;
 
-	if(!packet.address.isIPv6){
-		for(pair<const int64_t, Endpoint>& _e:endpoints){
-			const Endpoint& e=_e.second;
-			if(e.address==packet.address && e.port==packet.port){
-				if((e.type!=Endpoint::Type::TCP_RELAY && packet.protocol==NetworkProtocol::UDP) || (e.type==Endpoint::Type::TCP_RELAY && packet.protocol==NetworkProtocol::TCP)){
-					srcEndpointID=e.id;
-					break;
-				}
-			}
-		}
-		if(!srcEndpointID && packet.protocol==NetworkProtocol::UDP){
-			try{
-				Endpoint &p2p=GetEndpointByType(Endpoint::Type::UDP_P2P_INET);
-				if(p2p.rtts[0]==0.0 && p2p.address.PrefixMatches(24, packet.address)){
-					LOGD("Packet source matches p2p endpoint partially: %s:%u", packet.address.ToString().c_str(), packet.port);
-					srcEndpointID=p2p.id;
-				}
-			}catch(out_of_range& ex){}
-		}
-	}else{
-		for(pair<const int64_t, Endpoint> &_e:endpoints){
-			const Endpoint& e=_e.second;
-			if(e.v6address==packet.address && e.port==packet.port && e.IsIPv6Only()){
-				if((e.type!=Endpoint::Type::TCP_RELAY && packet.protocol==NetworkProtocol::UDP) || (e.type==Endpoint::Type::TCP_RELAY && packet.protocol==NetworkProtocol::TCP)){
-					srcEndpointID=e.id;
-					break;
-				}
-			}
+	int64_t srcEndpointID=FindSourceEndpoint(packet);
+
+	if(!srcEndpointID && !packet.address.isIPv6 && packet.protocol==NetworkProtocol::UDP){
+		Endpoint* p2p=FindEndpointByType(Endpoint::Type::UDP_P2P_INET);
+		if(p2p && p2p->rtts[0]==0.0 && p2p->address.PrefixMatches(24, packet.address)){
+			LOGD("Packet source matches p2p endpoint partially: %s:%u", packet.address.ToString().c_str(), packet.port);
+			srcEndpointID=p2p->id;
 		}
 	}
 
@@ -1924,6 +2043,7 @@ void VoIPController::ProcessIncomingPacket(NetworkPacket &packet, Endpoint& srcE
 				if(endpoints.find(lanID)!=endpoints.end()){
 					MutexGuard m(endpointsMutex);
 					endpoints.erase(lanID);
+					RebuildEndpointIndex();
 				}
 
 				unsigned char peerTag[16];
@@ -1933,6 +2053,7 @@ void VoIPController::ProcessIncomingPacket(NetworkPacket &packet, Endpoint& srcE
 					{
     					MutexGuard m(endpointsMutex);
 						endpoints[p2pID]=p2p;
+						RebuildEndpointIndex();
 					}
 					if(myAddr==peerAddr){
 						LOGW("Detected LAN");
@@ -2008,11 +2129,13 @@ void VoIPController::ProcessIncomingPacket(NetworkPacket &packet, Endpoint& srcE
 		}
 		in.ReadBytes(msgKey, 16);
 
-		unsigned char decrypted[1500];
+		// with room in front for the key that's hashed together with the packet
+		unsigned char decryptedBuffer[32+1500];
+		unsigned char* decrypted=decryptedBuffer+32;
 		unsigned char aesKey[32], aesIv[32];
 		KDF2(msgKey, isOutgoing ? 8 : 0, aesKey, aesIv);
 		size_t decryptedLen=in.Remaining();
-		if(decryptedLen>sizeof(decrypted))
+		if(decryptedLen>sizeof(decryptedBuffer)-32)
 			return;
 		if(decryptedLen%16!=0){
 			LOGW("wrong decrypted length");
@@ -2025,12 +2148,8 @@ void VoIPController::ProcessIncomingPacket(NetworkPacket &packet, Endpoint& srcE
 		//LOGD("received packet length: %d", in.ReadInt32());
 		size_t sizeSize=shortFormat ? 0 : 4;
 
-		BufferOutputStream buf(decryptedLen+32);
-		size_t x=isOutgoing ? 8 : 0;
-		buf.WriteBytes(encryptionKey+88+x, 32);
-		buf.WriteBytes(decrypted+sizeSize, decryptedLen-sizeSize);
 		unsigned char msgKeyLarge[32];
-		crypto.sha256(buf.GetBuffer(), buf.GetLength(), msgKeyLarge);
+		MsgKeyHash(isOutgoing ? 8 : 0, decrypted+sizeSize, decryptedLen-sizeSize, msgKeyLarge);
 
 		if(memcmp(msgKey, msgKeyLarge+8, 16)!=0){
 			LOGW("Received packet has wrong hash");
@@ -2067,6 +2186,7 @@ void VoIPController::ProcessIncomingPacket(NetworkPacket &packet, Endpoint& srcE
 				LOGI("Incoming packet was decrypted successfully, changing P2P endpoint to %s:%u", packet.address.ToString().c_str(), packet.port);
 				srcEndpoint.address=packet.address;
 				srcEndpoint.port=packet.port;
+				RebuildEndpointIndex();
 			}
 		}
 	}
@@ -2151,14 +2271,11 @@ simpleAudioBlock random_id:long random_bytes:string raw_data:string = DecryptedA
 	}
 	packetsReceived++;
 
-	if(seqgt(pseq, lastRemoteSeq-MAX_RECENT_PACKETS)){
-		if(find(recentIncomingPackets.begin(), recentIncomingPackets.end(), pseq)!=recentIncomingPackets.end()){
+	if(!recentIncomingSeqs.IsTooOld(pseq)){
+		if(!recentIncomingSeqs.Add(pseq)){
 			LOGW("Received duplicated packet for seq %u", pseq);
 			return;
 		}
-		recentIncomingPackets.push_back(pseq);
-		while(recentIncomingPackets.size()>MAX_RECENT_PACKETS)
-			recentIncomingPackets.erase(recentIncomingPackets.begin());
 		if(seqgt(pseq, lastRemoteSeq))
 			lastRemoteSeq=pseq;
 	}else{
@@ -2191,32 +2308,27 @@ simpleAudioBlock random_id:long random_bytes:string raw_data:string = DecryptedA
 			}, 1.0);
 			LOGI("resuming sending");
 		}
-		vector<uint32_t> peerAcks;
 		lastRemoteAckSeq=ackId;
 		conctl->PacketAcknowledged(ackId);
-		peerAcks.push_back(ackId);
-		for(unsigned int i=0;i<32;i++){
-			if((acks >> (31-i)) & 1){
-				peerAcks.push_back(ackId-(i+1));
-			}
-		}
-
-		for(RecentOutgoingPacket& opkt:recentOutgoingPackets){
-			if(opkt.ackTime!=0.0)
+		// bit 0 of the mask is ackId-32 and bit 31 is ackId-1, ackId itself becomes bit 32, so they're handled oldest first
+		uint64_t ackedSeqs=(uint64_t)acks | (1ULL << 32);
+		for(unsigned int bit=0;bit<=32;bit++){
+			if(!((ackedSeqs >> bit) & 1))
 				continue;
-			if(find(peerAcks.begin(), peerAcks.end(), opkt.seq)!=peerAcks.end()){
-				opkt.ackTime=GetCurrentTime();
-				if(opkt.lost){
-					LOGW("acknowledged lost packet %u", opkt.seq);
-					sendLosses--;
-				}
-				if(opkt.sender && !opkt.lost){ // don't report lost packets as acknowledged to PacketSenders
-					opkt.sender->PacketAcknowledged(opkt.seq, opkt.sendTime, recvTS/1000.0f, opkt.type, opkt.size);
-				}
-
-				// TODO move this to a PacketSender
-				conctl->PacketAcknowledged(opkt.seq);
+			RecentOutgoingPacket* opkt=recentOutgoingPackets.Get(ackId-32+bit);
+			if(!opkt || opkt->ackTime!=0.0)
+				continue;
+			opkt->ackTime=GetCurrentTime();
+			if(opkt->lost){
+				LOGW("acknowledged lost packet %u", opkt->seq);
+				sendLosses--;
+			}
+			if(opkt->sender && !opkt->lost){ // don't report lost packets as acknowledged to PacketSenders
+				opkt->sender->PacketAcknowledged(opkt->seq, opkt->sendTime, recvTS/1000.0f, opkt->type, opkt->size);
 			}
+
+			// TODO move this to a PacketSender
+			conctl->PacketAcknowledged(opkt->seq);
 		}
 
 		if(peerVersion<6){
@@ -2231,15 +2343,12 @@ simpleAudioBlock random_id:long random_bytes:string raw_data:string = DecryptedA
 					int remoteAcksIndex=lastRemoteAckSeq-qp.seqs[j];
 					//LOGV("remote acks index %u, value %f", remoteAcksIndex, remoteAcksIndex>=0 && remoteAcksIndex<32 ? remoteAcks[remoteAcksIndex] : -1);
 					if(seqgt(lastRemoteAckSeq, qp.seqs[j]) && remoteAcksIndex>=0 && remoteAcksIndex<32){
-						for(RecentOutgoingPacket &opkt:recentOutgoingPackets){
-							if(opkt.seq==qp.seqs[j] && opkt.ackTime>0){
-								LOGD("did ack seq %u, removing", qp.seqs[j]);
-								didAck=true;
-								break;
-							}
-						}
-						if(didAck)
+						RecentOutgoingPacket* opkt=recentOutgoingPackets.Get(qp.seqs[j]);
+						if(opkt && opkt->ackTime>0){
+							LOGD("did ack seq %u, removing", qp.seqs[j]);
+							didAck=true;
 							break;
+						}
 					}
 				}
 				if(didAck){
@@ -2328,6 +2437,7 @@ simpleAudioBlock random_id:long random_bytes:string raw_data:string = DecryptedA
 			if(flags & INIT_FLAG_VIDEO_SEND_SUPPORTED){
 				peerCapabilities|=TGVOIP_PEER_CAP_VIDEO_CAPTURE;
 			}
+			protocolInfo.videoFecCM256Supported=(flags & INIT_FLAG_VIDEO_FEC_CM256_SUPPORTED)==INIT_FLAG_VIDEO_FEC_CM256_SUPPORTED;
 		}
 
 		unsigned int i;
@@ -2557,7 +2667,6 @@ simpleAudioBlock random_id:long random_bytes:string raw_data:string = DecryptedA
 			}else if(stm && stm->type==STREAM_TYPE_VIDEO){
 				if(stm->packetReassembler){
 					uint8_t frameSeq=in.ReadByte();
-					Buffer pdata(sdlen);
 					uint16_t rotation=0;
 					if(fragmentIndex==0){
 						unsigned char _rotation=in.ReadByte() & (unsigned char)VIDEO_ROTATION_MASK;
@@ -2582,8 +2691,7 @@ simpleAudioBlock random_id:long random_bytes:string raw_data:string = DecryptedA
 						//	LOGI("Video rotation: %u", rotation);
 						//}
 					}
-					pdata.CopyFrom(buffer+in.GetOffset(), 0, sdlen);
-					stm->packetReassembler->AddFragment(std::move(pdata), fragmentIndex, fragmentCount, pts, frameSeq, keyframe, rotation);
+					stm->packetReassembler->AddFragment(buffer+in.GetOffset(), sdlen, fragmentIndex, fragmentCount, pts, frameSeq, keyframe, rotation);
 				}
 				//LOGV("Received video fragment %u of %u", fragmentIndex, fragmentCount);
 			}else{
@@ -2649,6 +2757,7 @@ simpleAudioBlock random_id:long random_bytes:string raw_data:string = DecryptedA
 
 		MutexGuard m(endpointsMutex);
 		endpoints[lanID]=lan;
+		RebuildEndpointIndex();
 	}
 	if(type==PKT_NETWORK_CHANGED && _currentEndpoint->type!=Endpoint::Type::UDP_RELAY && _currentEndpoint->type!=Endpoint::Type::TCP_RELAY){
 		currentEndpoint=preferredRelay;
@@ -2794,6 +2903,7 @@ void VoIPController::ProcessExtraData(Buffer &data){
 		Endpoint lan(lanID, peerPort, NetworkAddress::IPv4(peerAddr), NetworkAddress::Empty(), Endpoint::Type::UDP_P2P_LAN, peerTag);
 		MutexGuard m(endpointsMutex);
 		endpoints[lanID]=lan;
+		RebuildEndpointIndex();
 	}else if(type==EXTRA_TYPE_NETWORK_CHANGED){
 		LOGI("Peer network changed");
 		wasNetworkHandover=true;
@@ -2843,6 +2953,7 @@ void VoIPController::ProcessExtraData(Buffer &data){
 		ep.v6address=addr;
 		ep.id=p2pID;
 		endpoints[p2pID]=ep;
+		RebuildEndpointIndex();
 		if(!myIPv6.IsEmpty())
 			currentEndpoint=p2pID;
 	}
@@ -2904,7 +3015,7 @@ bool VoIPController::SendOrEnqueuePacket(PendingOutgoingPacket pkt, bool enqueue
 				endpoint->socket=proxy;
 				endpoint->socket->Connect(endpoint->GetAddress(), endpoint->port);
 			}
-			selectCanceller->CancelSelect();
+			CancelReceiverSelect();
 		}
 		canSend=endpoint->socket && endpoint->socket->IsReadyToSend();
 	}
@@ -2916,11 +3027,13 @@ bool VoIPController::SendOrEnqueuePacket(PendingOutgoingPacket pkt, bool enqueue
 		return false;
 	}
 	if((endpoint->type==Endpoint::Type::TCP_RELAY && useTCP) || (endpoint->type!=Endpoint::Type::TCP_RELAY && useUDP)){
-		//BufferOutputStream p(buf, sizeof(buf));
-		BufferOutputStream p(1500);
-		WritePacketHeader(pkt.seq, &p, pkt.type, (uint32_t)pkt.len, source);
-		p.WriteBytes(pkt.data);
-		SendPacket(p.GetBuffer(), p.GetLength(), *endpoint, pkt);
+		unsigned char headerBuf[1500];
+		BufferOutputStream header(headerBuf, sizeof(headerBuf));
+		WritePacketHeader(pkt.seq, &header, pkt.type, (uint32_t)pkt.len, source);
+		// doesn't copy the data if it was built with room around it, like audio packets are
+		PacketBuffer p=PacketBuffer::FromBuffer(move(pkt.data), header.GetLength()+PACKET_ENCRYPTION_HEADROOM, PACKET_ENCRYPTION_TAILROOM(header.GetLength()+pkt.len));
+		memcpy(p.Prepend(header.GetLength()), headerBuf, header.GetLength());
+		SendPacket(move(p), *endpoint, pkt);
 		if(pkt.type==PKT_STREAM_DATA){
 			unsentStreamPackets--;
 		}
@@ -2928,95 +3041,88 @@ bool VoIPController::SendOrEnqueuePacket(PendingOutgoingPacket pkt, bool enqueue
 	return true;
 }
 
-void VoIPController::SendPacket(unsigned char *data, size_t len, Endpoint& ep, PendingOutgoingPacket& srcPacket){
+void VoIPController::SendPacket(PacketBuffer packet, Endpoint& ep, PendingOutgoingPacket& srcPacket){
 	if(stopping)
 		return;
 	if(ep.type==Endpoint::Type::TCP_RELAY && !useTCP)
 		return;
-	BufferOutputStream out(len+128);
-	if(ep.type==Endpoint::Type::UDP_RELAY || ep.type==Endpoint::Type::TCP_RELAY)
-		out.WriteBytes((unsigned char*)ep.peerTag, 16);
-	else if(peerVersion<9)
-		out.WriteBytes(callID, 16);
+	size_t len=packet.Length();
+	// The length and the padding are added to the packet in place. The encrypted copy is written right after it in the
+	// same allocation, and then the headers go in front of that copy, over the plaintext that isn't needed anymore.
+	PacketBuffer out;
 	if(len>0){
 		if(useMTProto2){
-			BufferOutputStream inner(len+128);
+			bool shortLength=peerVersion>=8 || (!peerVersion && connectionMaxLayer>=92);
+			size_t lengthSize=shortLength ? 2 : 4;
+			size_t padLen=16-(lengthSize+len)%16;
+			if(padLen<16)
+				padLen+=16;
+			packet.EnsureRoom(PACKET_ENCRYPTION_HEADROOM, padLen+lengthSize+len+padLen);
+			BufferOutputStream length(packet.Prepend(lengthSize), lengthSize);
 			size_t sizeSize;
-			if(peerVersion>=8 || (!peerVersion && connectionMaxLayer>=92)){
-				inner.WriteInt16((uint16_t) len);
+			if(shortLength){
+				length.WriteInt16((uint16_t) len);
 				sizeSize=0;
 			}else{
-				inner.WriteInt32((uint32_t) len);
-				out.WriteBytes(keyFingerprint, 8);
+				length.WriteInt32((uint32_t) len);
 				sizeSize=4;
 			}
-			inner.WriteBytes(data, len);
-
-			size_t padLen=16-inner.GetLength()%16;
-			if(padLen<16)
-				padLen+=16;
-			unsigned char padding[32];
-			crypto.rand_bytes((uint8_t *) padding, padLen);
-			inner.WriteBytes(padding, padLen);
-			assert(inner.GetLength()%16==0);
+			crypto.rand_bytes(packet.Append(padLen), padLen);
+			assert(packet.Length()%16==0);
 
 			unsigned char key[32], iv[32], msgKey[16];
-			BufferOutputStream buf(len+32);
 			size_t x=isOutgoing ? 0 : 8;
-			buf.WriteBytes(encryptionKey+88+x, 32);
-			buf.WriteBytes(inner.GetBuffer()+sizeSize, inner.GetLength()-sizeSize);
 			unsigned char msgKeyLarge[32];
-			crypto.sha256(buf.GetBuffer(), buf.GetLength(), msgKeyLarge);
+			MsgKeyHash(x, packet.Data()+sizeSize, packet.Length()-sizeSize, msgKeyLarge);
 			memcpy(msgKey, msgKeyLarge+8, 16);
 			KDF2(msgKey, isOutgoing ? 0 : 8, key, iv);
-			out.WriteBytes(msgKey, 16);
 			//LOGV("<- MSG KEY: %08x %08x %08x %08x, hashed %u", *reinterpret_cast<int32_t*>(msgKey), *reinterpret_cast<int32_t*>(msgKey+4), *reinterpret_cast<int32_t*>(msgKey+8), *reinterpret_cast<int32_t*>(msgKey+12), inner.GetLength()-4);
 
-			unsigned char aesOut[MSC_STACK_FALLBACK(inner.GetLength(), 1500)];
-			crypto.aes_ige_encrypt(inner.GetBuffer(), aesOut, inner.GetLength(), key, iv);
-			out.WriteBytes(aesOut, inner.GetLength());
+			out=packet.Tail();
+			crypto.aes_ige_encrypt(packet.Data(), out.Append(packet.Length()), packet.Length(), key, iv);
+			memcpy(out.Prepend(16), msgKey, 16);
+			if(!shortLength)
+				memcpy(out.Prepend(8), keyFingerprint, 8);
 		}else{
-			BufferOutputStream inner(len+128);
-			inner.WriteInt32((int32_t)len);
-			inner.WriteBytes(data, len);
-			if(inner.GetLength()%16!=0){
-				size_t padLen=16-inner.GetLength()%16;
-				unsigned char padding[16];
-				crypto.rand_bytes((uint8_t *) padding, padLen);
-				inner.WriteBytes(padding, padLen);
-			}
-			assert(inner.GetLength()%16==0);
+			size_t padLen=(16-(4+len)%16)%16;
+			packet.EnsureRoom(PACKET_ENCRYPTION_HEADROOM, padLen+4+len+padLen);
+			BufferOutputStream length(packet.Prepend(4), 4);
+			length.WriteInt32((int32_t)len);
+			if(padLen)
+				crypto.rand_bytes(packet.Append(padLen), padLen);
+			assert(packet.Length()%16==0);
 			unsigned char key[32], iv[32], msgHash[SHA1_LENGTH];
-			crypto.sha1((uint8_t *) inner.GetBuffer(), len+4, msgHash);
-			out.WriteBytes(keyFingerprint, 8);
-			out.WriteBytes((msgHash+(SHA1_LENGTH-16)), 16);
+			crypto.sha1(packet.Data(), len+4, msgHash);
 			KDF(msgHash+(SHA1_LENGTH-16), isOutgoing ? 0 : 8, key, iv);
-			unsigned char aesOut[MSC_STACK_FALLBACK(inner.GetLength(), 1500)];
-			crypto.aes_ige_encrypt(inner.GetBuffer(), aesOut, inner.GetLength(), key, iv);
-			out.WriteBytes(aesOut, inner.GetLength());
+			out=packet.Tail();
+			crypto.aes_ige_encrypt(packet.Data(), out.Append(packet.Length()), packet.Length(), key, iv);
+			memcpy(out.Prepend(16), msgHash+(SHA1_LENGTH-16), 16);
+			memcpy(out.Prepend(8), keyFingerprint, 8);
 		}
+	}else{
+		out=move(packet);
+		out.EnsureRoom(16, 0);
 	}
-	//LOGV("Sending %d bytes to %s:%d", out.GetLength(), ep.address.ToString().c_str(), ep.port);
+	if(ep.type==Endpoint::Type::UDP_RELAY || ep.type==Endpoint::Type::TCP_RELAY)
+		memcpy(out.Prepend(16), ep.peerTag, 16);
+	else if(peerVersion<9)
+		memcpy(out.Prepend(16), callID, 16);
+	//LOGV("Sending %d bytes to %s:%d", out.Length(), ep.address.ToString().c_str(), ep.port);
 #ifdef LOG_PACKETS
-	LOGV("Sending: to=%s:%u, seq=%u, length=%u, type=%s", ep.GetAddress().ToString().c_str(), ep.port, srcPacket.seq, (unsigned int)out.GetLength(), GetPacketTypeString(srcPacket.type).c_str());
+	LOGV("Sending: to=%s:%u, seq=%u, length=%u, type=%s", ep.GetAddress().ToString().c_str(), ep.port, srcPacket.seq, (unsigned int)out.Length(), GetPacketTypeString(srcPacket.type).c_str());
 #endif
 
-
-	/*ActuallySendPacket(NetworkPacket{
-			Buffer(std::move(out)),
-			ep.GetAddress(),
-			ep.port,
-			ep.type==Endpoint::Type::TCP_RELAY ? NetworkProtocol::TCP : NetworkProtocol::UDP
-		}, ep);*/
 	rawSendQueue.Put(RawPendingOutgoingPacket{
 			NetworkPacket{
-					Buffer(std::move(out)),
+					out.ToBuffer(),
 					ep.GetAddress(),
 					ep.port,
 					ep.type==Endpoint::Type::TCP_RELAY ? NetworkProtocol::TCP : NetworkProtocol::UDP
 			},
 			ep.type==Endpoint::Type::TCP_RELAY ? ep.socket : nullptr
 	});
+	if(engine)
+		engine->ScheduleSend(this);
 }
 
 void VoIPController::ActuallySendPacket(NetworkPacket pkt, Endpoint& ep){
@@ -3117,6 +3223,7 @@ void VoIPController::AddIPv6Relays(){
 				LOGD("Adding IPv6-only endpoint [%s]:%u", e.v6address.ToString().c_str(), e.port);
 			}
 		}
+		RebuildEndpointIndex();
 	}
 }
 
@@ -3155,6 +3262,7 @@ void VoIPController::AddTCPRelays(){
 		for(Endpoint& e:relays){
 			endpoints[e.id]=move(e);
 		}
+		RebuildEndpointIndex();
 		didAddTcpRelays=true;
 	}
 }
@@ -3170,6 +3278,9 @@ static void initMachTimestart() {
 #endif
 
 double VoIPController::GetCurrentTime(){
+	Clock* clock=Clock::GetCurrent();
+	if(clock)
+		return clock->GetTime();
 #if defined(__linux__)
 	struct timespec ts;
 	clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -3229,24 +3340,28 @@ void VoIPController::KDF(unsigned char* msgKey, size_t x, unsigned char* aesKey,
 
 void VoIPController::KDF2(unsigned char* msgKey, size_t x, unsigned char *aesKey, unsigned char *aesIv){
 	uint8_t sA[32], sB[32];
-	BufferOutputStream buf(128);
-	buf.WriteBytes(msgKey, 16);
-	buf.WriteBytes(encryptionKey+x, 36);
-	crypto.sha256(buf.GetBuffer(), buf.GetLength(), sA);
-	buf.Reset();
-	buf.WriteBytes(encryptionKey+40+x, 36);
-	buf.WriteBytes(msgKey, 16);
-	crypto.sha256(buf.GetBuffer(), buf.GetLength(), sB);
-	buf.Reset();
-	buf.WriteBytes(sA, 8);
-	buf.WriteBytes(sB+8, 16);
-	buf.WriteBytes(sA+24, 8);
-	memcpy(aesKey, buf.GetBuffer(), 32);
-	buf.Reset();
-	buf.WriteBytes(sB, 8);
-	buf.WriteBytes(sA+8, 16);
-	buf.WriteBytes(sB+24, 8);
-	memcpy(aesIv, buf.GetBuffer(), 32);
+	uint8_t buf[16+36];
+	memcpy(buf, msgKey, 16);
+	memcpy(buf+16, encryptionKey+x, 36);
+	crypto.sha256(buf, sizeof(buf), sA);
+	memcpy(buf, encryptionKey+40+x, 36);
+	memcpy(buf+36, msgKey, 16);
+	crypto.sha256(buf, sizeof(buf), sB);
+	memcpy(aesKey, sA, 8);
+	memcpy(aesKey+8, sB+8, 16);
+	memcpy(aesKey+24, sA+24, 8);
+	memcpy(aesIv, sB, 8);
+	memcpy(aesIv+8, sA+8, 16);
+	memcpy(aesIv+24, sB+24, 8);
+}
+
+void VoIPController::MsgKeyHash(size_t x, unsigned char* data, size_t length, unsigned char* output){
+	unsigned char* hashed=data-32;
+	unsigned char overwritten[32];
+	memcpy(overwritten, hashed, 32);
+	memcpy(hashed, encryptionKey+88+x, 32);
+	crypto.sha256(hashed, 32+length, output);
+	memcpy(hashed, overwritten, 32);
 }
 
 
@@ -3268,13 +3383,67 @@ void VoIPController::SendPublicEndpointsRequest(const Endpoint& relay){
 }
 
 Endpoint& VoIPController::GetEndpointByType(int type){
-	if(type==Endpoint::Type::UDP_RELAY && preferredRelay)
-		return endpoints.at(preferredRelay);
+	Endpoint* e=FindEndpointByType(type);
+	if(!e)
+		throw out_of_range("no endpoint");
+	return *e;
+}
+
+Endpoint* VoIPController::FindEndpointByType(int type){
+	if(type==Endpoint::Type::UDP_RELAY && preferredRelay){
+		map<int64_t, Endpoint>::iterator e=endpoints.find(preferredRelay);
+		return e!=endpoints.end() ? &e->second : NULL;
+	}
 	for(pair<const int64_t, Endpoint>& e:endpoints){
 		if(e.second.type==type)
-			return e.second;
+			return &e.second;
+	}
+	return NULL;
+}
+
+int64_t VoIPController::FindSourceEndpoint(const NetworkPacket& packet){
+	unordered_map<EndpointAddressKey, int64_t, EndpointAddressKeyHash>::iterator e=endpointsByAddress.find(EndpointAddressKey(packet.address, packet.port, packet.protocol==NetworkProtocol::TCP));
+	return e!=endpointsByAddress.end() ? e->second : 0;
+}
+
+void VoIPController::RebuildEndpointIndex(){
+	endpointsByAddress.clear();
+	// endpoints is ordered by ID, so when several endpoints have the same address the one with the lowest ID gets it
+	for(pair<const int64_t, Endpoint>& _e:endpoints){
+		const Endpoint& e=_e.second;
+		bool tcp=e.type==Endpoint::Type::TCP_RELAY;
+		if(!e.address.isIPv6 && !e.address.IsEmpty())
+			endpointsByAddress.emplace(EndpointAddressKey(e.address, e.port, tcp), _e.first);
+		// IPv6 packets are only attributed to IPv6-only endpoints
+		if(e.IsIPv6Only() && e.v6address.isIPv6)
+			endpointsByAddress.emplace(EndpointAddressKey(e.v6address, e.port, tcp), _e.first);
 	}
-	throw out_of_range("no endpoint");
+}
+
+VoIPController::EndpointAddressKey::EndpointAddressKey(const NetworkAddress& address, uint16_t port, bool tcp){
+	memset(this->address, 0, sizeof(this->address));
+	if(address.isIPv6)
+		memcpy(this->address, address.addr.ipv6, 16);
+	else
+		memcpy(this->address, &address.addr.ipv4, 4);
+	this->port=port;
+	isIPv6=address.isIPv6;
+	this->tcp=tcp;
+}
+
+bool VoIPController::EndpointAddressKey::operator==(const EndpointAddressKey& other) const{
+	return port==other.port && isIPv6==other.isIPv6 && tcp==other.tcp && memcmp(address, other.address, sizeof(address))==0;
+}
+
+size_t VoIPController::EndpointAddressKeyHash::operator()(const EndpointAddressKey& key) const{
+	uint64_t a, b;
+	memcpy(&a, key.address, 8);
+	memcpy(&b, key.address+8, 8);
+	uint64_t h=a*0x9E3779B97F4A7C15ULL;
+	h^=b+0x9E3779B97F4A7C15ULL+(h << 6)+(h >> 2);
+	h^=((uint64_t)key.port << 2) | ((uint64_t)key.isIPv6 << 1) | (uint64_t)key.tcp;
+	h*=0xFF51AFD7ED558CCDULL;
+	return (size_t)(h ^ (h >> 32));
 }
 
 
@@ -3547,7 +3716,7 @@ void VoIPController::EvaluateUdpPingResults(){
 		NetworkSocket* proxySocket=udpSocket;
 		proxySocket->Close();
 		udpSocket=realUdpSocket;
-		selectCanceller->CancelSelect();
+		CancelReceiverSelect();
 		delete proxySocket;
 		proxySupportsUDP=false;
 		ResetUdpAvailability();
@@ -3671,6 +3840,7 @@ void VoIPController::UpdateRTT(){
 }
 
 void VoIPController::UpdateCongestion(){
+	fecController.Update();
 	if(conctl && encoder){
 		uint32_t sendLossCount=conctl->GetSendLossCount();
 		sendLossCountHistory.Add(sendLossCount-prevSendLossCount);
@@ -3699,7 +3869,10 @@ void VoIPController::UpdateCongestion(){
 			}
 		}
 		
-		if(avgSendLossCount>0.08){
+		int adaptiveEcLevel=fecController.GetAudioRedundancy();
+		if(adaptiveEcLevel>=0){
+			extraEcLevel=adaptiveEcLevel;
+		}else if(avgSendLossCount>0.08){
 			extraEcLevel=4;
 		}else if(avgSendLossCount>0.05){
 			extraEcLevel=3;
@@ -3921,22 +4094,40 @@ void VoIPController::TickJitterBufferAndCongestionControl(){
 	double currentTime=GetCurrentTime();
 	double rtt=GetAverageRTT();
 	double packetLossTimeout=std::max(rtt*2.0, 0.1);
-	for(RecentOutgoingPacket& pkt:recentOutgoingPackets){
-		if(pkt.ackTime!=0.0 || pkt.lost)
-			continue;
-		if(currentTime-pkt.sendTime>packetLossTimeout){
-			pkt.lost=true;
-			sendLosses++;
-			LOGW("Outgoing packet lost: seq=%u, type=%s, size=%u", pkt.seq, GetPacketTypeString(pkt.type).c_str(), (unsigned int)pkt.size);
-			if(pkt.sender){
-				pkt.sender->PacketLost(pkt.seq, pkt.type, pkt.size);
-			}else if(pkt.type==PKT_STREAM_DATA){
-				conctl->PacketLost(pkt.seq);
-			}
-		}
+	if(recentOutgoingPackets.IsEmpty())
+		return;
+	// packets are sent in seq order, so the scan can stop at the first one that hasn't timed out yet
+	uint32_t newestSeq=recentOutgoingPackets.GetNewestSeq();
+	while((int32_t)(newestSeq-nextLossCheckSeq)>=0){
+		if(!CheckNextOutgoingPacketForLoss(currentTime, packetLossTimeout, false))
+			break;
 	}
 }
 
+bool VoIPController::CheckNextOutgoingPacketForLoss(double currentTime, double timeout, bool force){
+	RecentOutgoingPacket* pkt=recentOutgoingPackets.Get(nextLossCheckSeq);
+	if(pkt && !pkt->lost && pkt->ackTime==0.0 && !force && currentTime-pkt->sendTime<=timeout)
+		return false;
+	// moved past it first because the senders may send packets from PacketLost and end up here again
+	nextLossCheckSeq++;
+	if(!pkt || pkt->lost)
+		return true;
+	if(pkt->ackTime!=0.0){
+		fecController.PacketReceived();
+		return true;
+	}
+	pkt->lost=true;
+	sendLosses++;
+	fecController.PacketLost();
+	LOGW("Outgoing packet lost: seq=%u, type=%s, size=%u", pkt->seq, GetPacketTypeString(pkt->type).c_str(), (unsigned int)pkt->size);
+	if(pkt->sender){
+		pkt->sender->PacketLost(pkt->seq, pkt->type, pkt->size);
+	}else if(pkt->type==PKT_STREAM_DATA){
+		conctl->PacketLost(pkt->seq);
+	}
+	return true;
+}
+
 #pragma mark - Endpoint
 
 Endpoint::Endpoint(int64_t id, uint16_t port, const IPv4Address& _address, const IPv6Address& _v6address, Type type, unsigned char peerTag[16]) : address(NetworkAddress::IPv4(_address.addr)), v6address(NetworkAddress::IPv6(_v6address.addr)){
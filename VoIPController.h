@@ -34,6 +34,7 @@
 #include "OpusEncoder.h"
 #include "EchoCanceller.h"
 #include "CongestionControl.h"
+#include "FecController.h"
 #include "NetworkSocket.h"
 #include "Buffers.h"
 #include "PacketReassembler.h"
@@ -196,6 +197,8 @@ namespace tgvoip{
 	};
 
 	class PacketSender;
+	class VoIPEngine;
+	class PacketCryptoBenchmark;
 	namespace video{
 		class VideoPacketSender;
 	}
@@ -203,6 +206,8 @@ namespace tgvoip{
 	class VoIPController{
 		friend class VoIPGroupController;
 		friend class PacketSender;
+		friend class VoIPEngine;
+		friend class PacketCryptoBenchmark; // tests/PacketCryptoBenchmark.cpp
 	public:
 		TGVOIP_DISALLOW_COPY_AND_ASSIGN(VoIPController);
 		struct Config{
@@ -259,6 +264,12 @@ namespace tgvoip{
 		 * DO NOT HARDCODE THIS VALUE, it's extremely important for backwards compatibility.
 		 */
 		void SetRemoteEndpoints(std::vector<Endpoint> endpoints, bool allowP2p, int32_t connectionMaxLayer);
+		/**
+		 * Run this call on the shared threads of an engine instead of starting its own network and message threads.
+		 * Must be called before Start(). The engine must outlive the controller.
+		 * @param engine The engine to use, or NULL for dedicated threads (the default)
+		 */
+		void SetEngine(VoIPEngine* engine);
 		/**
 		 * Initialize and start all the internal threads
 		 */
@@ -286,6 +297,9 @@ namespace tgvoip{
 		 * @return
 		 */
 		double GetAverageRTT();
+		/**
+		 * Monotonic time in seconds, from the Clock installed with Clock::SetCurrent() if there is one
+		 */
 		static double GetCurrentTime();
 		/**
 		 * Use this field to store any of your context data associated with this call
@@ -511,6 +525,7 @@ namespace tgvoip{
 			bool videoCaptureSupported;
 			bool videoDisplaySupported;
 			bool callUpgradeSupported;
+			bool videoFecCM256Supported;
 		};
 
 	private:
@@ -527,6 +542,40 @@ namespace tgvoip{
 			PacketSender* sender;
 			bool lost;
 		};
+		/**
+		 * The last SIZE outgoing packets in slots indexed by seq, so looking one up is O(1) and there's nothing to trim:
+		 * a slot is simply overwritten by the packet SIZE seqs later. Slots that were never written have a zero sendTime.
+		 */
+		class RecentOutgoingPacketRing{
+		public:
+			enum{
+				SIZE=512 // must be a power of two
+			};
+			RecentOutgoingPacketRing() : packets(SIZE){}
+			void Add(const RecentOutgoingPacket& pkt){
+				packets[pkt.seq & (SIZE-1)]=pkt;
+				if(empty || (int32_t)(pkt.seq-newestSeq)>0)
+					newestSeq=pkt.seq;
+				empty=false;
+			}
+			RecentOutgoingPacket* Get(uint32_t seq){
+				RecentOutgoingPacket& pkt=packets[seq & (SIZE-1)];
+				if(pkt.sendTime==0.0 || pkt.seq!=seq)
+					return NULL;
+				return &pkt;
+			}
+			bool IsEmpty() const{
+				return empty;
+			}
+			uint32_t GetNewestSeq() const{
+				return newestSeq;
+			}
+
+		private:
+			std::vector<RecentOutgoingPacket> packets;
+			uint32_t newestSeq=0;
+			bool empty=true;
+		};
 		struct QueuedPacket{
 			Buffer data;
 			unsigned char type;
@@ -539,7 +588,7 @@ namespace tgvoip{
 		virtual void ProcessIncomingPacket(NetworkPacket& packet, Endpoint& srcEndpoint);
 		virtual void ProcessExtraData(Buffer& data);
 		virtual void WritePacketHeader(uint32_t seq, BufferOutputStream* s, unsigned char type, uint32_t length, PacketSender* source);
-		virtual void SendPacket(unsigned char* data, size_t len, Endpoint& ep, PendingOutgoingPacket& srcPacket);
+		virtual void SendPacket(PacketBuffer packet, Endpoint& ep, PendingOutgoingPacket& srcPacket);
 		virtual void SendInit();
 		virtual void SendUdpPing(Endpoint& endpoint);
 		virtual void SendRelayPings();
@@ -563,9 +612,61 @@ namespace tgvoip{
 			Buffer data;
 			uint32_t firstContainingSeq;
 		};
-		struct RecentIncomingPacket{
-			uint32_t seq;
-			double recvTime;
+		/**
+		 * Which of the last 128 seqs before and including the highest one have been received, as a bitmap that
+		 * slides along with the highest seq. Bit 127 of hi:lo is the highest seq, bit 126 the one before it, and so on,
+		 * so the ack mask that goes into packet headers is a single shift.
+		 */
+		class ReceivedSeqWindow{
+		public:
+			enum{
+				SIZE=128
+			};
+			bool IsTooOld(uint32_t seq) const{
+				return (int32_t)(last-seq)>=SIZE;
+			}
+			/**
+			 * @return false if seq is already in the window
+			 */
+			bool Add(uint32_t seq){
+				int32_t diff=(int32_t)(seq-last);
+				if(diff>0){
+					Shift((uint32_t)diff);
+					last=seq;
+					hi|=1ULL << 63;
+					return true;
+				}
+				unsigned int pos=(unsigned int)(SIZE-1+diff);
+				uint64_t& word=pos>=64 ? hi : lo;
+				uint64_t bit=1ULL << (pos%64);
+				if(word & bit)
+					return false;
+				word|=bit;
+				return true;
+			}
+			/**
+			 * @return Bit 31 set if last-1 was received, bit 30 for last-2, and so on down to last-32
+			 */
+			uint32_t GetAckMask() const{
+				return (uint32_t)(hi >> 31);
+			}
+
+		private:
+			void Shift(uint32_t count){
+				if(count>=SIZE){
+					hi=lo=0;
+				}else if(count>=64){
+					lo=hi >> (count-64);
+					hi=0;
+				}else{
+					lo=(lo >> count) | (hi << (64-count));
+					hi>>=count;
+				}
+			}
+
+			uint64_t hi=0;
+			uint64_t lo=0;
+			uint32_t last=0;
 		};
 		enum{
 			UDP_UNKNOWN=0,
@@ -588,6 +689,11 @@ namespace tgvoip{
 
 		void RunRecvThread();
 		void RunSendThread();
+		void AddSocketsToPoller(NetworkSocketPoller* poller, std::vector<std::shared_ptr<NetworkSocket>>& tcpSockets);
+		bool HandleSocketErrors(std::vector<NetworkSocket*>& errorSockets);
+		void ReceiveFromSocket(NetworkSocket* socket, std::vector<NetworkPacket>& recvBatch);
+		bool SendRawPackets(RawPendingOutgoingPacket pkt, std::vector<NetworkPacket>& udpBatch);
+		void CancelReceiverSelect();
 		void HandleAudioInput(unsigned char* data, size_t len, unsigned char* secondaryData, size_t secondaryLen);
 		void UpdateAudioBitrateLimit();
 		void SetState(int state);
@@ -596,9 +702,23 @@ namespace tgvoip{
 		void UpdateDataSavingState();
 		void KDF(unsigned char* msgKey, size_t x, unsigned char* aesKey, unsigned char* aesIv);
 		void KDF2(unsigned char* msgKey, size_t x, unsigned char* aesKey, unsigned char* aesIv);
+		/**
+		 * SHA-256 of the 32 bytes of key at encryptionKey+88+x followed by the data, msg_key is the middle 16 bytes of it.
+		 * The key is hashed from the 32 bytes right in front of data, which must be writable; what was there is put back.
+		 */
+		void MsgKeyHash(size_t x, unsigned char* data, size_t length, unsigned char* output);
 		void SendPublicEndpointsRequest();
 		void SendPublicEndpointsRequest(const Endpoint& relay);
 		Endpoint& GetEndpointByType(int type);
+		/**
+		 * Same as GetEndpointByType, but returns NULL instead of throwing when there's no such endpoint
+		 */
+		Endpoint* FindEndpointByType(int type);
+		/**
+		 * @return The ID of the endpoint whose address, port and protocol match the packet's, or 0 if there's none
+		 */
+		int64_t FindSourceEndpoint(const NetworkPacket& packet);
+		void RebuildEndpointIndex();
 		void SendPacketReliably(unsigned char type, unsigned char* data, size_t len, double retryInterval, double timeout);
 		uint32_t GenerateOutSeq();
 		void ActuallySendPacket(NetworkPacket pkt, Endpoint& ep);
@@ -616,16 +736,38 @@ namespace tgvoip{
 		void UpdateQueuedPackets();
 		void SendNopPacket();
 		void TickJitterBufferAndCongestionControl();
+		/**
+		 * Settles the packet at nextLossCheckSeq (acknowledged or lost) and moves the loss check past it
+		 * @param force count it as lost even if it hasn't timed out yet
+		 * @return false if it hasn't timed out yet, the cursor stays where it is then
+		 */
+		bool CheckNextOutgoingPacketForLoss(double currentTime, double timeout, bool force);
 		void ResetUdpAvailability();
 		std::string GetPacketTypeString(unsigned char type);
 		void SetupOutgoingVideoStream();
 		bool WasOutgoingPacketAcknowledged(uint32_t seq);
 		RecentOutgoingPacket* GetRecentOutgoingPacket(uint32_t seq);
-		void NetworkPacketReceived(std::shared_ptr<NetworkPacket> packet);
+		void ProcessReceivedPackets();
+		void NetworkPacketReceived(NetworkPacket& packet);
 		void TrySendQueuedPackets();
 
+		struct EndpointAddressKey{
+			EndpointAddressKey(const NetworkAddress& address, uint16_t port, bool tcp);
+			uint8_t address[16];
+			uint16_t port;
+			bool isIPv6;
+			bool tcp;
+			bool operator==(const EndpointAddressKey& other) const;
+		};
+		struct EndpointAddressKeyHash{
+			size_t operator()(const EndpointAddressKey& key) const;
+		};
+
 		int state;
 		std::map<int64_t, Endpoint> endpoints;
+		// Maps the addresses packets come from to endpoint IDs. Has all of endpoints in it, so it has to be rebuilt
+		// with RebuildEndpointIndex whenever an endpoint is added, removed or has its address changed.
+		std::unordered_map<EndpointAddressKey, int64_t, EndpointAddressKeyHash> endpointsByAddress;
 		int64_t currentEndpoint=0;
 		int64_t preferredRelay=0;
 		int64_t peerPreferredRelay=0;
@@ -634,8 +776,9 @@ namespace tgvoip{
 		uint32_t lastRemoteSeq;
 		uint32_t lastRemoteAckSeq;
 		uint32_t lastSentSeq;
-		std::vector<RecentOutgoingPacket> recentOutgoingPackets;
-		std::vector<uint32_t> recentIncomingPackets;
+		RecentOutgoingPacketRing recentOutgoingPackets;
+		uint32_t nextLossCheckSeq=0; // packets before this one are already acknowledged or lost
+		ReceivedSeqWindow recentIncomingSeqs;
 		HistoricBuffer<uint32_t, 10, double> sendLossCountHistory;
 		uint32_t audioTimestampIn;
 		uint32_t audioTimestampOut;
@@ -649,6 +792,10 @@ namespace tgvoip{
 		bool audioOutStarted;
 		Thread* recvThread;
 		Thread* sendThread;
+		VoIPEngine* engine=NULL;
+		bool useEngineReceiver=false;
+		bool sendBatching;
+		bool engineSendScheduled=false; // protected by the engine's send mutex
 		uint32_t packetsReceived;
 		uint32_t recvLossCount;
 		uint32_t prevSendLossCount;
@@ -678,6 +825,7 @@ namespace tgvoip{
 		Config config;
 		int32_t peerVersion;
 		CongestionControl* conctl;
+		FecController fecController;
 		TrafficStats stats;
 		bool receivedInit;
 		bool receivedInitAck;
@@ -732,12 +880,15 @@ namespace tgvoip{
 		bool wasEstablished=false;
 		bool receivedFirstStreamPacket=false;
 		std::atomic<unsigned int> unsentStreamPackets;
-		HistoricBuffer<unsigned int, 5> unsentStreamPacketsHistory;
+		AggregatingHistoricBuffer<unsigned int, 5> unsentStreamPacketsHistory;
 		bool needReInitUdpProxy=true;
 		bool needRate=false;
 		std::vector<DebugLoggedPacket> debugLoggedPackets;
-		BufferPool<1024, 32> outgoingAudioBufferPool;
 		BlockingQueue<RawPendingOutgoingPacket> rawSendQueue;
+		// Packets received by the recv thread that messageThread hasn't processed yet. Swapped with processingPackets as a whole.
+		std::vector<NetworkPacket> receivedPackets;
+		std::vector<NetworkPacket> processingPackets;
+		Mutex receivedPacketsMutex;
 
 		uint32_t initTimeoutID=MessageThread::INVALID_ID;
 		uint32_t udpPingTimeoutID=MessageThread::INVALID_ID;
@@ -843,7 +994,7 @@ namespace tgvoip{
 		virtual void SendInit();
 		virtual void SendUdpPing(Endpoint& endpoint);
 		virtual void SendRelayPings();
-		virtual void SendPacket(unsigned char* data, size_t len, Endpoint& ep, PendingOutgoingPacket& srcPacket);
+		virtual void SendPacket(PacketBuffer packet, Endpoint& ep, PendingOutgoingPacket& srcPacket);
 		virtual void WritePacketHeader(uint32_t seq, BufferOutputStream* s, unsigned char type, uint32_t length, PacketSender* sender=NULL);
 		virtual void OnAudioOutputReady();
 	private:
@@ -0,0 +1,226 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include "VoIPEngine.h"
+#include "VoIPController.h"
+#include "logging.h"
+
+using namespace tgvoip;
+
+VoIPEngine::VoIPEngine(unsigned int messageThreadCount) : messageThreadPool(messageThreadCount),
+														  recvThread(std::bind(&VoIPEngine::RunRecvThread, this)),
+														  sendThread(std::bind(&VoIPEngine::RunSendThread, this)),
+														  socketUpdateSemaphore(0x7FFFFFFF, 0),
+														  sendDoneSemaphore(0x7FFFFFFF, 0),
+														  sendSemaphore(0x7FFFFFFF, 0){
+	running=true;
+	socketUpdatesRequested=0;
+	socketUpdatesDone=0;
+	selectCanceller=SocketSelectCanceller::Create();
+	recvThread.SetName("VoipEngineRecv");
+	recvThread.Start();
+	sendThread.SetName("VoipEngineSend");
+	sendThread.Start();
+}
+
+VoIPEngine::~VoIPEngine(){
+	running=false;
+	selectCanceller->CancelSelect();
+	sendSemaphore.Release();
+	recvThread.Join();
+	sendThread.Join();
+	delete selectCanceller;
+	if(!controllers.empty())
+		LOGE("VoIPEngine destroyed with %u calls still running", (unsigned int)controllers.size());
+}
+
+void VoIPEngine::AddController(VoIPController* controller){
+	{
+		MutexGuard m(controllersMutex);
+		controllers.insert(controller);
+	}
+	UpdateSockets();
+}
+
+void VoIPEngine::RemoveController(VoIPController* controller){
+	controllersMutex.Lock();
+	controllers.erase(controller);
+	unsigned int update=++socketUpdatesRequested;
+	selectCanceller->CancelSelect();
+	// the poller may still reference this controller's sockets until the set is rebuilt
+	while(running && (int)(socketUpdatesDone-update)<0){
+		socketUpdateWaiters++;
+		controllersMutex.Unlock();
+		socketUpdateSemaphore.Acquire();
+		controllersMutex.Lock();
+	}
+	controllersMutex.Unlock();
+
+	sendMutex.Lock();
+	if(controller->engineSendScheduled){
+		sendQueue.erase(std::find(sendQueue.begin(), sendQueue.end(), controller));
+		controller->engineSendScheduled=false;
+	}
+	// nothing can schedule it again, so this is the last turn it may be in
+	if(currentSendController==controller){
+		sendDoneWaiters++;
+		sendMutex.Unlock();
+		sendDoneSemaphore.Acquire();
+	}else{
+		sendMutex.Unlock();
+	}
+}
+
+void VoIPEngine::UpdateSockets(){
+	socketUpdatesRequested++;
+	selectCanceller->CancelSelect();
+}
+
+void VoIPEngine::ScheduleSend(VoIPController* controller){
+	MutexGuard m(sendMutex);
+	// stopping is set before RemoveController, so nothing can sneak back into the queue after that
+	if(controller->engineSendScheduled || controller->stopping)
+		return;
+	controller->engineSendScheduled=true;
+	sendQueue.push_back(controller);
+	sendSemaphore.Release();
+}
+
+void VoIPEngine::RunRecvThread(){
+	std::unique_ptr<NetworkSocketPoller> poller(NetworkSocketPoller::Create(selectCanceller));
+	std::vector<NetworkSocket*> readSockets;
+	std::vector<NetworkSocket*> errorSockets;
+	std::vector<NetworkSocket*> writeSockets;
+	std::vector<NetworkPacket> recvBatch;
+	recvBatch.reserve(MAX_RECV_BATCH_SIZE);
+	std::vector<std::shared_ptr<NetworkSocket>> tcpSockets;
+	std::unordered_map<NetworkSocket*, VoIPController*> socketOwners;
+	std::vector<NetworkSocket*> controllerErrorSockets;
+	std::vector<VoIPController*> writableControllers;
+	while(running){
+		unsigned int updatesRequested=socketUpdatesRequested;
+		if(updatesRequested!=socketUpdatesDone){
+			poller->RemoveAllSockets();
+			tcpSockets.clear();
+			socketOwners.clear();
+			MutexGuard m(controllersMutex);
+			for(VoIPController* ctl:controllers){
+				size_t firstTcpSocket=tcpSockets.size();
+				ctl->AddSocketsToPoller(poller.get(), tcpSockets);
+				socketOwners[ctl->udpSocket]=ctl;
+				socketOwners[ctl->realUdpSocket]=ctl;
+				for(size_t i=firstTcpSocket;i<tcpSockets.size();i++){
+					socketOwners[&*tcpSockets[i]]=ctl;
+				}
+			}
+			socketUpdatesDone=updatesRequested;
+			// they recheck whether their update is done and wait again if it isn't
+			if(socketUpdateWaiters){
+				socketUpdateSemaphore.Release((int)socketUpdateWaiters);
+				socketUpdateWaiters=0;
+			}
+		}
+
+		if(!poller->Poll(readSockets, writeSockets, errorSockets)){
+			// something changed, the sockets will be updated on the next iteration if needed
+			continue;
+		}
+
+		MutexGuard m(controllersMutex);
+		if(!errorSockets.empty()){
+			// each controller gets its own error sockets, the same way its own receive thread would
+			while(!errorSockets.empty()){
+				VoIPController* ctl=socketOwners[errorSockets[0]];
+				controllerErrorSockets.clear();
+				for(std::vector<NetworkSocket*>::iterator s=errorSockets.begin();s!=errorSockets.end();){
+					if(socketOwners[*s]==ctl){
+						controllerErrorSockets.push_back(*s);
+						s=errorSockets.erase(s);
+					}else{
+						++s;
+					}
+				}
+				if(!ctl || controllers.find(ctl)==controllers.end() || !ctl->runReceiver)
+					continue;
+				if(!ctl->HandleSocketErrors(controllerErrorSockets))
+					controllers.erase(ctl);
+			}
+			socketUpdatesRequested++;
+			continue;
+		}
+
+		for(NetworkSocket* socket:readSockets){
+			std::unordered_map<NetworkSocket*, VoIPController*>::iterator owner=socketOwners.find(socket);
+			if(owner==socketOwners.end() || controllers.find(owner->second)==controllers.end() || !owner->second->runReceiver)
+				continue;
+			owner->second->ReceiveFromSocket(socket, recvBatch);
+		}
+
+		writableControllers.clear();
+		for(NetworkSocket* socket:writeSockets){
+			std::unordered_map<NetworkSocket*, VoIPController*>::iterator owner=socketOwners.find(socket);
+			if(owner==socketOwners.end() || controllers.find(owner->second)==controllers.end())
+				continue;
+			if(std::find(writableControllers.begin(), writableControllers.end(), owner->second)==writableControllers.end())
+				writableControllers.push_back(owner->second);
+		}
+		for(VoIPController* ctl:writableControllers){
+			ctl->messageThread.Post(std::bind(&VoIPController::TrySendQueuedPackets, ctl));
+		}
+	}
+	controllersMutex.Lock();
+	if(socketUpdateWaiters){
+		socketUpdateSemaphore.Release((int)socketUpdateWaiters);
+		socketUpdateWaiters=0;
+	}
+	controllersMutex.Unlock();
+	LOGI("=== engine recv thread exiting ===");
+}
+
+void VoIPEngine::RunSendThread(){
+	std::vector<NetworkPacket> udpBatch;
+	udpBatch.reserve(MAX_SEND_BATCH_SIZE);
+	while(true){
+		sendSemaphore.Acquire();
+		sendMutex.Lock();
+		if(!running){
+			sendMutex.Unlock();
+			break;
+		}
+		// the semaphore may be ahead of the queue if a controller was removed before its turn
+		if(sendQueue.empty()){
+			sendMutex.Unlock();
+			continue;
+		}
+		VoIPController* ctl=sendQueue.front();
+		sendQueue.pop_front();
+		ctl->engineSendScheduled=false;
+		currentSendController=ctl;
+		sendMutex.Unlock();
+
+		// one batch per turn so that a busy call can't hold up the others; anything put into the queue from now on
+		// schedules this controller again
+		if(ctl->rawSendQueue.Size()>0)
+			ctl->SendRawPackets(ctl->rawSendQueue.Get(), udpBatch);
+
+		sendMutex.Lock();
+		currentSendController=NULL;
+		if(sendDoneWaiters){
+			sendDoneSemaphore.Release((int)sendDoneWaiters);
+			sendDoneWaiters=0;
+		}else if(ctl->rawSendQueue.Size()>0 && !ctl->engineSendScheduled && !ctl->stopping){
+			// the rest waits for its next turn at the back of the queue
+			ctl->engineSendScheduled=true;
+			sendQueue.push_back(ctl);
+			sendSemaphore.Release();
+		}
+		sendMutex.Unlock();
+	}
+	LOGI("=== engine send thread exiting ===");
+}
@@ -0,0 +1,76 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_VOIPENGINE_H
+#define LIBTGVOIP_VOIPENGINE_H
+
+#include <atomic>
+#include <deque>
+#include <unordered_set>
+#include "threading.h"
+#include "utils.h"
+#include "MessageThread.h"
+#include "NetworkSocket.h"
+
+namespace tgvoip{
+
+	class VoIPController;
+
+	/**
+	 * Runs many calls on a fixed set of threads, for servers and bots that handle lots of calls at once.
+	 * One thread polls the sockets of all calls, one thread sends their packets, and a pool of threads
+	 * runs their message queues. Pass it to VoIPController::SetEngine() before starting a call.
+	 * Audio encoding, decoding and processing still happen on per-call threads.
+	 */
+	class VoIPEngine{
+	public:
+		TGVOIP_DISALLOW_COPY_AND_ASSIGN(VoIPEngine);
+		/**
+		 * @param messageThreadCount The number of threads that run the message queues of all calls
+		 */
+		VoIPEngine(unsigned int messageThreadCount=2);
+		~VoIPEngine();
+		MessageThreadPool& GetMessageThreadPool(){
+			return messageThreadPool;
+		}
+
+	private:
+		friend class VoIPController;
+		void AddController(VoIPController* controller);
+		void RemoveController(VoIPController* controller);
+		void UpdateSockets();
+		void ScheduleSend(VoIPController* controller);
+		void RunRecvThread();
+		void RunSendThread();
+
+		MessageThreadPool messageThreadPool;
+		Thread recvThread;
+		Thread sendThread;
+		std::atomic<bool> running;
+
+		// controllers whose sockets are polled by recvThread
+		std::unordered_set<VoIPController*> controllers;
+		Mutex controllersMutex;
+		SocketSelectCanceller* selectCanceller;
+		// recvThread rebuilds its socket set whenever these two differ
+		std::atomic<unsigned int> socketUpdatesRequested;
+		std::atomic<unsigned int> socketUpdatesDone;
+		// RemoveController() calls waiting for the socket set to be rebuilt, protected by controllersMutex
+		unsigned int socketUpdateWaiters=0;
+		Semaphore socketUpdateSemaphore;
+
+		// controllers that have something in their rawSendQueue
+		std::deque<VoIPController*> sendQueue;
+		VoIPController* currentSendController=NULL;
+		// RemoveController() calls waiting for currentSendController to finish, protected by sendMutex
+		unsigned int sendDoneWaiters=0;
+		Semaphore sendDoneSemaphore;
+		Mutex sendMutex;
+		Semaphore sendSemaphore;
+	};
+}
+
+#endif //LIBTGVOIP_VOIPENGINE_H
@@ -46,6 +46,7 @@ void VoIPGroupController::SetGroupCallInfo(unsigned char *encryptionKey, unsigne
 	e.type=Endpoint::Type::UDP_RELAY;
 	e.id=FOURCC('G','R','P','R');
 	endpoints[e.id]=e;
+	RebuildEndpointIndex();
 	groupReflector=e;
 	currentEndpoint=e.id;
 
@@ -345,11 +346,13 @@ void VoIPGroupController::ProcessIncomingPacket(NetworkPacket &packet, Endpoint&
 	unsigned char msgKey[16];
 	in.ReadBytes(msgKey, 16);
 
-	unsigned char decrypted[1500];
+	// with room in front for the key that's hashed together with the packet
+	unsigned char decryptedBuffer[32+1500];
+	unsigned char* decrypted=decryptedBuffer+32;
 	unsigned char aesKey[32], aesIv[32];
 	KDF2(msgKey, 0, aesKey, aesIv);
 	size_t decryptedLen=in.Remaining()-16;
-	if(decryptedLen>sizeof(decrypted))
+	if(decryptedLen>sizeof(decryptedBuffer)-32)
 		return;
 	//LOGV("-> MSG KEY: %08x %08x %08x %08x, hashed %u", *reinterpret_cast<int32_t*>(msgKey), *reinterpret_cast<int32_t*>(msgKey+4), *reinterpret_cast<int32_t*>(msgKey+8), *reinterpret_cast<int32_t*>(msgKey+12), decryptedLen-4);
 	uint8_t *decryptOffset = packet.data + in.GetOffset();
@@ -364,12 +367,8 @@ void VoIPGroupController::ProcessIncomingPacket(NetworkPacket &packet, Endpoint&
 	in=BufferInputStream(decrypted, decryptedLen);
 	//LOGD("received packet length: %d", in.ReadInt32());
 
-	BufferOutputStream buf(decryptedLen+32);
-	size_t x=0;
-	buf.WriteBytes(encryptionKey+88+x, 32);
-	buf.WriteBytes(decrypted+4, decryptedLen-4);
 	unsigned char msgKeyLarge[32];
-	crypto.sha256(buf.GetBuffer(), buf.GetLength(), msgKeyLarge);
+	MsgKeyHash(0, decrypted+4, decryptedLen-4, msgKeyLarge);
 
 	if(memcmp(msgKey, msgKeyLarge+8, 16)!=0){
 		LOGW("Received packet from user %d has wrong hash", sender->userID);
@@ -482,7 +481,7 @@ void VoIPGroupController::SetNetworkType(int type){
 		lastUdpPingTime=0;
 		if(proxyProtocol==PROXY_SOCKS5)
 			InitUDPProxy();
-		selectCanceller->CancelSelect();
+		CancelReceiverSelect();
 	}
 }
 
@@ -590,18 +589,22 @@ void VoIPGroupController::WritePacketHeader(uint32_t seq, BufferOutputStream *s,
 	}
 }
 
-void VoIPGroupController::SendPacket(unsigned char *data, size_t len, Endpoint& ep, PendingOutgoingPacket& srcPacket){
+void VoIPGroupController::SendPacket(PacketBuffer packet, Endpoint& ep, PendingOutgoingPacket& srcPacket){
 	if(stopping)
 		return;
 	if(ep.type==Endpoint::Type::TCP_RELAY && !useTCP)
 		return;
+	unsigned char* data=packet.Data();
+	size_t len=packet.Length();
 	BufferOutputStream out(len+128);
 	//LOGV("send group packet %u", len);
 
 	out.WriteBytes(reflectorSelfTag, 16);
 
 	if(len>0){
-		BufferOutputStream inner(len+128);
+		// the 28 bytes in front of the length are where MsgKeyHash puts the key
+		unsigned char innerBuffer[MSC_STACK_FALLBACK(28+len+128, 28+1500+128)];
+		BufferOutputStream inner(innerBuffer+28, sizeof(innerBuffer)-28);
 		inner.WriteInt32((uint32_t)len);
 		inner.WriteBytes(data, len);
 		size_t padLen=16-inner.GetLength()%16;
@@ -614,12 +617,8 @@ void VoIPGroupController::SendPacket(unsigned char *data, size_t len, Endpoint&
 
 		unsigned char key[32], iv[32], msgKey[16];
 		out.WriteBytes(keyFingerprint, 8);
-		BufferOutputStream buf(len+32);
-		size_t x=0;
-		buf.WriteBytes(encryptionKey+88+x, 32);
-		buf.WriteBytes(inner.GetBuffer()+4, inner.GetLength()-4);
 		unsigned char msgKeyLarge[32];
-		crypto.sha256(buf.GetBuffer(), buf.GetLength(), msgKeyLarge);
+		MsgKeyHash(0, inner.GetBuffer()+4, inner.GetLength()-4, msgKeyLarge);
 		memcpy(msgKey, msgKeyLarge+8, 16);
 		KDF2(msgKey, 0, key, iv);
 		out.WriteBytes(msgKey, 16);
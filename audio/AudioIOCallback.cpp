@@ -6,6 +6,7 @@
 
 #include "AudioIOCallback.h"
 #include "../VoIPController.h"
+#include "../Clock.h"
 #include "../logging.h"
 
 using namespace tgvoip;
@@ -67,9 +68,10 @@ void AudioInputCallback::RunThread(){
 		memset(buf, 0, sizeof(buf));
 		dataCallback(buf, 960);
 		InvokeCallback(reinterpret_cast<unsigned char*>(buf), 960*2);
-		double sl=0.02-(VoIPController::GetCurrentTime()-t);
-		if(sl>0)
-			Thread::Sleep(sl);
+		// a simulated clock may need more than one wait to get there
+		double sl;
+		while(running && (sl=t+0.02-VoIPController::GetCurrentTime())>0)
+			Thread::Sleep(Clock::ToRealDuration(sl));
 	}
 }
 
@@ -112,9 +114,10 @@ void AudioOutputCallback::RunThread(){
 		double t=VoIPController::GetCurrentTime();
 		InvokeCallback(reinterpret_cast<unsigned char*>(buf), 960*2);
 		dataCallback(buf, 960);
-		double sl=0.02-(VoIPController::GetCurrentTime()-t);
-		if(sl>0)
-			Thread::Sleep(sl);
+		// a simulated clock may need more than one wait to get there
+		double sl;
+		while(running && (sl=t+0.02-VoIPController::GetCurrentTime())>0)
+			Thread::Sleep(Clock::ToRealDuration(sl));
 	}
 }
 
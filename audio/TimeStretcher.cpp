@@ -0,0 +1,113 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "TimeStretcher.h"
+
+// 400 Hz .. 62.5 Hz at 48 kHz
+#define MIN_PITCH_PERIOD 120
+#define MAX_PITCH_PERIOD 768
+// how many samples are compared to find the pitch period
+#define CORRELATION_LENGTH 480
+// the coarse search runs on the signal decimated by this much
+#define DECIMATION 4
+
+using namespace tgvoip::audio;
+
+static double NormalizedCorrelation(const int16_t* a, const int16_t* b, size_t len, size_t stride){
+	int64_t ab=0, aa=0, bb=0;
+	for(size_t i=0;i<len;i+=stride){
+		ab+=(int32_t)a[i]*b[i];
+		aa+=(int32_t)a[i]*a[i];
+		bb+=(int32_t)b[i]*b[i];
+	}
+	if(aa==0 || bb==0)
+		return 0;
+	return (double)ab/sqrt((double)aa*(double)bb);
+}
+
+size_t TimeStretcher::FindPitchPeriod(const int16_t* in, size_t available, size_t minPeriod, size_t maxPeriod){
+	size_t corrLen=std::min((size_t)CORRELATION_LENGTH, available-maxPeriod);
+
+	// coarse search over every DECIMATION-th lag, comparing every DECIMATION-th sample
+	double scores[MAX_PITCH_PERIOD/DECIMATION+1];
+	double bestScore=-1.0;
+	for(size_t lag=minPeriod;lag<=maxPeriod;lag+=DECIMATION){
+		double score=NormalizedCorrelation(in, in+lag, corrLen, DECIMATION);
+		scores[(lag-minPeriod)/DECIMATION]=score;
+		if(score>bestScore)
+			bestScore=score;
+	}
+	if(bestScore<=0.0) // silence or noise, any period will do
+		return minPeriod;
+	// a multiple of the period matches about as well as the period itself; take the shortest one to keep the steps small
+	size_t count=(maxPeriod-minPeriod)/DECIMATION+1;
+	size_t coarse=minPeriod;
+	for(size_t i=0;i<count;i++){
+		bool isPeak=(i==0 || scores[i]>=scores[i-1]) && (i==count-1 || scores[i]>=scores[i+1]);
+		if(isPeak && scores[i]>=bestScore*0.9){
+			coarse=minPeriod+i*DECIMATION;
+			break;
+		}
+	}
+
+	size_t best=coarse;
+	bestScore=-2.0;
+	for(size_t lag=std::max(minPeriod, coarse-std::min(coarse, (size_t)DECIMATION-1));lag<=std::min(maxPeriod, coarse+DECIMATION-1);lag++){
+		double score=NormalizedCorrelation(in, in+lag, corrLen, 1);
+		if(score>bestScore){
+			bestScore=score;
+			best=lag;
+		}
+	}
+	return best;
+}
+
+size_t TimeStretcher::Stretch(const int16_t* in, size_t length, int16_t* out, ptrdiff_t change){
+	ptrdiff_t maxChange=(ptrdiff_t)(length/2);
+	change=std::max(-maxChange, std::min(maxChange, change));
+	size_t inPos=0, outPos=0;
+	ptrdiff_t done=0;
+	while(done!=change){
+		size_t available=length-inPos;
+		// need two periods to splice them and one period plus the correlation window to search
+		if(available<MIN_PITCH_PERIOD*2 || available<MIN_PITCH_PERIOD+CORRELATION_LENGTH/2)
+			break;
+		size_t maxPeriod=std::min((size_t)MAX_PITCH_PERIOD, std::min(available/2, available-CORRELATION_LENGTH/2));
+		if(maxPeriod<MIN_PITCH_PERIOD)
+			break;
+		size_t period=FindPitchPeriod(in+inPos, available, MIN_PITCH_PERIOD, maxPeriod);
+		ptrdiff_t p=(ptrdiff_t)period;
+		ptrdiff_t remaining=change-done;
+		if(std::abs(remaining)<p/2 || std::abs(done)+p>maxChange)
+			break;
+
+		const int16_t* a=in+inPos;
+		const int16_t* b=in+inPos+period;
+		if(remaining<0){
+			// remove one period: fade from the first period into the second one
+			for(size_t i=0;i<period;i++){
+				out[outPos+i]=(int16_t)(a[i]+((int32_t)(b[i]-a[i])*(int32_t)i)/(int32_t)period);
+			}
+			outPos+=period;
+			inPos+=period*2;
+			done-=p;
+		}else{
+			// repeat one period: play it, then fade from the second period back into the first one
+			memcpy(out+outPos, a, period*2);
+			for(size_t i=0;i<period;i++){
+				out[outPos+period+i]=(int16_t)(b[i]+((int32_t)(a[i]-b[i])*(int32_t)i)/(int32_t)period);
+			}
+			outPos+=period*2;
+			inPos+=period;
+			done+=p;
+		}
+	}
+	memcpy(out+outPos, in+inPos, (length-inPos)*2);
+	return outPos+(length-inPos);
+}
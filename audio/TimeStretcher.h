@@ -0,0 +1,38 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_TIMESTRETCHER_H
+#define LIBTGVOIP_TIMESTRETCHER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace tgvoip{ namespace audio{
+	/**
+	 * Pitch-synchronous WSOLA time-scale modification of 48 kHz mono audio.
+	 * Changes the duration of a frame by removing or repeating whole pitch periods, each one spliced in with a crossfade
+	 * at the offset where the waveform best matches itself, so the pitch is kept and there are no audible clicks.
+	 * The first and the last samples of the frame are kept as is, so consecutive frames still join seamlessly.
+	 */
+	class TimeStretcher{
+	public:
+		/**
+		 * Stretches or shrinks one frame.
+		 * @param in the frame
+		 * @param length number of samples in the frame
+		 * @param out where to write the result, must have space for length*3/2 samples
+		 * @param change desired change of the frame length in samples, positive to make it longer.
+		 * It is only applied in whole pitch periods and at most by half of the frame, so the caller should carry the remainder over to the next frame.
+		 * @return the number of samples written to out
+		 */
+		static size_t Stretch(const int16_t* in, size_t length, int16_t* out, ptrdiff_t change);
+	private:
+		static size_t FindPitchPeriod(const int16_t* in, size_t available, size_t minPeriod, size_t maxPeriod);
+	};
+}}
+
+#endif //LIBTGVOIP_TIMESTRETCHER_H
@@ -0,0 +1,417 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include "AES.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define TGVOIP_AES_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TGVOIP_TARGET_AES
+#else
+#include <cpuid.h>
+#define TGVOIP_TARGET_AES __attribute__((target("aes,sse2")))
+#endif
+#elif defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)
+#define TGVOIP_AES_ARMV8
+#include <arm_neon.h>
+#define TGVOIP_TARGET_AES
+#else
+#define TGVOIP_TARGET_AES
+#endif
+
+using namespace tgvoip;
+
+namespace{
+
+#pragma mark - Block primitives
+
+// The lanes are spelled out instead of looped over, otherwise GCC keeps the blocks in memory at -O2
+#define FOR_EACH_LANE(body) \
+	{const int i=0; body;} \
+	if(N>1){const int i=1; body;} \
+	if(N>2){const int i=2; body;} \
+	if(N>3){const int i=3; body;}
+
+#if defined(TGVOIP_AES_X86)
+
+typedef __m128i Block;
+
+TGVOIP_TARGET_AES inline Block LoadBlock(const uint8_t* p){
+	return _mm_loadu_si128((const __m128i*)p);
+}
+
+TGVOIP_TARGET_AES inline void StoreBlock(uint8_t* p, Block b){
+	_mm_storeu_si128((__m128i*)p, b);
+}
+
+TGVOIP_TARGET_AES inline Block XorBlocks(Block a, Block b){
+	return _mm_xor_si128(a, b);
+}
+
+// N independent blocks, each with its own round keys, so the latency of one aesenc is hidden behind the others
+template<int N> TGVOIP_TARGET_AES inline void EncryptBlocks(const uint8_t* const* roundKeys, Block* blocks){
+	FOR_EACH_LANE(blocks[i]=_mm_xor_si128(blocks[i], LoadBlock(roundKeys[i])));
+	for(int r=1;r<AES256_ROUNDS;r++){
+		FOR_EACH_LANE(blocks[i]=_mm_aesenc_si128(blocks[i], LoadBlock(roundKeys[i]+r*AES_BLOCK_SIZE)));
+	}
+	FOR_EACH_LANE(blocks[i]=_mm_aesenclast_si128(blocks[i], LoadBlock(roundKeys[i]+AES256_ROUNDS*AES_BLOCK_SIZE)));
+}
+
+template<int N> TGVOIP_TARGET_AES inline void DecryptBlocks(const uint8_t* const* roundKeys, Block* blocks){
+	FOR_EACH_LANE(blocks[i]=_mm_xor_si128(blocks[i], LoadBlock(roundKeys[i])));
+	for(int r=1;r<AES256_ROUNDS;r++){
+		FOR_EACH_LANE(blocks[i]=_mm_aesdec_si128(blocks[i], LoadBlock(roundKeys[i]+r*AES_BLOCK_SIZE)));
+	}
+	FOR_EACH_LANE(blocks[i]=_mm_aesdeclast_si128(blocks[i], LoadBlock(roundKeys[i]+AES256_ROUNDS*AES_BLOCK_SIZE)));
+}
+
+TGVOIP_TARGET_AES inline Block ExpandKeyStep1(Block prev, Block assist){
+	assist=_mm_shuffle_epi32(assist, 0xFF);
+	Block t=_mm_slli_si128(prev, 4);
+	prev=_mm_xor_si128(prev, t);
+	t=_mm_slli_si128(t, 4);
+	prev=_mm_xor_si128(prev, t);
+	t=_mm_slli_si128(t, 4);
+	prev=_mm_xor_si128(prev, t);
+	return _mm_xor_si128(prev, assist);
+}
+
+TGVOIP_TARGET_AES inline Block ExpandKeyStep2(Block even, Block odd){
+	Block assist=_mm_shuffle_epi32(_mm_aeskeygenassist_si128(even, 0x00), 0xAA);
+	Block t=_mm_slli_si128(odd, 4);
+	odd=_mm_xor_si128(odd, t);
+	t=_mm_slli_si128(t, 4);
+	odd=_mm_xor_si128(odd, t);
+	t=_mm_slli_si128(t, 4);
+	odd=_mm_xor_si128(odd, t);
+	return _mm_xor_si128(odd, assist);
+}
+
+// the round constant has to be an immediate
+#define EXPAND_KEY_ROUND(i, rcon) \
+	even=ExpandKeyStep1(even, _mm_aeskeygenassist_si128(odd, rcon)); \
+	StoreBlock(roundKeys+(i)*AES_BLOCK_SIZE, even); \
+	if((i)<AES256_ROUNDS){ \
+		odd=ExpandKeyStep2(even, odd); \
+		StoreBlock(roundKeys+((i)+1)*AES_BLOCK_SIZE, odd); \
+	}
+
+TGVOIP_TARGET_AES void ExpandEncryptKey(const uint8_t* key, uint8_t* roundKeys){
+	Block even=LoadBlock(key);
+	Block odd=LoadBlock(key+16);
+	StoreBlock(roundKeys, even);
+	StoreBlock(roundKeys+AES_BLOCK_SIZE, odd);
+	EXPAND_KEY_ROUND(2, 0x01);
+	EXPAND_KEY_ROUND(4, 0x02);
+	EXPAND_KEY_ROUND(6, 0x04);
+	EXPAND_KEY_ROUND(8, 0x08);
+	EXPAND_KEY_ROUND(10, 0x10);
+	EXPAND_KEY_ROUND(12, 0x20);
+	EXPAND_KEY_ROUND(14, 0x40);
+}
+
+#undef EXPAND_KEY_ROUND
+
+TGVOIP_TARGET_AES inline Block InvMixColumns(Block b){
+	return _mm_aesimc_si128(b);
+}
+
+bool DetectHardwareSupport(){
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 25))!=0 && (info[3] & (1 << 26))!=0;
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (ecx & bit_AES)!=0 && (edx & bit_SSE2)!=0;
+#endif
+}
+
+#elif defined(TGVOIP_AES_ARMV8)
+
+typedef uint8x16_t Block;
+
+inline Block LoadBlock(const uint8_t* p){
+	return vld1q_u8(p);
+}
+
+inline void StoreBlock(uint8_t* p, Block b){
+	vst1q_u8(p, b);
+}
+
+inline Block XorBlocks(Block a, Block b){
+	return veorq_u8(a, b);
+}
+
+// AESE and AESD add the round key first, so the last two keys are used by the final step
+template<int N> inline void EncryptBlocks(const uint8_t* const* roundKeys, Block* blocks){
+	for(int r=0;r<AES256_ROUNDS-1;r++){
+		FOR_EACH_LANE(blocks[i]=vaesmcq_u8(vaeseq_u8(blocks[i], LoadBlock(roundKeys[i]+r*AES_BLOCK_SIZE))));
+	}
+	FOR_EACH_LANE(blocks[i]=veorq_u8(vaeseq_u8(blocks[i], LoadBlock(roundKeys[i]+(AES256_ROUNDS-1)*AES_BLOCK_SIZE)), LoadBlock(roundKeys[i]+AES256_ROUNDS*AES_BLOCK_SIZE)));
+}
+
+template<int N> inline void DecryptBlocks(const uint8_t* const* roundKeys, Block* blocks){
+	for(int r=0;r<AES256_ROUNDS-1;r++){
+		FOR_EACH_LANE(blocks[i]=vaesimcq_u8(vaesdq_u8(blocks[i], LoadBlock(roundKeys[i]+r*AES_BLOCK_SIZE))));
+	}
+	FOR_EACH_LANE(blocks[i]=veorq_u8(vaesdq_u8(blocks[i], LoadBlock(roundKeys[i]+(AES256_ROUNDS-1)*AES_BLOCK_SIZE)), LoadBlock(roundKeys[i]+AES256_ROUNDS*AES_BLOCK_SIZE)));
+}
+
+// SubWord without a table indexed by key bytes: AESE with a zero round key is SubBytes and ShiftRows, and with
+// the word in all four columns ShiftRows doesn't move anything
+inline uint32_t SubWord(uint32_t w){
+	Block b=vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(w)), vdupq_n_u8(0));
+	return vgetq_lane_u32(vreinterpretq_u32_u8(b), 0);
+}
+
+// there's no key expansion instruction on ARM, but it's only 13 SubWords; the words are little-endian
+void ExpandEncryptKey(const uint8_t* key, uint8_t* roundKeys){
+	uint32_t w[(AES256_ROUNDS+1)*4];
+	memcpy(w, key, 32);
+	uint32_t rcon=0x01;
+	for(int i=8;i<(AES256_ROUNDS+1)*4;i++){
+		uint32_t t=w[i-1];
+		if(i%8==0){
+			t=SubWord((t >> 8) | (t << 24)) ^ rcon; // RotWord first
+			rcon<<=1;
+		}else if(i%8==4){
+			t=SubWord(t);
+		}
+		w[i]=w[i-8] ^ t;
+	}
+	memcpy(roundKeys, w, sizeof(w));
+}
+
+inline Block InvMixColumns(Block b){
+	return vaesimcq_u8(b);
+}
+
+bool DetectHardwareSupport(){
+	return true;
+}
+
+#else
+
+// Nothing calls these because IsHardwareAccelerated() is false, they're only here so that the modes below compile.
+struct Block{
+	uint8_t bytes[AES_BLOCK_SIZE];
+};
+
+inline Block LoadBlock(const uint8_t* p){
+	Block b;
+	memcpy(b.bytes, p, AES_BLOCK_SIZE);
+	return b;
+}
+
+inline void StoreBlock(uint8_t* p, Block b){
+	memcpy(p, b.bytes, AES_BLOCK_SIZE);
+}
+
+inline Block XorBlocks(Block a, Block b){
+	for(int i=0;i<AES_BLOCK_SIZE;i++)
+		a.bytes[i]^=b.bytes[i];
+	return a;
+}
+
+template<int N> inline void EncryptBlocks(const uint8_t* const* roundKeys, Block* blocks){
+	abort();
+}
+
+template<int N> inline void DecryptBlocks(const uint8_t* const* roundKeys, Block* blocks){
+	abort();
+}
+
+void ExpandEncryptKey(const uint8_t* key, uint8_t* roundKeys){
+	abort();
+}
+
+inline Block InvMixColumns(Block b){
+	abort();
+}
+
+bool DetectHardwareSupport(){
+	return false;
+}
+
+#endif
+
+#undef FOR_EACH_LANE
+
+#pragma mark - Modes
+
+TGVOIP_TARGET_AES void DeriveDecryptKeys(const uint8_t* encrypt, uint8_t* decrypt){
+	StoreBlock(decrypt, LoadBlock(encrypt+AES256_ROUNDS*AES_BLOCK_SIZE));
+	for(int i=1;i<AES256_ROUNDS;i++){
+		StoreBlock(decrypt+i*AES_BLOCK_SIZE, InvMixColumns(LoadBlock(encrypt+(AES256_ROUNDS-i)*AES_BLOCK_SIZE)));
+	}
+	StoreBlock(decrypt+AES256_ROUNDS*AES_BLOCK_SIZE, LoadBlock(encrypt));
+}
+
+TGVOIP_TARGET_AES void IGEEncryptWithRoundKeys(const uint8_t* roundKeys, const uint8_t* in, uint8_t* out, size_t length, uint8_t* iv){
+	Block prevCipher=LoadBlock(iv);
+	Block prevPlain=LoadBlock(iv+AES_BLOCK_SIZE);
+	for(size_t offset=0;offset+AES_BLOCK_SIZE<=length;offset+=AES_BLOCK_SIZE){
+		Block plain=LoadBlock(in+offset);
+		Block block=XorBlocks(plain, prevCipher);
+		EncryptBlocks<1>(&roundKeys, &block);
+		prevCipher=XorBlocks(block, prevPlain);
+		prevPlain=plain;
+		StoreBlock(out+offset, prevCipher);
+	}
+	StoreBlock(iv, prevCipher);
+	StoreBlock(iv+AES_BLOCK_SIZE, prevPlain);
+}
+
+TGVOIP_TARGET_AES void IGEDecryptWithRoundKeys(const uint8_t* roundKeys, const uint8_t* in, uint8_t* out, size_t length, uint8_t* iv){
+	Block prevCipher=LoadBlock(iv);
+	Block prevPlain=LoadBlock(iv+AES_BLOCK_SIZE);
+	for(size_t offset=0;offset+AES_BLOCK_SIZE<=length;offset+=AES_BLOCK_SIZE){
+		Block cipher=LoadBlock(in+offset);
+		Block block=XorBlocks(cipher, prevPlain);
+		DecryptBlocks<1>(&roundKeys, &block);
+		prevPlain=XorBlocks(block, prevCipher);
+		prevCipher=cipher;
+		StoreBlock(out+offset, prevPlain);
+	}
+	StoreBlock(iv, prevCipher);
+	StoreBlock(iv+AES_BLOCK_SIZE, prevPlain);
+}
+
+inline void IncrementCounter(uint8_t* counter){
+	for(int i=AES_BLOCK_SIZE-1;i>=0;i--){
+		if(++counter[i]!=0)
+			break;
+	}
+}
+
+}
+
+bool AES::IsHardwareAccelerated(){
+	static const bool supported=DetectHardwareSupport();
+	return supported;
+}
+
+TGVOIP_TARGET_AES void AES::ExpandKey(const uint8_t* key, AESKeySchedule* schedule){
+	ExpandEncryptKey(key, schedule->encrypt);
+	DeriveDecryptKeys(schedule->encrypt, schedule->decrypt);
+}
+
+void AES::IGEEncrypt(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t length, uint8_t* iv){
+	IGEEncryptWithRoundKeys(schedule.encrypt, in, out, length, iv);
+}
+
+void AES::IGEDecrypt(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t length, uint8_t* iv){
+	IGEDecryptWithRoundKeys(schedule.decrypt, in, out, length, iv);
+}
+
+TGVOIP_TARGET_AES void AES::CBCEncrypt(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t length, uint8_t* iv){
+	const uint8_t* roundKeys=schedule.encrypt;
+	Block prev=LoadBlock(iv);
+	for(size_t offset=0;offset+AES_BLOCK_SIZE<=length;offset+=AES_BLOCK_SIZE){
+		prev=XorBlocks(LoadBlock(in+offset), prev);
+		EncryptBlocks<1>(&roundKeys, &prev);
+		StoreBlock(out+offset, prev);
+	}
+	StoreBlock(iv, prev);
+}
+
+TGVOIP_TARGET_AES void AES::CBCDecrypt(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t length, uint8_t* iv){
+	const uint8_t* keys[4]={schedule.decrypt, schedule.decrypt, schedule.decrypt, schedule.decrypt};
+	Block prev=LoadBlock(iv);
+	size_t offset=0;
+	// unlike encryption, the blocks don't depend on each other here
+	for(;offset+4*AES_BLOCK_SIZE<=length;offset+=4*AES_BLOCK_SIZE){
+		Block cipher[4], blocks[4];
+		for(int i=0;i<4;i++)
+			blocks[i]=cipher[i]=LoadBlock(in+offset+i*AES_BLOCK_SIZE);
+		DecryptBlocks<4>(keys, blocks);
+		for(int i=0;i<4;i++){
+			StoreBlock(out+offset+i*AES_BLOCK_SIZE, XorBlocks(blocks[i], prev));
+			prev=cipher[i];
+		}
+	}
+	for(;offset+AES_BLOCK_SIZE<=length;offset+=AES_BLOCK_SIZE){
+		Block cipher=LoadBlock(in+offset);
+		Block block=cipher;
+		DecryptBlocks<1>(keys, &block);
+		StoreBlock(out+offset, XorBlocks(block, prev));
+		prev=cipher;
+	}
+	StoreBlock(iv, prev);
+}
+
+TGVOIP_TARGET_AES void AES::CTREncrypt(const AESKeySchedule& schedule, uint8_t* inout, size_t length, uint8_t* iv, uint8_t* ecount, uint32_t* num){
+	const uint8_t* keys[4]={schedule.encrypt, schedule.encrypt, schedule.encrypt, schedule.encrypt};
+	uint32_t n=*num;
+	while(n!=0 && length>0){
+		*inout++^=ecount[n];
+		n=(n+1)%AES_BLOCK_SIZE;
+		length--;
+	}
+	while(length>=4*AES_BLOCK_SIZE){
+		Block blocks[4];
+		for(int i=0;i<4;i++){
+			blocks[i]=LoadBlock(iv);
+			IncrementCounter(iv);
+		}
+		EncryptBlocks<4>(keys, blocks);
+		for(int i=0;i<4;i++)
+			StoreBlock(inout+i*AES_BLOCK_SIZE, XorBlocks(LoadBlock(inout+i*AES_BLOCK_SIZE), blocks[i]));
+		inout+=4*AES_BLOCK_SIZE;
+		length-=4*AES_BLOCK_SIZE;
+	}
+	while(length>0){
+		Block block=LoadBlock(iv);
+		IncrementCounter(iv);
+		EncryptBlocks<1>(keys, &block);
+		StoreBlock(ecount, block);
+		size_t blockLength=std::min(length, (size_t)AES_BLOCK_SIZE);
+		for(size_t i=0;i<blockLength;i++)
+			inout[i]^=ecount[i];
+		n=(uint32_t)(blockLength%AES_BLOCK_SIZE);
+		inout+=blockLength;
+		length-=blockLength;
+	}
+	*num=n;
+}
+
+TGVOIP_TARGET_AES void AES::IGEEncrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv){
+	uint8_t roundKeys[(AES256_ROUNDS+1)*AES_BLOCK_SIZE];
+	ExpandEncryptKey(key, roundKeys);
+	IGEEncryptWithRoundKeys(roundKeys, in, out, length, iv);
+}
+
+TGVOIP_TARGET_AES void AES::IGEDecrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv){
+	AESKeySchedule schedule;
+	ExpandKey(key, &schedule);
+	IGEDecryptWithRoundKeys(schedule.decrypt, in, out, length, iv);
+}
+
+TGVOIP_TARGET_AES void AES::CBCEncrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv){
+	AESKeySchedule schedule;
+	ExpandEncryptKey(key, schedule.encrypt); // the decryption half isn't used here
+	CBCEncrypt(schedule, in, out, length, iv);
+}
+
+TGVOIP_TARGET_AES void AES::CBCDecrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv){
+	AESKeySchedule schedule;
+	ExpandKey(key, &schedule);
+	CBCDecrypt(schedule, in, out, length, iv);
+}
+
+TGVOIP_TARGET_AES void AES::CTREncrypt(uint8_t* inout, size_t length, uint8_t* key, uint8_t* iv, uint8_t* ecount, uint32_t* num){
+	AESKeySchedule schedule;
+	ExpandEncryptKey(key, schedule.encrypt);
+	CTREncrypt(schedule, inout, length, iv, ecount, num);
+}
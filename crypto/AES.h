@@ -0,0 +1,55 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_AES_H
+#define LIBTGVOIP_AES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define AES_BLOCK_SIZE 16
+#define AES256_ROUNDS 14
+
+namespace tgvoip{
+
+/**
+ * Expanded AES-256 round keys for both directions. Plain data, so it can be embedded into other structs.
+ * The round keys are always loaded unaligned, so this doesn't need any particular alignment.
+ */
+struct AESKeySchedule{
+	uint8_t encrypt[(AES256_ROUNDS+1)*AES_BLOCK_SIZE];
+	uint8_t decrypt[(AES256_ROUNDS+1)*AES_BLOCK_SIZE];
+};
+
+/**
+ * AES-256 on the AES instructions of x86 (AES-NI) and ARMv8. There's no software fallback, so it can only be used
+ * when IsHardwareAccelerated() returns true. The library itself only uses it from the default CryptoFunctions;
+ * everything else goes through VoIPController::crypto so that the functions supplied by the app are the ones used.
+ * The overloads that take a raw key have the same signatures as the CryptoFunctions members and can be assigned to them.
+ * All modes may be used in place and update iv, ecount and num the same way OpenSSL does.
+ */
+class AES{
+public:
+	static bool IsHardwareAccelerated();
+	static void ExpandKey(const uint8_t* key, AESKeySchedule* schedule);
+
+	static void IGEEncrypt(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t length, uint8_t* iv);
+	static void IGEDecrypt(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t length, uint8_t* iv);
+	static void CBCEncrypt(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t length, uint8_t* iv);
+	static void CBCDecrypt(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t length, uint8_t* iv);
+	static void CTREncrypt(const AESKeySchedule& schedule, uint8_t* inout, size_t length, uint8_t* iv, uint8_t* ecount, uint32_t* num);
+
+	// these expand the key on every call and don't keep it anywhere afterwards
+	static void IGEEncrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv);
+	static void IGEDecrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv);
+	static void CBCEncrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv);
+	static void CBCDecrypt(uint8_t* in, uint8_t* out, size_t length, uint8_t* key, uint8_t* iv);
+	static void CTREncrypt(uint8_t* inout, size_t length, uint8_t* key, uint8_t* iv, uint8_t* ecount, uint32_t* num);
+};
+
+}
+
+#endif //LIBTGVOIP_AES_H
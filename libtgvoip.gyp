@@ -53,12 +53,22 @@
           '<(tgvoip_src_loc)/PrivateDefines.h',
           '<(tgvoip_src_loc)/VoIPServerConfig.cpp',
           '<(tgvoip_src_loc)/VoIPServerConfig.h',
+          '<(tgvoip_src_loc)/VoIPEngine.cpp',
+          '<(tgvoip_src_loc)/VoIPEngine.h',
+          '<(tgvoip_src_loc)/FecController.cpp',
+          '<(tgvoip_src_loc)/FecController.h',
+          '<(tgvoip_src_loc)/Clock.cpp',
+          '<(tgvoip_src_loc)/Clock.h',
+          '<(tgvoip_src_loc)/crypto/AES.cpp',
+          '<(tgvoip_src_loc)/crypto/AES.h',
           '<(tgvoip_src_loc)/audio/AudioInput.cpp',
           '<(tgvoip_src_loc)/audio/AudioInput.h',
           '<(tgvoip_src_loc)/audio/AudioOutput.cpp',
           '<(tgvoip_src_loc)/audio/AudioOutput.h',
           '<(tgvoip_src_loc)/audio/Resampler.cpp',
           '<(tgvoip_src_loc)/audio/Resampler.h',
+          '<(tgvoip_src_loc)/audio/TimeStretcher.cpp',
+          '<(tgvoip_src_loc)/audio/TimeStretcher.h',
           '<(tgvoip_src_loc)/NetworkSocket.cpp',
           '<(tgvoip_src_loc)/NetworkSocket.h',
           '<(tgvoip_src_loc)/PacketReassembler.cpp',
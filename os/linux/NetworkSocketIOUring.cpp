@@ -0,0 +1,420 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#include "NetworkSocketIOUring.h"
+#include "../../logging.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <algorithm>
+
+using namespace tgvoip;
+
+#pragma mark - IOUring
+
+IOUring::IOUring(){
+
+}
+
+IOUring::~IOUring(){
+	Destroy();
+}
+
+bool IOUring::Init(unsigned int entries){
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	fd=(int)syscall(__NR_io_uring_setup, entries, &params);
+	if(fd<0){
+		LOGW("io_uring_setup failed: %d / %s", errno, strerror(errno));
+		fd=-1;
+		return false;
+	}
+
+	sqRingSize=params.sq_off.array+params.sq_entries*sizeof(unsigned int);
+	cqRingSize=params.cq_off.cqes+params.cq_entries*sizeof(io_uring_cqe);
+	bool singleMmap=(params.features & IORING_FEAT_SINGLE_MMAP)!=0;
+	if(singleMmap){
+		sqRingSize=cqRingSize=std::max(sqRingSize, cqRingSize);
+	}
+	sqRing=mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(sqRing==MAP_FAILED){
+		sqRing=NULL;
+		LOGW("io_uring sq ring mmap failed: %d / %s", errno, strerror(errno));
+		Destroy();
+		return false;
+	}
+	if(singleMmap){
+		cqRing=sqRing;
+	}else{
+		cqRing=mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(cqRing==MAP_FAILED){
+			cqRing=NULL;
+			LOGW("io_uring cq ring mmap failed: %d / %s", errno, strerror(errno));
+			Destroy();
+			return false;
+		}
+	}
+	sqesSize=params.sq_entries*sizeof(io_uring_sqe);
+	void* _sqes=mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(_sqes==MAP_FAILED){
+		LOGW("io_uring sqes mmap failed: %d / %s", errno, strerror(errno));
+		Destroy();
+		return false;
+	}
+	sqes=reinterpret_cast<io_uring_sqe*>(_sqes);
+
+	unsigned char* sq=reinterpret_cast<unsigned char*>(sqRing);
+	sqHead=reinterpret_cast<unsigned int*>(sq+params.sq_off.head);
+	sqTail=reinterpret_cast<unsigned int*>(sq+params.sq_off.tail);
+	sqMask=*reinterpret_cast<unsigned int*>(sq+params.sq_off.ring_mask);
+	sqEntries=*reinterpret_cast<unsigned int*>(sq+params.sq_off.ring_entries);
+	sqArray=reinterpret_cast<unsigned int*>(sq+params.sq_off.array);
+	sqeTail=*sqTail;
+
+	unsigned char* cq=reinterpret_cast<unsigned char*>(cqRing);
+	cqHead=reinterpret_cast<unsigned int*>(cq+params.cq_off.head);
+	cqTail=reinterpret_cast<unsigned int*>(cq+params.cq_off.tail);
+	cqMask=*reinterpret_cast<unsigned int*>(cq+params.cq_off.ring_mask);
+	cqes=reinterpret_cast<io_uring_cqe*>(cq+params.cq_off.cqes);
+	return true;
+}
+
+void IOUring::Destroy(){
+	if(sqes){
+		munmap(sqes, sqesSize);
+		sqes=NULL;
+	}
+	if(cqRing && cqRing!=sqRing)
+		munmap(cqRing, cqRingSize);
+	cqRing=NULL;
+	if(sqRing){
+		munmap(sqRing, sqRingSize);
+		sqRing=NULL;
+	}
+	if(fd>=0){
+		close(fd);
+		fd=-1;
+	}
+}
+
+io_uring_sqe* IOUring::GetSqe(){
+	unsigned int head=__atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+	if(sqeTail-head>=sqEntries)
+		return NULL;
+	unsigned int index=sqeTail & sqMask;
+	io_uring_sqe* sqe=&sqes[index];
+	memset(sqe, 0, sizeof(io_uring_sqe));
+	sqArray[index]=index;
+	sqeTail++;
+	return sqe;
+}
+
+int IOUring::Submit(unsigned int waitFor){
+	unsigned int toSubmit=sqeTail-*sqTail;
+	__atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+	int res;
+	do{
+		res=(int)syscall(__NR_io_uring_enter, fd, toSubmit, waitFor, waitFor>0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	}while(res<0 && errno==EINTR);
+	return res<0 ? -errno : res;
+}
+
+io_uring_cqe* IOUring::PeekCqe(){
+	unsigned int head=*cqHead;
+	if(head==__atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &cqes[head & cqMask];
+}
+
+void IOUring::AdvanceCq(){
+	__atomic_store_n(cqHead, *cqHead+1, __ATOMIC_RELEASE);
+}
+
+int IOUring::Register(unsigned int opcode, void* arg, unsigned int nrArgs){
+	int res=(int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+	return res<0 ? -errno : res;
+}
+
+#pragma mark - NetworkSocketIOUring
+
+NetworkSocketIOUring::NetworkSocketIOUring(NetworkProtocol protocol) : NetworkSocketPosix(protocol){
+	memset(&recvMsg, 0, sizeof(recvMsg));
+}
+
+NetworkSocketIOUring::~NetworkSocketIOUring(){
+	if(fd>=0)
+		Close();
+	DestroyRings();
+}
+
+void NetworkSocketIOUring::Open(){
+	NetworkSocketPosix::Open();
+	if(failed || protocol!=NetworkProtocol::UDP)
+		return;
+	useRing=InitRings();
+	if(useRing){
+		LOGI("Using io_uring for UDP socket");
+	}else{
+		LOGW("io_uring is not available, falling back to regular sockets");
+	}
+}
+
+void NetworkSocketIOUring::Close(){
+	// The rings stay around until the destructor because the receive thread could still be polling them.
+	MutexGuard m(recvMutex);
+	if(useRing && fd>=0)
+		CancelReceive();
+	NetworkSocketPosix::Close();
+}
+
+void NetworkSocketIOUring::CancelReceive(){
+	// A pending receive holds its own reference to the socket, so closing the descriptor alone would leave it bound
+	// and receiving until the rings are destroyed. Cancel it and wait for its final completion instead.
+	if(!recvArmed)
+		return;
+	io_uring_sqe* sqe=recvRing.GetSqe();
+	if(!sqe){
+		LOGE("io_uring: no room to cancel the receive");
+		return;
+	}
+	sqe->opcode=IORING_OP_ASYNC_CANCEL;
+	sqe->fd=-1;
+	sqe->addr=IO_URING_RECV_TAG;
+	sqe->user_data=IO_URING_CANCEL_TAG;
+	int res=recvRing.Submit();
+	if(res<0){
+		LOGE("error submitting recvmsg cancellation: %d / %s", -res, strerror(-res));
+		return;
+	}
+	bool cancelDone=false;
+	while(recvArmed || !cancelDone){
+		io_uring_cqe* cqe=recvRing.PeekCqe();
+		if(!cqe){
+			res=recvRing.Submit(1);
+			if(res<0){
+				LOGE("error waiting for recvmsg cancellation: %d / %s", -res, strerror(-res));
+				return;
+			}
+			continue;
+		}
+		if(cqe->user_data==IO_URING_CANCEL_TAG){
+			// -ENOENT means the receive had already finished, its completion is in the queue then
+			cancelDone=true;
+		}else{
+			// whatever was received in the meantime is dropped
+			if(cqe->flags & IORING_CQE_F_BUFFER)
+				RecycleBuffer((uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+			if(!(cqe->flags & IORING_CQE_F_MORE))
+				recvArmed=false;
+		}
+		recvRing.AdvanceCq();
+	}
+}
+
+int NetworkSocketIOUring::GetPollDescriptor(){
+	// The io_uring descriptor becomes readable when there are completions
+	return useRing ? recvRing.GetFD() : (int)fd;
+}
+
+bool NetworkSocketIOUring::InitRings(){
+	if(!recvRing.Init(64)){
+		DestroyRings();
+		return false;
+	}
+	void* ringMem=mmap(NULL, IO_URING_RECV_BUFFER_COUNT*sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if(ringMem==MAP_FAILED){
+		LOGW("buffer ring mmap failed: %d / %s", errno, strerror(errno));
+		DestroyRings();
+		return false;
+	}
+	bufRing=reinterpret_cast<io_uring_buf*>(ringMem);
+	io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr=reinterpret_cast<uint64_t>(bufRing);
+	reg.ring_entries=IO_URING_RECV_BUFFER_COUNT;
+	reg.bgid=0;
+	int res=recvRing.Register(IORING_REGISTER_PBUF_RING, &reg, 1);
+	if(res<0){
+		LOGW("registering buffer ring failed: %d / %s", -res, strerror(-res));
+		DestroyRings();
+		return false;
+	}
+	recvBuffers=reinterpret_cast<unsigned char*>(malloc(IO_URING_RECV_BUFFER_COUNT*IO_URING_RECV_BUFFER_SIZE));
+	if(!recvBuffers){
+		DestroyRings();
+		return false;
+	}
+	bufRingTail=0;
+	for(uint16_t i=0;i<IO_URING_RECV_BUFFER_COUNT;i++){
+		RecycleBuffer(i);
+	}
+
+	memset(&recvMsg, 0, sizeof(recvMsg));
+	recvMsg.msg_namelen=sizeof(sockaddr_in6);
+	if(!ArmReceive()){
+		DestroyRings();
+		return false;
+	}
+	return true;
+}
+
+void NetworkSocketIOUring::DestroyRings(){
+	recvRing.Destroy();
+	if(bufRing){
+		munmap(bufRing, IO_URING_RECV_BUFFER_COUNT*sizeof(io_uring_buf));
+		bufRing=NULL;
+	}
+	if(recvBuffers){
+		free(recvBuffers);
+		recvBuffers=NULL;
+	}
+	recvArmed=false;
+}
+
+bool NetworkSocketIOUring::ArmReceive(){
+	io_uring_sqe* sqe=recvRing.GetSqe();
+	if(!sqe)
+		return false;
+	sqe->opcode=IORING_OP_RECVMSG;
+	sqe->fd=fd;
+	sqe->addr=reinterpret_cast<uint64_t>(&recvMsg);
+	sqe->flags=IOSQE_BUFFER_SELECT;
+	sqe->buf_group=0;
+	sqe->user_data=IO_URING_RECV_TAG;
+	if(multishot){
+		sqe->ioprio=IORING_RECV_MULTISHOT;
+	}else{
+		// a single-shot receive puts the address into msg_name and only the payload into the buffer
+		recvAddr={0};
+		recvMsg.msg_name=&recvAddr;
+		recvMsg.msg_namelen=sizeof(recvAddr);
+		recvIov.iov_base=NULL;
+		recvIov.iov_len=IO_URING_RECV_BUFFER_SIZE;
+		recvMsg.msg_iov=&recvIov;
+		recvMsg.msg_iovlen=1;
+	}
+	int res=recvRing.Submit();
+	if(res<0){
+		LOGE("error submitting %s recvmsg: %d / %s", multishot ? "multishot" : "single-shot", -res, strerror(-res));
+		return false;
+	}
+	recvArmed=true;
+	return true;
+}
+
+void NetworkSocketIOUring::RecycleBuffer(uint16_t bid){
+	// The tail shares memory with the first buffer's resv field, so the entries are filled field by field
+	io_uring_buf& buf=bufRing[bufRingTail & (IO_URING_RECV_BUFFER_COUNT-1)];
+	buf.addr=reinterpret_cast<uint64_t>(recvBuffers+(size_t)bid*IO_URING_RECV_BUFFER_SIZE);
+	buf.len=IO_URING_RECV_BUFFER_SIZE;
+	buf.bid=bid;
+	bufRingTail++;
+	uint16_t* tail=reinterpret_cast<uint16_t*>(reinterpret_cast<unsigned char*>(bufRing)+offsetof(io_uring_buf, resv));
+	__atomic_store_n(tail, bufRingTail, __ATOMIC_RELEASE);
+}
+
+size_t NetworkSocketIOUring::ReceiveBatch(std::vector<NetworkPacket>& packets, size_t maxCount){
+	if(!useRing)
+		return NetworkSocketPosix::ReceiveBatch(packets, maxCount);
+	MutexGuard m(recvMutex);
+	if(failed)
+		return 0;
+	size_t count=0;
+	while(count<maxCount){
+		io_uring_cqe* cqe=recvRing.PeekCqe();
+		if(!cqe)
+			break;
+		int res=cqe->res;
+		uint32_t flags=cqe->flags;
+		recvRing.AdvanceCq();
+		if(!(flags & IORING_CQE_F_MORE))
+			recvArmed=false;
+		if(!(flags & IORING_CQE_F_BUFFER)){
+			if(res==-EINVAL || res==-EOPNOTSUPP){
+				// the kernel doesn't support this kind of receive, re-arming it the same way would fail forever
+				if(multishot && !multishotWorked){
+					LOGW("multishot recvmsg is not supported, falling back to single-shot");
+					multishot=false;
+				}else{
+					LOGE("io_uring recvmsg is not supported: %d / %s", -res, strerror(-res));
+					failed=true;
+				}
+			}else if(res<0 && res!=-ENOBUFS){
+				LOGE("error receiving %d / %s", -res, strerror(-res));
+			}
+			continue;
+		}
+		uint16_t bid=(uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+		unsigned char* buf=recvBuffers+(size_t)bid*IO_URING_RECV_BUFFER_SIZE;
+		if(res<0){
+			RecycleBuffer(bid);
+			continue;
+		}
+		if(!multishot){
+			if(res==0 || recvMsg.msg_namelen<sizeof(sockaddr_in6)){
+				RecycleBuffer(bid);
+				continue;
+			}
+			Buffer data=GetReceiveBuffer((size_t)res);
+			data.CopyFrom(buf, 0, (size_t)res);
+			data.Resize((size_t)res);
+			RecycleBuffer(bid);
+			packets.push_back(NetworkPacket{
+				std::move(data),
+				AddressFromSockaddr(recvAddr),
+				ntohs(recvAddr.sin6_port),
+				NetworkProtocol::UDP
+			});
+			count++;
+			// there's only one packet per receive, arm the next one right away
+			if(!failed)
+				ArmReceive();
+			continue;
+		}
+		multishotWorked=true;
+		io_uring_recvmsg_out* out=reinterpret_cast<io_uring_recvmsg_out*>(buf);
+		size_t payloadOffset=sizeof(io_uring_recvmsg_out)+recvMsg.msg_namelen+recvMsg.msg_controllen;
+		if(out->namelen<sizeof(sockaddr_in6) || (size_t)res<payloadOffset){
+			RecycleBuffer(bid);
+			continue;
+		}
+		size_t len=std::min((size_t)out->payloadlen, (size_t)res-payloadOffset);
+		if(len==0){
+			RecycleBuffer(bid);
+			continue;
+		}
+		sockaddr_in6 srcAddr;
+		memcpy(&srcAddr, buf+sizeof(io_uring_recvmsg_out), sizeof(sockaddr_in6));
+		Buffer data=GetReceiveBuffer(len);
+		data.CopyFrom(buf+payloadOffset, 0, len);
+		data.Resize(len);
+		RecycleBuffer(bid);
+		packets.push_back(NetworkPacket{
+			std::move(data),
+			AddressFromSockaddr(srcAddr),
+			ntohs(srcAddr.sin6_port),
+			NetworkProtocol::UDP
+		});
+		count++;
+	}
+	// the multishot receive stops when it runs out of buffers or hits an error
+	if(!recvArmed && !failed)
+		ArmReceive();
+	return count;
+}
+
+NetworkPacket NetworkSocketIOUring::Receive(size_t maxLen){
+	if(!useRing)
+		return NetworkSocketPosix::Receive(maxLen);
+	std::vector<NetworkPacket> packets;
+	if(ReceiveBatch(packets, 1)==0)
+		return NetworkPacket::Empty();
+	return std::move(packets[0]);
+}
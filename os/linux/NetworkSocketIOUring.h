@@ -0,0 +1,110 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+#ifndef LIBTGVOIP_NETWORKSOCKETIOURING_H
+#define LIBTGVOIP_NETWORKSOCKETIOURING_H
+
+#include "../posix/NetworkSocketPosix.h"
+#include "../../threading.h"
+#include "../../utils.h"
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#define IO_URING_RECV_BUFFER_COUNT 128 // must be a power of 2
+#define IO_URING_RECV_BUFFER_SIZE 2048
+// user_data of the receive and of the request that cancels it
+#define IO_URING_RECV_TAG 1
+#define IO_URING_CANCEL_TAG 2
+
+namespace tgvoip{
+
+/**
+ * A minimal io_uring wrapper on top of the raw system calls, so there's no dependency on liburing.
+ * Not thread-safe, each ring is supposed to be used from one thread.
+ */
+class IOUring{
+public:
+	TGVOIP_DISALLOW_COPY_AND_ASSIGN(IOUring);
+	IOUring();
+	~IOUring();
+	bool Init(unsigned int entries);
+	void Destroy();
+	io_uring_sqe* GetSqe();
+	/**
+	 * Submits all SQEs obtained since the last call and waits until at least waitFor completions are available
+	 * @return the number of submitted SQEs or -errno
+	 */
+	int Submit(unsigned int waitFor=0);
+	io_uring_cqe* PeekCqe();
+	void AdvanceCq();
+	int Register(unsigned int opcode, void* arg, unsigned int nrArgs);
+	int GetFD(){
+		return fd;
+	}
+
+private:
+	int fd=-1;
+	void* sqRing=NULL;
+	size_t sqRingSize=0;
+	void* cqRing=NULL;
+	size_t cqRingSize=0;
+	io_uring_sqe* sqes=NULL;
+	size_t sqesSize=0;
+	unsigned int* sqHead;
+	unsigned int* sqTail;
+	unsigned int sqMask;
+	unsigned int sqEntries;
+	unsigned int* sqArray;
+	unsigned int sqeTail=0;
+	unsigned int* cqHead;
+	unsigned int* cqTail;
+	unsigned int cqMask;
+	io_uring_cqe* cqes;
+};
+
+/**
+ * UDP socket that receives through a multishot recvmsg into a ring of kernel-provided buffers.
+ * Sends go through NetworkSocketPosix, since sendmmsg with UDP GSO is cheaper than a ring round trip per batch.
+ * Behaves exactly like NetworkSocketPosix if io_uring isn't available.
+ */
+class NetworkSocketIOUring : public NetworkSocketPosix{
+public:
+	NetworkSocketIOUring(NetworkProtocol protocol);
+	virtual ~NetworkSocketIOUring();
+	virtual NetworkPacket Receive(size_t maxLen) override;
+	virtual size_t ReceiveBatch(std::vector<NetworkPacket>& packets, size_t maxCount) override;
+	virtual void Open() override;
+	virtual void Close() override;
+
+protected:
+	virtual int GetPollDescriptor() override;
+
+private:
+	bool InitRings();
+	void DestroyRings();
+	bool ArmReceive();
+	void CancelReceive();
+	void RecycleBuffer(uint16_t bid);
+
+	bool useRing=false;
+	IOUring recvRing;
+	// Close() can be called from another thread while the receive thread is reaping completions
+	Mutex recvMutex;
+	unsigned char* recvBuffers=NULL;
+	io_uring_buf* bufRing=NULL;
+	uint16_t bufRingTail=0;
+	bool recvArmed=false;
+	// multishot recvmsg needs Linux 6.0, buffer rings only 5.19; without it, each receive is armed separately
+	bool multishot=true;
+	bool multishotWorked=false;
+	msghdr recvMsg;
+	iovec recvIov;
+	sockaddr_in6 recvAddr;
+};
+
+}
+
+#endif //LIBTGVOIP_NETWORKSOCKETIOURING_H
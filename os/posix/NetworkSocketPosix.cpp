@@ -17,6 +17,7 @@
 #include "../../logging.h"
 #include "../../VoIPController.h"
 #include "../../Buffers.h"
+#include "../../VoIPServerConfig.h"
 
 #ifdef __ANDROID__
 #include <jni.h>
@@ -29,6 +30,28 @@ extern jclass jniUtilitiesClass;
 #include <ifaddrs.h>
 #endif
 
+// recvmmsg() is available on glibc and on Android since API level 21, sendmmsg() since 21 too
+#if defined(__linux__) && (!defined(__ANDROID__) || __ANDROID_API__>=21)
+#define TGVOIP_HAVE_RECVMMSG
+#define TGVOIP_HAVE_SENDMMSG
+#endif
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#ifdef TGVOIP_HAVE_SENDMMSG
+#include <netinet/udp.h>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#define MAX_GSO_SEGMENTS 64
+#define MAX_GSO_TOTAL_SIZE 65000
+#endif
+
 using namespace tgvoip;
 
 
@@ -84,57 +107,7 @@ void NetworkSocketPosix::Send(NetworkPacket packet){
 	int res;
 	if(protocol==NetworkProtocol::UDP){
 		sockaddr_in6 addr;
-		if(!packet.address.isIPv6){
-			if(needUpdateNat64Prefix && !isV4Available && VoIPController::GetCurrentTime()>switchToV6at && switchToV6at!=0){
-				LOGV("Updating NAT64 prefix");
-				nat64Present=false;
-				addrinfo *addr0;
-				int res=getaddrinfo("ipv4only.arpa", NULL, NULL, &addr0);
-				if(res!=0){
-					LOGW("Error updating NAT64 prefix: %d / %s", res, gai_strerror(res));
-				}else{
-					addrinfo *addrPtr;
-					unsigned char *addr170=NULL;
-					unsigned char *addr171=NULL;
-					for(addrPtr=addr0; addrPtr; addrPtr=addrPtr->ai_next){
-						if(addrPtr->ai_family==AF_INET6){
-							sockaddr_in6 *translatedAddr=(sockaddr_in6 *) addrPtr->ai_addr;
-							uint32_t v4part=*((uint32_t *) &translatedAddr->sin6_addr.s6_addr[12]);
-							if(v4part==0xAA0000C0 && !addr170){
-								addr170=translatedAddr->sin6_addr.s6_addr;
-							}
-							if(v4part==0xAB0000C0 && !addr171){
-								addr171=translatedAddr->sin6_addr.s6_addr;
-							}
-							char buf[INET6_ADDRSTRLEN];
-							LOGV("Got translated address: %s", inet_ntop(AF_INET6, &translatedAddr->sin6_addr, buf, sizeof(buf)));
-						}
-					}
-					if(addr170 && addr171 && memcmp(addr170, addr171, 12)==0){
-						nat64Present=true;
-						memcpy(nat64Prefix, addr170, 12);
-						char buf[INET6_ADDRSTRLEN];
-						LOGV("Found nat64 prefix from %s", inet_ntop(AF_INET6, addr170, buf, sizeof(buf)));
-					}else{
-						LOGV("Didn't find nat64");
-					}
-					freeaddrinfo(addr0);
-				}
-				needUpdateNat64Prefix=false;
-			}
-			memset(&addr, 0, sizeof(sockaddr_in6));
-			addr.sin6_family=AF_INET6;
-			*((uint32_t *) &addr.sin6_addr.s6_addr[12])=packet.address.addr.ipv4;
-			if(nat64Present)
-				memcpy(addr.sin6_addr.s6_addr, nat64Prefix, 12);
-			else
-				addr.sin6_addr.s6_addr[11]=addr.sin6_addr.s6_addr[10]=0xFF;
-
-		}else{
-			memcpy(addr.sin6_addr.s6_addr, packet.address.addr.ipv6, 16);
-			addr.sin6_family=AF_INET6;
-		}
-		addr.sin6_port=htons(packet.port);
+		SockaddrFromAddress(packet.address, packet.port, addr);
 		res=(int)sendto(fd, *packet.data, packet.data.Length(), 0, (const sockaddr *) &addr, sizeof(addr));
 	}else{
 		res=(int)send(fd, *packet.data, packet.data.Length(), 0);
@@ -168,6 +141,162 @@ void NetworkSocketPosix::Send(NetworkPacket packet){
 	}
 }
 
+void NetworkSocketPosix::SockaddrFromAddress(const NetworkAddress& address, uint16_t port, sockaddr_in6& addr){
+	if(!address.isIPv6){
+		if(needUpdateNat64Prefix && !isV4Available && VoIPController::GetCurrentTime()>switchToV6at && switchToV6at!=0){
+			LOGV("Updating NAT64 prefix");
+			nat64Present=false;
+			addrinfo *addr0;
+			int res=getaddrinfo("ipv4only.arpa", NULL, NULL, &addr0);
+			if(res!=0){
+				LOGW("Error updating NAT64 prefix: %d / %s", res, gai_strerror(res));
+			}else{
+				addrinfo *addrPtr;
+				unsigned char *addr170=NULL;
+				unsigned char *addr171=NULL;
+				for(addrPtr=addr0; addrPtr; addrPtr=addrPtr->ai_next){
+					if(addrPtr->ai_family==AF_INET6){
+						sockaddr_in6 *translatedAddr=(sockaddr_in6 *) addrPtr->ai_addr;
+						uint32_t v4part=*((uint32_t *) &translatedAddr->sin6_addr.s6_addr[12]);
+						if(v4part==0xAA0000C0 && !addr170){
+							addr170=translatedAddr->sin6_addr.s6_addr;
+						}
+						if(v4part==0xAB0000C0 && !addr171){
+							addr171=translatedAddr->sin6_addr.s6_addr;
+						}
+						char buf[INET6_ADDRSTRLEN];
+						LOGV("Got translated address: %s", inet_ntop(AF_INET6, &translatedAddr->sin6_addr, buf, sizeof(buf)));
+					}
+				}
+				if(addr170 && addr171 && memcmp(addr170, addr171, 12)==0){
+					nat64Present=true;
+					memcpy(nat64Prefix, addr170, 12);
+					char buf[INET6_ADDRSTRLEN];
+					LOGV("Found nat64 prefix from %s", inet_ntop(AF_INET6, addr170, buf, sizeof(buf)));
+				}else{
+					LOGV("Didn't find nat64");
+				}
+				freeaddrinfo(addr0);
+			}
+			needUpdateNat64Prefix=false;
+		}
+		memset(&addr, 0, sizeof(sockaddr_in6));
+		addr.sin6_family=AF_INET6;
+		*((uint32_t *) &addr.sin6_addr.s6_addr[12])=address.addr.ipv4;
+		if(nat64Present)
+			memcpy(addr.sin6_addr.s6_addr, nat64Prefix, 12);
+		else
+			addr.sin6_addr.s6_addr[11]=addr.sin6_addr.s6_addr[10]=0xFF;
+
+	}else{
+		memset(&addr, 0, sizeof(sockaddr_in6));
+		memcpy(addr.sin6_addr.s6_addr, address.addr.ipv6, 16);
+		addr.sin6_family=AF_INET6;
+	}
+	addr.sin6_port=htons(port);
+}
+
+void NetworkSocketPosix::SendBatch(std::vector<NetworkPacket>& packets){
+#ifdef TGVOIP_HAVE_SENDMMSG
+	if(protocol!=NetworkProtocol::UDP || packets.size()<2){
+		NetworkSocket::SendBatch(packets);
+		return;
+	}
+	size_t offset=0;
+	while(offset<packets.size()){
+		size_t count=std::min(packets.size()-offset, (size_t)MAX_SEND_BATCH_SIZE);
+		size_t sent=SendBatchInternal(&packets[offset], count);
+		if(sent<count){
+			// something went wrong, let Send() deal with the errors
+			for(size_t i=offset+sent;i<packets.size();i++){
+				if(!pendingOutgoingPacket.IsEmpty() || failed){
+					LOGW("Dropping %u outgoing packets", (unsigned int)(packets.size()-i));
+					break;
+				}
+				Send(std::move(packets[i]));
+			}
+			break;
+		}
+		offset+=count;
+	}
+#else
+	NetworkSocket::SendBatch(packets);
+#endif
+}
+
+#ifdef TGVOIP_HAVE_SENDMMSG
+size_t NetworkSocketPosix::SendBatchInternal(NetworkPacket* packets, size_t count){
+	mmsghdr msgs[MAX_SEND_BATCH_SIZE];
+	iovec iovs[MAX_SEND_BATCH_SIZE];
+	sockaddr_in6 addrs[MAX_SEND_BATCH_SIZE];
+	size_t firstPacket[MAX_SEND_BATCH_SIZE]; // index of the first packet in each message
+	union{
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+		cmsghdr align;
+	} control[MAX_SEND_BATCH_SIZE];
+
+	for(size_t i=0;i<count;i++){
+		SockaddrFromAddress(packets[i].address, packets[i].port, addrs[i]);
+		iovs[i].iov_base=*packets[i].data;
+		iovs[i].iov_len=packets[i].data.Length();
+	}
+
+	size_t msgCount=0;
+	memset(msgs, 0, sizeof(mmsghdr)*count);
+	for(size_t i=0;i<count;){
+		mmsghdr& msg=msgs[msgCount];
+		firstPacket[msgCount]=i;
+		msg.msg_hdr.msg_name=&addrs[i];
+		msg.msg_hdr.msg_namelen=sizeof(sockaddr_in6);
+		msg.msg_hdr.msg_iov=&iovs[i];
+		size_t segments=1;
+		if(gsoAvailable){
+			// With GSO, consecutive same-sized datagrams to the same destination go out as one message
+			// that the kernel (or the NIC) splits into segments. Only the last segment may be shorter.
+			size_t segmentSize=iovs[i].iov_len;
+			size_t totalSize=segmentSize;
+			while(i+segments<count && segments<MAX_GSO_SEGMENTS){
+				size_t next=i+segments;
+				if(iovs[next].iov_len>segmentSize || totalSize+iovs[next].iov_len>MAX_GSO_TOTAL_SIZE)
+					break;
+				if(memcmp(&addrs[next].sin6_addr, &addrs[i].sin6_addr, sizeof(in6_addr))!=0 || addrs[next].sin6_port!=addrs[i].sin6_port)
+					break;
+				totalSize+=iovs[next].iov_len;
+				segments++;
+				if(iovs[next].iov_len<segmentSize)
+					break;
+			}
+			if(segments>1){
+				msg.msg_hdr.msg_control=control[msgCount].buf;
+				msg.msg_hdr.msg_controllen=sizeof(control[msgCount].buf);
+				cmsghdr* cm=CMSG_FIRSTHDR(&msg.msg_hdr);
+				cm->cmsg_level=SOL_UDP;
+				cm->cmsg_type=UDP_SEGMENT;
+				cm->cmsg_len=CMSG_LEN(sizeof(uint16_t));
+				*reinterpret_cast<uint16_t*>(CMSG_DATA(cm))=(uint16_t)segmentSize;
+			}
+		}
+		msg.msg_hdr.msg_iovlen=segments;
+		msgCount++;
+		i+=segments;
+	}
+
+	size_t sentMsgs=0;
+	while(sentMsgs<msgCount){
+		int res=sendmmsg(fd, msgs+sentMsgs, (unsigned int)(msgCount-sentMsgs), 0);
+		if(res<=0){
+			if(msgs[sentMsgs].msg_hdr.msg_iovlen>1 && (errno==EIO || errno==EINVAL || errno==ENOPROTOOPT)){
+				LOGW("UDP GSO send failed (%d / %s), disabling it", errno, strerror(errno));
+				gsoAvailable=false;
+			}
+			break;
+		}
+		sentMsgs+=(size_t)res;
+	}
+	return sentMsgs<msgCount ? firstPacket[sentMsgs] : count;
+}
+#endif
+
 bool NetworkSocketPosix::OnReadyToSend(){
 	if(!pendingOutgoingPacket.IsEmpty()){
 		Send(std::move(pendingOutgoingPacket));
@@ -184,25 +313,16 @@ NetworkPacket NetworkSocketPosix::Receive(size_t maxLen){
 	if(failed){
 		return NetworkPacket::Empty();
 	}
+	if(recvBuffer.IsEmpty())
+		recvBuffer=GetReceiveBuffer(LARGE_RECV_BUFFER_SIZE);
 	if(protocol==NetworkProtocol::UDP){
 		int addrLen=sizeof(sockaddr_in6);
 		sockaddr_in6 srcAddr;
 		ssize_t len=recvfrom(fd, *recvBuffer, std::min(recvBuffer.Length(), maxLen), 0, (sockaddr *) &srcAddr, (socklen_t *) &addrLen);
 		if(len>0){
-			if(!isV4Available && IN6_IS_ADDR_V4MAPPED(&srcAddr.sin6_addr)){
-				isV4Available=true;
-				LOGI("Detected IPv4 connectivity, will not try IPv6");
-			}
-			NetworkAddress addr=NetworkAddress::Empty();
-			if(IN6_IS_ADDR_V4MAPPED(&srcAddr.sin6_addr) || (nat64Present && memcmp(nat64Prefix, srcAddr.sin6_addr.s6_addr, 12)==0)){
-				in_addr v4addr=*((in_addr *) &srcAddr.sin6_addr.s6_addr[12]);
-				addr=NetworkAddress::IPv4(v4addr.s_addr);
-			}else{
-				addr=NetworkAddress::IPv6(srcAddr.sin6_addr.s6_addr);
-			}
 			return NetworkPacket{
-				Buffer::CopyOf(recvBuffer, 0, (size_t)len),
-				addr,
+				TakeReceivedData(recvBuffer, (size_t)len),
+				AddressFromSockaddr(srcAddr),
 				ntohs(srcAddr.sin6_port),
 				NetworkProtocol::UDP
 			};
@@ -219,7 +339,7 @@ NetworkPacket NetworkSocketPosix::Receive(size_t maxLen){
 			return NetworkPacket::Empty();
 		}else{
 			return NetworkPacket{
-					Buffer::CopyOf(recvBuffer, 0, (size_t)res),
+					TakeReceivedData(recvBuffer, (size_t)res),
 					tcpConnectedAddress,
 					tcpConnectedPort,
 					NetworkProtocol::TCP
@@ -229,6 +349,93 @@ NetworkPacket NetworkSocketPosix::Receive(size_t maxLen){
 	return NetworkPacket::Empty();
 }
 
+size_t NetworkSocketPosix::ReceiveBatch(std::vector<NetworkPacket>& packets, size_t maxCount){
+	if(protocol!=NetworkProtocol::UDP)
+		return NetworkSocket::ReceiveBatch(packets, maxCount);
+	if(failed || maxCount==0)
+		return 0;
+	maxCount=std::min(maxCount, (size_t)MAX_RECV_BATCH_SIZE);
+	// Datagrams are received straight into pooled buffers that are then handed over with the packets.
+	// Small ones are moved into a buffer of the smaller size class so that the large ones can be reused.
+#ifdef TGVOIP_HAVE_RECVMMSG
+	mmsghdr msgs[MAX_RECV_BATCH_SIZE];
+	iovec iovs[MAX_RECV_BATCH_SIZE];
+	sockaddr_in6 srcAddrs[MAX_RECV_BATCH_SIZE];
+	memset(msgs, 0, sizeof(mmsghdr)*maxCount);
+	for(size_t i=0;i<maxCount;i++){
+		if(recvBatchBuffers[i].IsEmpty())
+			recvBatchBuffers[i]=GetReceiveBuffer(LARGE_RECV_BUFFER_SIZE);
+		iovs[i].iov_base=*recvBatchBuffers[i];
+		iovs[i].iov_len=recvBatchBuffers[i].Length();
+		msgs[i].msg_hdr.msg_iov=&iovs[i];
+		msgs[i].msg_hdr.msg_iovlen=1;
+		msgs[i].msg_hdr.msg_name=&srcAddrs[i];
+		msgs[i].msg_hdr.msg_namelen=sizeof(sockaddr_in6);
+	}
+	int count=recvmmsg(fd, msgs, (unsigned int)maxCount, MSG_DONTWAIT, NULL);
+	if(count<0){
+		if(errno!=EAGAIN && errno!=EWOULDBLOCK)
+			LOGE("error receiving %d / %s", errno, strerror(errno));
+		return 0;
+	}
+	for(int i=0;i<count;i++){
+		packets.push_back(NetworkPacket{
+			TakeReceivedData(recvBatchBuffers[i], msgs[i].msg_len),
+			AddressFromSockaddr(srcAddrs[i]),
+			ntohs(srcAddrs[i].sin6_port),
+			NetworkProtocol::UDP
+		});
+	}
+	return (size_t)count;
+#else
+	size_t count=0;
+	while(count<maxCount){
+		if(recvBatchBuffers[0].IsEmpty())
+			recvBatchBuffers[0]=GetReceiveBuffer(LARGE_RECV_BUFFER_SIZE);
+		socklen_t addrLen=sizeof(sockaddr_in6);
+		sockaddr_in6 srcAddr;
+		ssize_t len=recvfrom(fd, *recvBatchBuffers[0], recvBatchBuffers[0].Length(), MSG_DONTWAIT, (sockaddr*) &srcAddr, &addrLen);
+		if(len<=0){
+			if(len<0 && errno!=EAGAIN && errno!=EWOULDBLOCK)
+				LOGE("error receiving %d / %s", errno, strerror(errno));
+			break;
+		}
+		packets.push_back(NetworkPacket{
+			TakeReceivedData(recvBatchBuffers[0], (size_t)len),
+			AddressFromSockaddr(srcAddr),
+			ntohs(srcAddr.sin6_port),
+			NetworkProtocol::UDP
+		});
+		count++;
+	}
+	return count;
+#endif
+}
+
+Buffer NetworkSocketPosix::TakeReceivedData(Buffer& buffer, size_t len){
+	Buffer data;
+	if(len<=SMALL_RECV_BUFFER_SIZE){
+		data=GetReceiveBuffer(len);
+		data.CopyFrom(buffer, len);
+	}else{
+		data=std::move(buffer);
+	}
+	data.Resize(len);
+	return data;
+}
+
+NetworkAddress NetworkSocketPosix::AddressFromSockaddr(const sockaddr_in6& srcAddr){
+	if(!isV4Available && IN6_IS_ADDR_V4MAPPED(&srcAddr.sin6_addr)){
+		isV4Available=true;
+		LOGI("Detected IPv4 connectivity, will not try IPv6");
+	}
+	if(IN6_IS_ADDR_V4MAPPED(&srcAddr.sin6_addr) || (nat64Present && memcmp(nat64Prefix, srcAddr.sin6_addr.s6_addr, 12)==0)){
+		in_addr v4addr=*((in_addr *) &srcAddr.sin6_addr.s6_addr[12]);
+		return NetworkAddress::IPv4(v4addr.s_addr);
+	}
+	return NetworkAddress::IPv6(srcAddr.sin6_addr.s6_addr);
+}
+
 void NetworkSocketPosix::Open(){
 	if(protocol!=NetworkProtocol::UDP)
 		return;
@@ -288,6 +495,14 @@ void NetworkSocketPosix::Open(){
 	getsockname(fd, (sockaddr*)&addr, (socklen_t*) &addrLen);
 	LOGD("Bound to local UDP port %u", ntohs(addr.sin6_port));
 
+#ifdef TGVOIP_HAVE_SENDMMSG
+	// kernels that know about UDP_SEGMENT (4.18+) also support GSO in sendmsg
+	int gsoSize=0;
+	socklen_t gsoSizeLen=sizeof(gsoSize);
+	gsoAvailable=getsockopt(fd, SOL_UDP, UDP_SEGMENT, &gsoSize, &gsoSizeLen)==0 && ServerConfig::GetSharedInstance()->GetBoolean("use_udp_gso", true);
+	LOGD("UDP GSO %s", gsoAvailable ? "available" : "not available");
+#endif
+
 	needUpdateNat64Prefix=true;
 	isV4Available=false;
 	switchToV6at=VoIPController::GetCurrentTime()+ipv6Timeout;
@@ -560,8 +775,7 @@ bool NetworkSocketPosix::Select(std::vector<NetworkSocket *> &readFds, std::vect
 	select(maxfd+1, &readSet, &writeSet, &errorSet, NULL);
 
 	if(canceller && FD_ISSET(canceller->pipeRead, &readSet) && !anyFailed){
-		char c;
-		(void) read(canceller->pipeRead, &c, 1);
+		canceller->Acknowledge();
 		return false;
 	}else if(anyFailed){
 		FD_ZERO(&readSet);
@@ -610,6 +824,15 @@ bool NetworkSocketPosix::Select(std::vector<NetworkSocket *> &readFds, std::vect
 }
 
 SocketSelectCancellerPosix::SocketSelectCancellerPosix(){
+#ifdef __linux__
+	// an eventfd is one descriptor instead of two and doesn't need a pipe buffer
+	int efd=eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(efd>=0){
+		pipeRead=pipeWrite=efd;
+		return;
+	}
+	LOGW("eventfd() failed: %d / %s, using a pipe instead", errno, strerror(errno));
+#endif
 	int p[2];
 	int pipeRes=pipe(p);
 	if(pipeRes!=0){
@@ -622,20 +845,183 @@ SocketSelectCancellerPosix::SocketSelectCancellerPosix(){
 
 SocketSelectCancellerPosix::~SocketSelectCancellerPosix(){
 	close(pipeRead);
-	close(pipeWrite);
+	if(pipeWrite!=pipeRead)
+		close(pipeWrite);
 }
 
 void SocketSelectCancellerPosix::CancelSelect(){
-	char c=1;
-	(void) write(pipeWrite, &c, 1);
+	if(pipeWrite==pipeRead){
+		uint64_t v=1;
+		(void) write(pipeWrite, &v, sizeof(v));
+	}else{
+		char c=1;
+		(void) write(pipeWrite, &c, 1);
+	}
+}
+
+void SocketSelectCancellerPosix::Acknowledge(){
+	if(pipeWrite==pipeRead){
+		uint64_t v;
+		(void) read(pipeRead, &v, sizeof(v));
+	}else{
+		char c;
+		(void) read(pipeRead, &c, 1);
+	}
 }
 
 int NetworkSocketPosix::GetDescriptorFromSocket(NetworkSocket *socket){
 	NetworkSocketPosix* sp=dynamic_cast<NetworkSocketPosix*>(socket);
 	if(sp)
-		return sp->fd;
+		return sp->GetPollDescriptor();
 	NetworkSocketWrapper* sw=dynamic_cast<NetworkSocketWrapper*>(socket);
 	if(sw)
 		return GetDescriptorFromSocket(sw->GetWrapped());
 	return 0;
 }
+
+#ifdef __linux__
+
+#pragma mark - epoll poller
+
+NetworkSocketPollerEpoll::NetworkSocketPollerEpoll(SocketSelectCanceller* _canceller){
+	canceller=dynamic_cast<SocketSelectCancellerPosix*>(_canceller);
+	epfd=epoll_create1(EPOLL_CLOEXEC);
+	if(epfd<0){
+		LOGE("epoll_create1 failed: %d / %s", errno, strerror(errno));
+		return;
+	}
+	if(canceller){
+		epoll_event ev={};
+		ev.events=EPOLLIN;
+		ev.data.ptr=NULL;
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, canceller->pipeRead, &ev)<0){
+			LOGE("error adding canceller to epoll: %d / %s", errno, strerror(errno));
+			close(epfd);
+			epfd=-1;
+		}
+	}
+}
+
+NetworkSocketPollerEpoll::~NetworkSocketPollerEpoll(){
+	if(epfd>=0)
+		close(epfd);
+}
+
+void NetworkSocketPollerEpoll::AddSocket(NetworkSocket* socket, int flags){
+	int fd=NetworkSocketPosix::GetDescriptorFromSocket(socket);
+	if(fd<=0){
+		LOGW("can't poll on a socket because it's not a NetworkSocketPosix instance or isn't open");
+		return;
+	}
+	Registration* reg=NULL;
+	for(std::unique_ptr<Registration>& r:registrations){
+		if(r->fd==fd){
+			reg=r.get();
+			break;
+		}
+	}
+	bool isNew=reg==NULL;
+	if(isNew){
+		registrations.push_back(std::unique_ptr<Registration>(new Registration{fd, NULL, NULL, false, false}));
+		reg=registrations.back().get();
+	}
+	if(flags & POLL_READ)
+		reg->readSocket=socket;
+	if(flags & POLL_WRITE_AND_ERROR){
+		reg->writeSocket=socket;
+		reg->isProxy=dynamic_cast<NetworkSocketSOCKS5Proxy*>(socket)!=NULL;
+		reg->wantWrite=NeedsWriteReadiness(socket, reg->isProxy);
+	}
+	epoll_event ev={};
+	ev.events=EPOLLIN | (reg->wantWrite ? (uint32_t)EPOLLOUT : 0);
+	ev.data.ptr=reg;
+	if(epoll_ctl(epfd, isNew ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev)<0){
+		LOGE("error adding socket %d to epoll: %d / %s", fd, errno, strerror(errno));
+	}
+	events.resize(registrations.size()+1);
+}
+
+void NetworkSocketPollerEpoll::RemoveAllSockets(){
+	for(std::unique_ptr<Registration>& r:registrations){
+		// the descriptor is already gone from the epoll set if the socket was closed
+		epoll_ctl(epfd, EPOLL_CTL_DEL, r->fd, NULL);
+	}
+	registrations.clear();
+}
+
+void NetworkSocketPollerEpoll::UpdateEvents(Registration& r){
+	epoll_event ev={};
+	ev.events=EPOLLIN | (r.wantWrite ? (uint32_t)EPOLLOUT : 0);
+	ev.data.ptr=&r;
+	if(epoll_ctl(epfd, EPOLL_CTL_MOD, r.fd, &ev)<0){
+		LOGW("error updating epoll events for socket %d: %d / %s", r.fd, errno, strerror(errno));
+	}
+}
+
+bool NetworkSocketPollerEpoll::Poll(std::vector<NetworkSocket*>& readFds, std::vector<NetworkSocket*>& writeFds, std::vector<NetworkSocket*>& errorFds){
+	readFds.clear();
+	writeFds.clear();
+	errorFds.clear();
+
+	// No syscalls here unless a socket's write interest actually changed
+	bool anyFailed=false;
+	double now=VoIPController::GetCurrentTime();
+	for(std::unique_ptr<Registration>& r:registrations){
+		NetworkSocket* s=r->writeSocket;
+		if(!s)
+			continue;
+		if(s->timeout>0 && now-s->lastSuccessfulOperationTime>s->timeout){
+			LOGW("Socket %d timed out", r->fd);
+			s->failed=true;
+		}
+		if(s->IsFailed()){
+			anyFailed=true;
+			errorFds.push_back(s);
+			continue;
+		}
+		bool wantWrite=NeedsWriteReadiness(s, r->isProxy);
+		if(wantWrite!=r->wantWrite){
+			r->wantWrite=wantWrite;
+			UpdateEvents(*r);
+		}
+	}
+	if(anyFailed)
+		return true;
+
+	if(events.size()<registrations.size()+1)
+		events.resize(registrations.size()+1);
+	int count=epoll_wait(epfd, events.data(), (int)events.size(), -1);
+	if(count<0){
+		if(errno!=EINTR)
+			LOGE("epoll_wait failed: %d / %s", errno, strerror(errno));
+		return false;
+	}
+
+	for(int i=0;i<count;i++){
+		if(!events[i].data.ptr){
+			canceller->Acknowledge();
+			return false;
+		}
+	}
+
+	now=VoIPController::GetCurrentTime();
+	for(int i=0;i<count;i++){
+		Registration* r=reinterpret_cast<Registration*>(events[i].data.ptr);
+		uint32_t ev=events[i].events;
+		// like with select(), errors and hangups are reported as readability so that the next receive sees them
+		if((ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) && r->readSocket){
+			r->readSocket->lastSuccessfulOperationTime=now;
+			if(r->readSocket->OnReadyToReceive())
+				readFds.push_back(r->readSocket);
+		}
+		if((ev & EPOLLOUT) && r->writeSocket && r->wantWrite){
+			LOGV("Socket %d is ready to send", r->fd);
+			r->writeSocket->lastSuccessfulOperationTime=now;
+			if(r->writeSocket->OnReadyToSend())
+				writeFds.push_back(r->writeSocket);
+		}
+	}
+	return readFds.size()>0 || errorFds.size()>0 || writeFds.size()>0;
+}
+
+#endif
@@ -11,27 +11,37 @@
 #include "../../Buffers.h"
 #include <vector>
 #include <sys/select.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #include <pthread.h>
 
 namespace tgvoip {
 
 class SocketSelectCancellerPosix : public SocketSelectCanceller{
 friend class NetworkSocketPosix;
+friend class NetworkSocketPollerEpoll;
 public:
 	SocketSelectCancellerPosix();
 	virtual ~SocketSelectCancellerPosix();
 	virtual void CancelSelect();
 private:
+	void Acknowledge();
+	// on Linux, these are the same eventfd
 	int pipeRead;
 	int pipeWrite;
 };
 
 class NetworkSocketPosix : public NetworkSocket{
+friend class NetworkSocketPollerEpoll;
 public:
 	NetworkSocketPosix(NetworkProtocol protocol);
 	virtual ~NetworkSocketPosix();
 	virtual void Send(NetworkPacket packet) override;
+	virtual void SendBatch(std::vector<NetworkPacket>& packets) override;
 	virtual NetworkPacket Receive(size_t maxLen) override;
+	virtual size_t ReceiveBatch(std::vector<NetworkPacket>& packets, size_t maxCount) override;
 	virtual void Open() override;
 	virtual void Close() override;
 	virtual void Connect(const NetworkAddress address, uint16_t port) override;
@@ -55,20 +65,65 @@ public:
 
 protected:
 	virtual void SetMaxPriority() override;
+	/**
+	 * The descriptor to select/poll on to find out whether this socket has something to receive
+	 */
+	virtual int GetPollDescriptor(){
+		return fd;
+	}
+	NetworkAddress AddressFromSockaddr(const sockaddr_in6& srcAddr);
+	void SockaddrFromAddress(const NetworkAddress& address, uint16_t port, sockaddr_in6& addr);
+	std::atomic<int> fd;
 
 private:
 	static int GetDescriptorFromSocket(NetworkSocket* socket);
-	std::atomic<int> fd;
+	Buffer TakeReceivedData(Buffer& buffer, size_t len);
+	size_t SendBatchInternal(NetworkPacket* packets, size_t count);
 	bool needUpdateNat64Prefix;
 	bool nat64Present;
 	double switchToV6at;
 	bool isV4Available;
+	bool gsoAvailable=false;
 	std::atomic<bool> closing;
 	NetworkAddress tcpConnectedAddress=NetworkAddress::Empty();
 	uint16_t tcpConnectedPort;
     NetworkPacket pendingOutgoingPacket=NetworkPacket::Empty();
-    Buffer recvBuffer=Buffer(2048);
+    Buffer recvBuffer;
+	Buffer recvBatchBuffers[MAX_RECV_BATCH_SIZE];
+};
+
+#ifdef __linux__
+/**
+ * Poller that keeps sockets registered with epoll between calls instead of rebuilding fd_sets every time
+ */
+class NetworkSocketPollerEpoll : public NetworkSocketPoller{
+public:
+	NetworkSocketPollerEpoll(SocketSelectCanceller* canceller);
+	virtual ~NetworkSocketPollerEpoll();
+	virtual void AddSocket(NetworkSocket* socket, int flags) override;
+	virtual void RemoveAllSockets() override;
+	virtual bool Poll(std::vector<NetworkSocket*>& readFds, std::vector<NetworkSocket*>& writeFds, std::vector<NetworkSocket*>& errorFds) override;
+	bool IsFailed(){
+		return epfd<0;
+	}
+
+private:
+	// One per file descriptor. A SOCKS5 UDP proxy and the UDP socket it wraps share the descriptor,
+	// the former is used for reading and the latter for writing and error reporting.
+	struct Registration{
+		int fd;
+		NetworkSocket* readSocket;
+		NetworkSocket* writeSocket;
+		bool isProxy;
+		bool wantWrite;
+	};
+	void UpdateEvents(Registration& r);
+	int epfd;
+	SocketSelectCancellerPosix* canceller;
+	std::vector<std::unique_ptr<Registration>> registrations;
+	std::vector<epoll_event> events;
 };
+#endif
 
 }
 
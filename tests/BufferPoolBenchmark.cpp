@@ -0,0 +1,147 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+// Compares BufferPool against the previous mutex-and-bitset implementation.
+// Usage: BufferPoolBenchmark [iterations]
+// "same thread" gets and releases on one thread, like an encoder reusing its frame buffers;
+// "contended" runs the same loop on 4 threads sharing one pool;
+// "handoff" gets on one thread and releases on another, like the receive thread passing packets to the message thread.
+
+#include "../Buffers.h"
+#include "../BlockingQueue.h"
+#include <bitset>
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using namespace tgvoip;
+
+namespace{
+
+template <size_t bufSize, size_t bufCount> class LegacyBufferPool{
+public:
+	TGVOIP_DISALLOW_COPY_AND_ASSIGN(LegacyBufferPool);
+	LegacyBufferPool(){
+		bufferStart=(unsigned char*)malloc(bufSize*bufCount);
+	};
+	~LegacyBufferPool(){
+		free(bufferStart);
+	};
+	Buffer Get(){
+		auto freeFn=[this](void* _buf){
+			unsigned char* buf=(unsigned char*)_buf;
+			size_t index=(buf-bufferStart)/bufSize;
+			MutexGuard m(mutex);
+			usedBuffers[index]=0;
+		};
+		auto resizeFn=[](void* buf, size_t newSize)->void*{
+			if(newSize>bufSize)
+				throw std::invalid_argument("newSize>bufferSize");
+			return buf;
+		};
+		MutexGuard m(mutex);
+		for(size_t i=0;i<bufCount;i++){
+			if(!usedBuffers[i]){
+				usedBuffers[i]=1;
+				return Buffer::Wrap(bufferStart+(bufSize*i), bufSize, freeFn, resizeFn);
+			}
+		}
+		throw std::bad_alloc();
+	}
+
+private:
+	std::bitset<bufCount> usedBuffers;
+	unsigned char* bufferStart;
+	Mutex mutex;
+};
+
+double Now(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<class Pool> double SameThread(Pool& pool, int iterations){
+	double start=Now();
+	for(int i=0;i<iterations;i++){
+		// hold a few at once so the legacy pool has to scan past the used ones
+		Buffer a=pool.Get();
+		Buffer b=pool.Get();
+		Buffer c=pool.Get();
+		**a=**b=**c=(unsigned char)i;
+	}
+	return (Now()-start)*1000000000.0/(iterations*3);
+}
+
+template<class Pool> double Contended(Pool& pool, int iterations){
+	std::vector<std::thread> threads;
+	double start=Now();
+	for(int i=0;i<4;i++){
+		threads.emplace_back([&]{
+			SameThread(pool, iterations/4);
+		});
+	}
+	for(std::thread& t:threads){
+		t.join();
+	}
+	return (Now()-start)*1000000000.0/((iterations/4)*4*3);
+}
+
+template<class Pool> double Handoff(Pool& pool, int iterations){
+	BlockingQueue<Buffer> queue(64);
+	double start=Now();
+	std::thread consumer([&]{
+		while(true){
+			Buffer buf=queue.GetBlocking();
+			if(buf.IsEmpty())
+				break;
+		}
+	});
+	for(int i=0;i<iterations;i++){
+		Buffer buf;
+		while(true){
+			try{
+				buf=pool.Get();
+				break;
+			}catch(std::bad_alloc& x){
+				std::this_thread::yield();
+			}
+		}
+		// keep the queue from overflowing, it has no overflow callback
+		while(queue.Size()>=60)
+			std::this_thread::yield();
+		queue.Put(std::move(buf));
+	}
+	queue.Put(Buffer());
+	consumer.join();
+	return (Now()-start)*1000000000.0/iterations;
+}
+
+}
+
+int main(int argc, char** argv){
+	int iterations=argc>1 ? atoi(argv[1]) : 1000000;
+
+	LegacyBufferPool<1024, 32> legacy;
+	BufferPool<1024, 32> pool;
+	// pools with thread caches must outlive every thread that used them
+	BufferPool<1024, 32, 8>& cachedPool=*new BufferPool<1024, 32, 8>();
+
+	printf("same thread, ns per buffer:\n");
+	printf("  legacy:       %.1f\n", SameThread(legacy, iterations));
+	printf("  lock-free:    %.1f\n", SameThread(pool, iterations));
+	printf("  thread cache: %.1f\n", SameThread(cachedPool, iterations));
+	printf("contended, ns per buffer:\n");
+	printf("  legacy:       %.1f\n", Contended(legacy, iterations));
+	printf("  lock-free:    %.1f\n", Contended(pool, iterations));
+	printf("  thread cache: %.1f\n", Contended(cachedPool, iterations));
+	printf("handoff, ns per buffer:\n");
+	printf("  legacy:       %.1f\n", Handoff(legacy, iterations));
+	printf("  lock-free:    %.1f\n", Handoff(pool, iterations));
+	printf("  thread cache: %.1f\n", Handoff(cachedPool, iterations));
+	return 0;
+}
@@ -0,0 +1,189 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+// Runs a two-party call through MockReflector over an impaired link on a simulated clock, faster than real time,
+// and reports how it went. Useful as a benchmark and to catch regressions in the timing-sensitive parts.
+// Usage: CallSimulation [-speed x] [-duration s] [-loss %] [-delay ms] [-jitter ms] [-seed n] [-s key=value ...] [-v]
+// -speed is how many times faster than real time the call runs (10 by default), -duration is in simulated seconds.
+// -s overrides a server config value, -v prints the debug logs of both sides at the end.
+// The library has to be built with callback audio I/O (--enable-audio-callback).
+//
+// Scheduling across the library's threads still depends on the OS, so runs aren't bit-exact,
+// but with the same parameters the numbers should stay within noise of each other.
+
+#include "MockReflector.h"
+#include "../VoIPController.h"
+#include "../VoIPServerConfig.h"
+#include "../Clock.h"
+#include <openssl/rand.h>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+using namespace tgvoip;
+using namespace tgvoip::test;
+
+#define REFLECTOR_PORT 31338
+
+namespace{
+
+struct Side{
+	VoIPController* controller=NULL;
+	std::atomic<unsigned int> phase{0};
+	std::atomic<size_t> framesPlayed{0};
+	std::atomic<size_t> silentFrames{0};
+};
+
+// a tone that's on for a second and off for a second, like someone talking
+void GenerateInput(Side& side, int16_t* data, size_t len){
+	unsigned int phase=side.phase;
+	for(size_t i=0;i<len;i++){
+		bool on=((phase+i)/48000)%2==0;
+		data[i]=on ? (int16_t)(8000.0*sin(2.0*M_PI*220.0*(phase+i)/48000.0)) : 0;
+	}
+	side.phase=phase+(unsigned int)len;
+}
+
+void HandleOutput(Side& side, int16_t* data, size_t len){
+	if(side.controller->GetConnectionState()!=STATE_ESTABLISHED)
+		return;
+	int16_t peak=0;
+	for(size_t i=0;i<len;i++)
+		peak=std::max(peak, (int16_t)abs(data[i]));
+	side.framesPlayed++;
+	if(peak<100)
+		side.silentFrames++;
+}
+
+}
+
+int main(int argc, char** argv){
+	double speed=10.0;
+	double duration=30.0;
+	double loss=0.0, delay=0.0, jitter=0.0;
+	uint32_t seed=0;
+	bool verbose=false;
+	std::string config="{";
+	for(int i=1;i<argc;i++){
+		if(!strcmp(argv[i], "-speed") && i+1<argc){
+			speed=atof(argv[++i]);
+		}else if(!strcmp(argv[i], "-duration") && i+1<argc){
+			duration=atof(argv[++i]);
+		}else if(!strcmp(argv[i], "-loss") && i+1<argc){
+			loss=atof(argv[++i])/100.0;
+		}else if(!strcmp(argv[i], "-delay") && i+1<argc){
+			delay=atof(argv[++i])/1000.0;
+		}else if(!strcmp(argv[i], "-jitter") && i+1<argc){
+			jitter=atof(argv[++i])/1000.0;
+		}else if(!strcmp(argv[i], "-seed") && i+1<argc){
+			seed=(uint32_t)atoi(argv[++i]);
+		}else if(!strcmp(argv[i], "-s") && i+1<argc){
+			std::string kv=argv[++i];
+			size_t eq=kv.find('=');
+			if(eq==std::string::npos){
+				fprintf(stderr, "-s needs key=value\n");
+				return 1;
+			}
+			if(config.length()>1)
+				config+=",";
+			config+="\""+kv.substr(0, eq)+"\":"+kv.substr(eq+1);
+		}else if(!strcmp(argv[i], "-v")){
+			verbose=true;
+		}else{
+			fprintf(stderr, "Usage: %s [-speed x] [-duration s] [-loss %%] [-delay ms] [-jitter ms] [-seed n] [-s key=value ...] [-v]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(speed<=0.0){
+		fprintf(stderr, "-speed must be positive\n");
+		return 1;
+	}
+	config+="}";
+	ServerConfig::GetSharedInstance()->Update(config);
+
+	SimulatedClock clock(speed);
+	Clock::SetCurrent(&clock);
+	srand(seed);
+
+	MockReflector reflector("127.0.0.1", REFLECTOR_PORT);
+	reflector.SetLinkConditions(loss, delay, jitter, seed);
+	reflector.Start();
+
+	std::array<std::array<uint8_t, 16>, 2> peerTags=MockReflector::GeneratePeerTags();
+	char encryptionKey[256];
+	RAND_bytes((uint8_t*)encryptionKey, sizeof(encryptionKey));
+	Side sides[2];
+	for(int i=0;i<2;i++){
+		Side& side=sides[i];
+		side.controller=new VoIPController();
+		std::vector<Endpoint> endpoints;
+		endpoints.push_back(Endpoint(1, REFLECTOR_PORT, NetworkAddress::IPv4("127.0.0.1"), NetworkAddress::Empty(), Endpoint::Type::UDP_RELAY, peerTags[i].data()));
+		// with older layers, one side can switch to the short packet format before the other one can read it
+		side.controller->SetRemoteEndpoints(endpoints, false, 92);
+		side.controller->SetEncryptionKey(encryptionKey, i==0);
+		VoIPController::Config cfg;
+		cfg.enableNS=cfg.enableAEC=cfg.enableAGC=false;
+		cfg.enableCallUpgrade=false;
+		side.controller->SetConfig(cfg);
+		side.controller->SetAudioDataCallbacks([&side](int16_t* data, size_t len){
+			GenerateInput(side, data, len);
+		}, [&side](int16_t* data, size_t len){
+			HandleOutput(side, data, len);
+		});
+	}
+
+	std::chrono::steady_clock::time_point realStart=std::chrono::steady_clock::now();
+	double startTime=clock.GetTime();
+	for(Side& side:sides){
+		side.controller->Start();
+		side.controller->Connect();
+	}
+	double establishedAt=0.0;
+	while(clock.GetTime()-startTime<duration){
+		if(establishedAt==0.0 && sides[0].controller->GetConnectionState()==STATE_ESTABLISHED && sides[1].controller->GetConnectionState()==STATE_ESTABLISHED)
+			establishedAt=clock.GetTime()-startTime;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	double realElapsed=std::chrono::duration<double>(std::chrono::steady_clock::now()-realStart).count();
+	double simElapsed=clock.GetTime()-startTime;
+
+	std::string debugLogs[2];
+	int states[2];
+	VoIPController::TrafficStats stats[2];
+	for(int i=0;i<2;i++){
+		VoIPController* controller=sides[i].controller;
+		states[i]=controller->GetConnectionState();
+		controller->GetStats(&stats[i]);
+		if(verbose)
+			debugLogs[i]=controller->GetDebugLog();
+		controller->Stop();
+		delete controller;
+	}
+	reflector.Stop();
+	Clock::SetCurrent(NULL);
+
+	// the library logs to stdout too, so the results go after all of that
+	printf("\nsimulated %.1f s in %.1f s of real time (%.1fx), link: %.1f%% loss, %.0f ms delay, %.0f ms jitter\n", simElapsed, realElapsed, simElapsed/realElapsed,
+		   loss*100.0, delay*1000.0, jitter*1000.0);
+	if(establishedAt>0.0)
+		printf("established after %.2f s\n", establishedAt);
+	else
+		printf("never established\n");
+	for(int i=0;i<2;i++){
+		if(verbose)
+			printf("side %d debug log: %s\n", i, debugLogs[i].c_str());
+		size_t frames=sides[i].framesPlayed;
+		printf("side %d: state %d, sent %u bytes, received %u bytes, played %u frames, %.1f%% of them silent (half the input is silence)\n", i, states[i],
+			   (unsigned int)(stats[i].bytesSentWifi+stats[i].bytesSentMobile), (unsigned int)(stats[i].bytesRecvdWifi+stats[i].bytesRecvdMobile),
+			   (unsigned int)frames, frames ? 100.0*sides[i].silentFrames/frames : 0.0);
+	}
+	return establishedAt>0.0 ? 0 : 1;
+}
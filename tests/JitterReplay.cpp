@@ -0,0 +1,236 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+// Replays recorded packet arrival traces through JitterBuffer on a virtual clock, the way OpusDecoder and
+// VoIPController drive it during a call, and reports what the listener would get.
+// Usage: JitterReplay [-s key=value ...] [-step ms] trace...
+// -s overrides a server config value (e.g. -s jitter_min_delay_60=3), -step sets the frame duration if it can't be
+// guessed from the timestamps. tests/jitter_traces has a few traces to start with.
+//
+// A trace has one packet per line: the packet's timestamp in ms and its arrival time in seconds, separated by whitespace.
+// Lines that don't start with a digit are skipped, so the files written with TGVOIP_DUMP_JITTER_STATS can be replayed as is.
+//
+// Playout delay is counted from the packet's timestamp, relative to the fastest packet in the trace, so it includes
+// the network jitter as well as the time spent in the jitter buffer. Late loss is the share of the packets that arrived
+// but were never played; concealment is the share of the played frames that had to be made up by the decoder.
+
+#include "../Clock.h"
+#include "../JitterBuffer.h"
+#include "../VoIPServerConfig.h"
+#include <algorithm>
+#include <math.h>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace tgvoip;
+
+namespace{
+
+struct TracePacket{
+	uint32_t timestamp;
+	double arrivalTime;
+};
+
+struct ReplayResult{
+	size_t packets=0;
+	size_t frames=0;
+	size_t concealedFrames=0;
+	size_t fecFrames=0;
+	size_t lateLost=0;
+	double meanDelay=0;
+	double p99Delay=0;
+	double maxDelay=0;
+};
+
+bool LoadTrace(const char* path, std::vector<TracePacket>& packets){
+	FILE* f=fopen(path, "r");
+	if(!f){
+		fprintf(stderr, "Can't open %s\n", path);
+		return false;
+	}
+	char line[256];
+	while(fgets(line, sizeof(line), f)){
+		if(line[0]<'0' || line[0]>'9')
+			continue;
+		unsigned int timestamp;
+		double arrivalTime;
+		if(sscanf(line, "%u %lf", &timestamp, &arrivalTime)==2)
+			packets.push_back(TracePacket{timestamp, arrivalTime});
+	}
+	fclose(f);
+	std::stable_sort(packets.begin(), packets.end(), [](const TracePacket& a, const TracePacket& b){
+		return a.arrivalTime<b.arrivalTime;
+	});
+	return !packets.empty();
+}
+
+uint32_t GuessFrameDuration(const std::vector<TracePacket>& packets){
+	std::vector<uint32_t> timestamps;
+	for(const TracePacket& p:packets)
+		timestamps.push_back(p.timestamp);
+	std::sort(timestamps.begin(), timestamps.end());
+	uint32_t step=0;
+	for(size_t i=1;i<timestamps.size();i++){
+		uint32_t diff=timestamps[i]-timestamps[i-1];
+		if(diff>0 && (step==0 || diff<step))
+			step=diff;
+	}
+	return step;
+}
+
+ReplayResult Replay(const std::vector<TracePacket>& packets, uint32_t step){
+	double now=packets[0].arrivalTime;
+	SimulatedClock clock(0.0, now);
+	Clock::SetCurrent(&clock);
+	JitterBuffer jitterBuffer(NULL, step);
+
+	// the smallest one-way delay in the trace, up to a constant offset
+	double baseDelay=INFINITY;
+	std::set<uint32_t> arrived;
+	uint32_t lastTimestamp=0;
+	for(const TracePacket& p:packets){
+		baseDelay=std::min(baseDelay, p.arrivalTime-p.timestamp/1000.0);
+		arrived.insert(p.timestamp);
+		lastTimestamp=std::max(lastTimestamp, p.timestamp);
+	}
+
+	ReplayResult result;
+	result.packets=arrived.size();
+	std::set<uint32_t> played;
+	std::vector<double> delays;
+	size_t nextPacket=0;
+	double nextOutputTime=now;
+	double nextTickTime=now;
+	// the timestamp the playout is at: the last one played, plus a step for each concealed frame after it
+	int64_t playoutTimestamp=-1;
+	// only a safety net in case nothing ever comes out of the jitter buffer
+	double endTime=packets.back().arrivalTime+2.0;
+	unsigned char buffer[JITTER_SLOT_SIZE];
+	while(now<endTime){
+		double next=std::min(nextOutputTime, nextTickTime);
+		if(nextPacket<packets.size())
+			next=std::min(next, packets[nextPacket].arrivalTime);
+		clock.Advance(next-now);
+		now=next;
+
+		if(nextPacket<packets.size() && packets[nextPacket].arrivalTime<=now){
+			uint32_t timestamp=packets[nextPacket].timestamp;
+			jitterBuffer.HandleInput(reinterpret_cast<unsigned char*>(&timestamp), sizeof(timestamp), timestamp, false);
+			nextPacket++;
+			continue;
+		}
+		if(nextTickTime<=now){
+			// VoIPController ticks it every 100 ms
+			jitterBuffer.Tick();
+			nextTickTime+=0.1;
+			continue;
+		}
+
+		// same as OpusDecoder::DecodeNextFrame(): if the packet isn't there, try the next one for FEC
+		int playbackDuration=0;
+		bool isEC=false;
+		size_t len=jitterBuffer.HandleOutput(buffer, sizeof(buffer), 0, true, playbackDuration, isEC);
+		bool fec=false;
+		if(!len){
+			fec=true;
+			len=jitterBuffer.HandleOutput(buffer, sizeof(buffer), 0, false, playbackDuration, isEC);
+		}
+		// nothing is played until the first packet comes out; that initial silence isn't concealment
+		if(len || !delays.empty())
+			result.frames++;
+		if(len==sizeof(uint32_t)){
+			uint32_t timestamp;
+			memcpy(&timestamp, buffer, sizeof(timestamp));
+			played.insert(timestamp);
+			delays.push_back((now-timestamp/1000.0-baseDelay)*1000.0);
+			if(fec)
+				result.fecFrames++;
+			playoutTimestamp=timestamp;
+		}else if(!delays.empty()){
+			result.concealedFrames++;
+			playoutTimestamp+=step;
+		}
+		// the stream is over once its last timestamp has been played or given up on
+		if(nextPacket==packets.size() && playoutTimestamp>=(int64_t)lastTimestamp)
+			break;
+		// the decoder asks for the next frame when it runs out of samples from this one
+		nextOutputTime=now+playbackDuration/1000.0;
+	}
+
+	Clock::SetCurrent(NULL);
+	for(uint32_t timestamp:arrived){
+		if(!played.count(timestamp))
+			result.lateLost++;
+	}
+	if(!delays.empty()){
+		double sum=0;
+		for(double d:delays)
+			sum+=d;
+		result.meanDelay=sum/delays.size();
+		std::sort(delays.begin(), delays.end());
+		result.p99Delay=delays[std::min(delays.size()-1, (size_t)(delays.size()*0.99))];
+		result.maxDelay=delays.back();
+	}
+	return result;
+}
+
+}
+
+int main(int argc, char** argv){
+	std::string config="{";
+	uint32_t step=0;
+	std::vector<const char*> traces;
+	for(int i=1;i<argc;i++){
+		if(!strcmp(argv[i], "-s") && i+1<argc){
+			std::string kv=argv[++i];
+			size_t eq=kv.find('=');
+			if(eq==std::string::npos){
+				fprintf(stderr, "-s needs key=value\n");
+				return 1;
+			}
+			if(config.length()>1)
+				config+=",";
+			config+="\""+kv.substr(0, eq)+"\":"+kv.substr(eq+1);
+		}else if(!strcmp(argv[i], "-step") && i+1<argc){
+			step=(uint32_t)atoi(argv[++i]);
+		}else{
+			traces.push_back(argv[i]);
+		}
+	}
+	if(traces.empty()){
+		fprintf(stderr, "Usage: %s [-s key=value ...] [-step ms] trace...\n", argv[0]);
+		return 1;
+	}
+	config+="}";
+	ServerConfig::GetSharedInstance()->Update(config);
+
+	std::vector<std::pair<std::string, ReplayResult>> results;
+	for(const char* path:traces){
+		std::vector<TracePacket> packets;
+		if(!LoadTrace(path, packets))
+			continue;
+		uint32_t traceStep=step ? step : GuessFrameDuration(packets);
+		if(!traceStep){
+			fprintf(stderr, "Can't guess the frame duration of %s, use -step\n", path);
+			continue;
+		}
+		const char* name=strrchr(path, '/');
+		results.push_back(std::make_pair(std::string(name ? name+1 : path), Replay(packets, traceStep)));
+	}
+
+	// the library logs to stdout too, so the results go after all of that
+	printf("\n%-24s %7s %7s %9s %9s %9s %8s %8s %8s\n", "trace", "packets", "frames", "mean, ms", "p99, ms", "max, ms", "late, %", "PLC, %", "FEC, %");
+	for(std::pair<std::string, ReplayResult>& res:results){
+		ReplayResult& r=res.second;
+		printf("%-24s %7u %7u %9.1f %9.1f %9.1f %8.2f %8.2f %8.2f\n", res.first.c_str(), (unsigned int)r.packets, (unsigned int)r.frames, r.meanDelay, r.p99Delay, r.maxDelay,
+			   100.0*r.lateLost/r.packets, 100.0*r.concealedFrames/r.frames, 100.0*r.fecFrames/r.frames);
+	}
+	return 0;
+}
@@ -5,9 +5,13 @@
 //
 
 #include "MockReflector.h"
+#include "../VoIPController.h"
+#include "../Clock.h"
+#include <algorithm>
 #include <arpa/inet.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 using namespace tgvoip;
 using namespace tgvoip::test;
@@ -34,10 +38,11 @@ MockReflector::MockReflector(std::string bindAddress, uint16_t bindPort){
 	inet_aton(bindAddress.c_str(), &bindAddr.sin_addr);
 	int res=bind(sfd, (struct sockaddr*)&bindAddr, sizeof(bindAddr));
 	assert(res==0);
+	pthread_mutex_init(&delayMutex, NULL);
 }
 
 MockReflector::~MockReflector(){
-	
+	pthread_mutex_destroy(&delayMutex);
 }
 
 std::array<std::array<uint8_t, 16>, 2> MockReflector::GeneratePeerTags(){
@@ -61,10 +66,15 @@ void MockReflector::Start(){
 		reinterpret_cast<MockReflector*>(arg)->RunThread();
 		return NULL;
 	}, this);
+	pthread_create(&delayThread, NULL, [](void* arg) -> void* {
+		reinterpret_cast<MockReflector*>(arg)->RunDelayThread();
+		return NULL;
+	}, this);
 }
 
 void MockReflector::Stop(){
 	running=false;
+	pthread_join(delayThread, NULL);
 	shutdown(sfd, SHUT_RDWR);
 	close(sfd);
 	pthread_join(thread, NULL);
@@ -74,6 +84,48 @@ void MockReflector::SetDropAllPackets(bool drop){
 	dropAllPackets=drop;
 }
 
+void MockReflector::SetLinkConditions(double lossRate, double delay, double jitter, uint32_t seed){
+	pthread_mutex_lock(&delayMutex);
+	this->lossRate=lossRate;
+	this->delay=delay;
+	this->jitter=jitter;
+	random.seed(seed);
+	pthread_mutex_unlock(&delayMutex);
+}
+
+void MockReflector::Relay(const uint8_t* data, size_t len, const sockaddr_in& dest){
+	pthread_mutex_lock(&delayMutex);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	if(lossRate>0.0 && uniform(random)<lossRate){
+		pthread_mutex_unlock(&delayMutex);
+		return;
+	}
+	if(delay==0.0 && jitter==0.0){
+		pthread_mutex_unlock(&delayMutex);
+		sendto(sfd, data, len, 0, (struct sockaddr*)&dest, sizeof(sockaddr_in));
+		return;
+	}
+	double sendAt=VoIPController::GetCurrentTime()+delay+jitter*uniform(random);
+	delayedPackets.insert(std::make_pair(sendAt, DelayedPacket{std::vector<uint8_t>(data, data+len), dest}));
+	pthread_mutex_unlock(&delayMutex);
+}
+
+void MockReflector::RunDelayThread(){
+	while(running){
+		pthread_mutex_lock(&delayMutex);
+		double now=VoIPController::GetCurrentTime();
+		while(!delayedPackets.empty() && delayedPackets.begin()->first<=now){
+			DelayedPacket& pkt=delayedPackets.begin()->second;
+			sendto(sfd, pkt.data.data(), pkt.data.size(), 0, (struct sockaddr*)&pkt.dest, sizeof(sockaddr_in));
+			delayedPackets.erase(delayedPackets.begin());
+		}
+		// wake up at least every simulated millisecond to pick up the packets queued meanwhile
+		double wait=delayedPackets.empty() ? 0.001 : std::min(0.001, delayedPackets.begin()->first-now);
+		pthread_mutex_unlock(&delayMutex);
+		usleep((useconds_t)(Clock::ToRealDuration(wait)*1000000.0)+1);
+	}
+}
+
 void MockReflector::RunThread(){
 	while(running){
 		std::array<uint8_t, 1500> buf;
@@ -122,7 +174,7 @@ void MockReflector::RunThread(){
 				else
 					buf[15] |= 1;
 				
-				sendto(sfd, buf.data(), len, 0, (struct sockaddr*)dest, sizeof(sockaddr_in));
+				Relay(buf.data(), (size_t)len, *dest);
 			}
 		}
 	}
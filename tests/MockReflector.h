@@ -9,6 +9,9 @@
 #include <string>
 #include <unordered_map>
 #include <array>
+#include <map>
+#include <random>
+#include <vector>
 #include <stdint.h>
 #include <pthread.h>
 
@@ -30,10 +33,25 @@ namespace tgvoip{
 			void Start();
 			void Stop();
 			void SetDropAllPackets(bool drop);
+			/**
+			 * Makes the relayed packets go through a lossy link with a delay, in both directions.
+			 * Delays are measured by VoIPController::GetCurrentTime(), so they follow a simulated clock if there's one.
+			 * @param lossRate probability of dropping each packet, 0..1
+			 * @param delay one-way delay in seconds
+			 * @param jitter extra delay in seconds, random between 0 and this value; packets may get reordered
+			 * @param seed seed for the random number generator, to make runs repeatable
+			 */
+			void SetLinkConditions(double lossRate, double delay, double jitter, uint32_t seed=0);
 			static std::array<std::array<uint8_t, 16>, 2> GeneratePeerTags();
 			
 		private:
 			void RunThread();
+			void RunDelayThread();
+			void Relay(const uint8_t* data, size_t len, const sockaddr_in& dest);
+			struct DelayedPacket{
+				std::vector<uint8_t> data;
+				sockaddr_in dest;
+			};
 			struct ClientPair{
 				sockaddr_in addr0={0};
 				sockaddr_in addr1={0};
@@ -43,6 +61,14 @@ namespace tgvoip{
 			pthread_t thread;
 			bool running=false;
 			bool dropAllPackets=false;
+
+			double lossRate=0.0;
+			double delay=0.0;
+			double jitter=0.0;
+			std::mt19937 random;
+			std::multimap<double, DelayedPacket> delayedPackets; // by the time to send them at
+			pthread_mutex_t delayMutex;
+			pthread_t delayThread;
 		};
 	}
 }
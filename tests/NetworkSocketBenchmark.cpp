@@ -0,0 +1,116 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+// Pushes UDP packets between two sockets through MockReflector on loopback and reports
+// the throughput and CPU time of the sending and receiving threads.
+// Usage: NetworkSocketBenchmark [seconds] [packet size]
+// Run it once with the default config and once with {"use_io_uring":false} in TGVOIP_BENCH_CONFIG to compare backends.
+
+#include "MockReflector.h"
+#include "../NetworkSocket.h"
+#include "../VoIPServerConfig.h"
+#include "../VoIPController.h"
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+using namespace tgvoip;
+using namespace tgvoip::test;
+
+#define REFLECTOR_PORT 31337
+
+static double ThreadCpuTime(){
+	rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	return usage.ru_utime.tv_sec+usage.ru_utime.tv_usec/1000000.0+usage.ru_stime.tv_sec+usage.ru_stime.tv_usec/1000000.0;
+}
+
+static Buffer MakePacket(const std::array<uint8_t, 16>& peerTag, size_t size){
+	Buffer buf(size);
+	memset(*buf, 0xAA, size);
+	buf.CopyFrom(peerTag.data(), 0, 16);
+	return buf;
+}
+
+int main(int argc, char** argv){
+	double duration=argc>1 ? atof(argv[1]) : 5.0;
+	size_t packetSize=argc>2 ? (size_t)atoi(argv[2]) : 200;
+	if(packetSize<32)
+		packetSize=32;
+	if(getenv("TGVOIP_BENCH_CONFIG"))
+		ServerConfig::GetSharedInstance()->Update(getenv("TGVOIP_BENCH_CONFIG"));
+
+	MockReflector reflector("127.0.0.1", REFLECTOR_PORT);
+	reflector.Start();
+	std::array<std::array<uint8_t, 16>, 2> tags=MockReflector::GeneratePeerTags();
+	NetworkAddress reflectorAddr=NetworkAddress::IPv4("127.0.0.1");
+
+	std::unique_ptr<NetworkSocket> sender(NetworkSocket::Create(NetworkProtocol::UDP));
+	std::unique_ptr<NetworkSocket> receiver(NetworkSocket::Create(NetworkProtocol::UDP));
+	sender->Open();
+	receiver->Open();
+
+	// let the reflector learn both addresses
+	receiver->Send(NetworkPacket{MakePacket(tags[1], packetSize), reflectorAddr, REFLECTOR_PORT, NetworkProtocol::UDP});
+	sender->Send(NetworkPacket{MakePacket(tags[0], packetSize), reflectorAddr, REFLECTOR_PORT, NetworkProtocol::UDP});
+	usleep(100000);
+
+	std::atomic<bool> running(true);
+	std::atomic<uint64_t> received(0);
+	double recvCpu=0;
+	std::unique_ptr<SocketSelectCanceller> canceller(SocketSelectCanceller::Create());
+	std::thread recvThread([&]{
+		std::unique_ptr<NetworkSocketPoller> poller(NetworkSocketPoller::Create(canceller.get()));
+		poller->AddSocket(receiver.get(), NetworkSocketPoller::POLL_READ);
+		std::vector<NetworkSocket*> readable, writable, error;
+		std::vector<NetworkPacket> packets;
+		packets.reserve(MAX_RECV_BATCH_SIZE);
+		double start=ThreadCpuTime();
+		while(running){
+			if(!poller->Poll(readable, writable, error))
+				continue;
+			size_t count;
+			do{
+				packets.clear();
+				count=receiver->ReceiveBatch(packets, MAX_RECV_BATCH_SIZE);
+				received+=count;
+			}while(count==MAX_RECV_BATCH_SIZE);
+		}
+		recvCpu=ThreadCpuTime()-start;
+	});
+
+	uint64_t sent=0;
+	double sendStart=ThreadCpuTime();
+	double startTime=VoIPController::GetCurrentTime();
+	std::vector<NetworkPacket> batch;
+	while(VoIPController::GetCurrentTime()-startTime<duration){
+		batch.clear();
+		for(int i=0;i<32;i++){
+			batch.push_back(NetworkPacket{MakePacket(tags[0], packetSize), reflectorAddr, REFLECTOR_PORT, NetworkProtocol::UDP});
+		}
+		sender->SendBatch(batch);
+		sent+=32;
+		// the reflector is single-threaded, don't bury it
+		usleep(200);
+	}
+	double sendCpu=ThreadCpuTime()-sendStart;
+	double elapsed=VoIPController::GetCurrentTime()-startTime;
+	usleep(200000);
+	running=false;
+	canceller->CancelSelect();
+	recvThread.join();
+	reflector.Stop();
+
+	printf("sent %llu, received %llu packets of %u bytes in %.2f s\n", (unsigned long long)sent, (unsigned long long)received.load(), (unsigned int)packetSize, elapsed);
+	printf("throughput: %.0f packets/s\n", received/elapsed);
+	printf("send thread CPU: %.3f s (%.2f us/packet)\n", sendCpu, sendCpu*1000000.0/(double)sent);
+	printf("receive thread CPU: %.3f s (%.2f us/packet)\n", recvCpu, received ? recvCpu*1000000.0/(double)received : 0.0);
+	return 0;
+}
@@ -0,0 +1,198 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+// Measures the per-packet cost of MTProto2 msg_key, KDF2 and AES-IGE in VoIPController::SendPacket against the way it used
+// to be done (building the hashed data in BufferOutputStreams and calling CryptoFunctions::sha256 three times).
+// The current code is the controller's own: MsgKeyHash and KDF2 for the keys, and SendPacket on a controller that isn't
+// started for whole packets, which are then taken from its send queue. Both paths are checked to produce the same packets.
+// Uses VoIPController::crypto, so with TGVOIP_USE_CUSTOM_CRYPTO it has to be filled in first.
+// Usage: PacketCryptoBenchmark [iterations]
+
+#include "../VoIPController.h"
+#include "../Buffers.h"
+#include "../PrivateDefines.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace tgvoip;
+
+namespace{
+
+char encryptionKey[256];
+
+double Now(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LegacyKDF2(unsigned char* msgKey, unsigned char* aesKey, unsigned char* aesIv){
+	CryptoFunctions& crypto=VoIPController::crypto;
+	uint8_t sA[32], sB[32];
+	BufferOutputStream buf(128);
+	buf.WriteBytes(msgKey, 16);
+	buf.WriteBytes((unsigned char*)encryptionKey, 36);
+	crypto.sha256(buf.GetBuffer(), buf.GetLength(), sA);
+	buf.Reset();
+	buf.WriteBytes((unsigned char*)encryptionKey+40, 36);
+	buf.WriteBytes(msgKey, 16);
+	crypto.sha256(buf.GetBuffer(), buf.GetLength(), sB);
+	memcpy(aesKey, sA, 8);
+	memcpy(aesKey+8, sB+8, 16);
+	memcpy(aesKey+24, sA+24, 8);
+	memcpy(aesIv, sB, 8);
+	memcpy(aesIv+8, sA+8, 16);
+	memcpy(aesIv+24, sB+24, 8);
+}
+
+void LegacyMsgKey(const unsigned char* inner, size_t innerLen, unsigned char* msgKey){
+	BufferOutputStream buf(innerLen+32);
+	buf.WriteBytes((unsigned char*)encryptionKey+88, 32);
+	buf.WriteBytes(inner, innerLen);
+	unsigned char msgKeyLarge[32];
+	VoIPController::crypto.sha256(buf.GetBuffer(), buf.GetLength(), msgKeyLarge);
+	memcpy(msgKey, msgKeyLarge+8, 16);
+}
+
+size_t LegacyEncrypt(const unsigned char* data, size_t len, unsigned char* output){
+	CryptoFunctions& crypto=VoIPController::crypto;
+	BufferOutputStream out(len+128);
+	BufferOutputStream inner(len+128);
+	inner.WriteInt16((uint16_t)len);
+	inner.WriteBytes(data, len);
+	size_t padLen=16-inner.GetLength()%16;
+	if(padLen<16)
+		padLen+=16;
+	unsigned char padding[32];
+	crypto.rand_bytes(padding, padLen);
+	inner.WriteBytes(padding, padLen);
+	unsigned char key[32], iv[32], msgKey[16];
+	LegacyMsgKey(inner.GetBuffer(), inner.GetLength(), msgKey);
+	LegacyKDF2(msgKey, key, iv);
+	out.WriteBytes(msgKey, 16);
+	unsigned char aesOut[1600];
+	crypto.aes_ige_encrypt(inner.GetBuffer(), aesOut, inner.GetLength(), key, iv);
+	out.WriteBytes(aesOut, inner.GetLength());
+	memcpy(output, out.GetBuffer(), out.GetLength());
+	return out.GetLength();
+}
+
+void ZeroRandBytes(uint8_t* buffer, size_t length){
+	memset(buffer, 0, length);
+}
+
+}
+
+namespace tgvoip{
+
+// a friend of VoIPController, to call the private parts of its send path
+class PacketCryptoBenchmark{
+public:
+	PacketCryptoBenchmark(){
+		controller.SetEncryptionKey(encryptionKey, true);
+		// what the controller uses with a peer that supports the current protocol: MTProto2 with a 2-byte length and no call ID in front
+		controller.useMTProto2=true;
+		controller.peerVersion=9;
+		endpoint.type=Endpoint::Type::UDP_P2P_INET;
+	}
+
+	~PacketCryptoBenchmark(){
+		controller.Stop();
+	}
+
+	void Keys(const unsigned char* data, size_t len, unsigned char* output){
+		// MsgKeyHash needs 32 bytes in front of the data, as SendPacket has them
+		unsigned char buffer[32+1600];
+		memcpy(buffer+32, data, len);
+		unsigned char msgKeyLarge[32], key[32], iv[32];
+		controller.MsgKeyHash(0, buffer+32, len, msgKeyLarge);
+		controller.KDF2(msgKeyLarge+8, 0, key, iv);
+		memcpy(output, key, 32);
+	}
+
+	size_t Encrypt(const unsigned char* data, size_t len, unsigned char* output){
+		// the same room around the data as SendOrEnqueuePacket leaves
+		PacketBuffer packet(PACKET_ENCRYPTION_HEADROOM, PACKET_ENCRYPTION_TAILROOM(len));
+		memcpy(packet.Append(len), data, len);
+		VoIPController::PendingOutgoingPacket srcPacket(0, PKT_STREAM_DATA, len, Buffer(), 0);
+		controller.SendPacket(std::move(packet), endpoint, srcPacket);
+		VoIPController::RawPendingOutgoingPacket sent=controller.rawSendQueue.GetBlocking();
+		memcpy(output, *sent.packet.data, sent.packet.data.Length());
+		return sent.packet.data.Length();
+	}
+
+private:
+	VoIPController controller;
+	Endpoint endpoint;
+};
+
+}
+
+namespace{
+
+void LegacyKeys(const unsigned char* data, size_t len, unsigned char* output){
+	unsigned char msgKey[16], key[32], iv[32];
+	LegacyMsgKey(data, len, msgKey);
+	LegacyKDF2(msgKey, key, iv);
+	memcpy(output, key, 32);
+}
+
+template<typename F> double Run(F encrypt, size_t len, int iterations, unsigned char* output){
+	unsigned char data[1500];
+	for(size_t i=0;i<len;i++){
+		data[i]=(unsigned char)i;
+	}
+	double start=Now();
+	for(int i=0;i<iterations;i++){
+		encrypt(data, len, output);
+		data[0]=output[0];
+	}
+	return (Now()-start)*1000000000.0/iterations;
+}
+
+}
+
+int main(int argc, char** argv){
+	int iterations=argc>1 ? atoi(argv[1]) : 200000;
+	for(int i=0;i<256;i++){
+		encryptionKey[i]=(char)(i*31+7);
+	}
+	PacketCryptoBenchmark current;
+
+	// the padding is random, so the packets are only comparable without it
+	void (*randBytes)(uint8_t*, size_t)=VoIPController::crypto.rand_bytes;
+	VoIPController::crypto.rand_bytes=ZeroRandBytes;
+	unsigned char legacyOut[1600], currentOut[1600];
+	unsigned char sample[200]={1, 2, 3};
+	size_t legacyLen=LegacyEncrypt(sample, sizeof(sample), legacyOut);
+	size_t currentLen=current.Encrypt(sample, sizeof(sample), currentOut);
+	VoIPController::crypto.rand_bytes=randBytes;
+	if(legacyLen!=currentLen || memcmp(legacyOut, currentOut, legacyLen)!=0){
+		printf("packets don't match\n");
+		return 1;
+	}
+	LegacyKeys(sample, sizeof(sample), legacyOut);
+	current.Keys(sample, sizeof(sample), currentOut);
+	if(memcmp(legacyOut, currentOut, 32)!=0){
+		printf("keys don't match\n");
+		return 1;
+	}
+
+	printf("ns per packet     legacy keys   MsgKeyHash+KDF2     legacy packet   SendPacket\n");
+	size_t sizes[]={60, 200, 1000};
+	for(size_t len:sizes){
+		double legacyKeys=Run(LegacyKeys, len, iterations, legacyOut);
+		double currentKeys=Run([&](const unsigned char* data, size_t len, unsigned char* output){
+			current.Keys(data, len, output);
+		}, len, iterations, currentOut);
+		double legacy=Run(LegacyEncrypt, len, iterations, legacyOut);
+		double sendPacket=Run([&](const unsigned char* data, size_t len, unsigned char* output){
+			current.Encrypt(data, len, output);
+		}, len, iterations, currentOut);
+		printf("%4u bytes     %14.0f   %15.0f   %15.0f   %10.0f\n", (unsigned int)len, legacyKeys, currentKeys, legacy, sendPacket);
+	}
+	return 0;
+}
@@ -0,0 +1,135 @@
+//
+// libtgvoip is free and unencumbered public domain software.
+// For more information, see http://unlicense.org or the UNLICENSE file
+// you should have received with this source code distribution.
+//
+
+// Compares ParityFEC encoding and decoding against the previous byte-by-byte implementation
+// on groups of 3 to 5 packets of about 1 KB, which is what VideoPacketSender makes.
+// Usage: ParityFECBenchmark [iterations]
+// Decoding is timed with one packet lost, and the results of both implementations are checked against the original packet.
+
+#include "../video/VideoFEC.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace tgvoip;
+using namespace tgvoip::video;
+
+namespace{
+
+Buffer LegacyEncode(std::vector<Buffer>& packets){
+	size_t maxSize=0;
+	for(Buffer& pkt:packets){
+		maxSize=std::max(maxSize, pkt.Length());
+	}
+	Buffer result(maxSize+2);
+	uint8_t* _result=*result;
+	memset(_result, 0, result.Length());
+	for(Buffer& pkt:packets){
+		for(size_t i=0;i<pkt.Length();i++){
+			_result[i] ^= pkt[i];
+		}
+		uint16_t len=(uint16_t)pkt.Length();
+		_result[maxSize] ^= (uint8_t)len;
+		_result[maxSize+1] ^= (uint8_t)(len >> 8);
+	}
+	return result;
+}
+
+Buffer LegacyDecode(std::vector<Buffer>& dataPackets, Buffer& fecPacket){
+	size_t maxSize=fecPacket.Length()-2;
+	Buffer result=Buffer::CopyOf(fecPacket);
+	uint8_t* _result=*result;
+	for(Buffer& pkt:dataPackets){
+		if(pkt.Length()==0)
+			continue;
+		for(size_t i=0;i<pkt.Length();i++){
+			_result[i] ^= pkt[i];
+		}
+		uint16_t len=(uint16_t)pkt.Length();
+		_result[maxSize] ^= (uint8_t)len;
+		_result[maxSize+1] ^= (uint8_t)(len >> 8);
+	}
+	uint16_t len=(uint16_t)_result[maxSize] | ((uint16_t)_result[maxSize+1] << 8);
+	result.Resize(len);
+	return result;
+}
+
+double Now(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::vector<Buffer> MakeGroup(size_t count){
+	std::vector<Buffer> packets;
+	for(size_t i=0;i<count;i++){
+		Buffer pkt(900+rand()%200);
+		for(size_t j=0;j<pkt.Length();j++)
+			pkt[j]=(unsigned char)rand();
+		packets.push_back(std::move(pkt));
+	}
+	return packets;
+}
+
+std::vector<Buffer> WithoutPacket(std::vector<Buffer>& packets, size_t lost){
+	std::vector<Buffer> result;
+	for(size_t i=0;i<packets.size();i++){
+		result.push_back(i==lost ? Buffer() : Buffer::CopyOf(packets[i]));
+	}
+	return result;
+}
+
+bool Matches(Buffer& a, Buffer& b){
+	return a.Length()==b.Length() && memcmp(*a, *b, a.Length())==0;
+}
+
+}
+
+int main(int argc, char** argv){
+	int iterations=argc>1 ? atoi(argv[1]) : 200000;
+	bool ok=true;
+	printf("%-8s %12s %12s %12s %12s\n", "packets", "legacy enc", "new enc", "legacy dec", "new dec");
+	for(size_t count=3;count<=5;count++){
+		std::vector<Buffer> packets=MakeGroup(count);
+		size_t lost=count/2;
+		std::vector<Buffer> received=WithoutPacket(packets, lost);
+
+		Buffer legacyFec=LegacyEncode(packets);
+		Buffer fec=ParityFEC::Encode(packets);
+		Buffer legacyRecovered=LegacyDecode(received, legacyFec);
+		Buffer recovered=ParityFEC::Decode(received, fec);
+		if(!Matches(legacyFec, fec) || !Matches(legacyRecovered, packets[lost]) || !Matches(recovered, packets[lost])){
+			printf("%u packets: results don't match\n", (unsigned int)count);
+			ok=false;
+			continue;
+		}
+
+		double times[4];
+		double start=Now();
+		for(int i=0;i<iterations;i++){
+			Buffer b=LegacyEncode(packets);
+		}
+		times[0]=Now()-start;
+		start=Now();
+		for(int i=0;i<iterations;i++){
+			Buffer b=ParityFEC::Encode(packets);
+		}
+		times[1]=Now()-start;
+		start=Now();
+		for(int i=0;i<iterations;i++){
+			Buffer b=LegacyDecode(received, fec);
+		}
+		times[2]=Now()-start;
+		start=Now();
+		for(int i=0;i<iterations;i++){
+			Buffer b=ParityFEC::Decode(received, fec);
+		}
+		times[3]=Now()-start;
+		// ns per group
+		printf("%-8u %9.0f ns %9.0f ns %9.0f ns %9.0f ns\n", (unsigned int)count, times[0]*1e9/iterations, times[1]*1e9/iterations, times[2]*1e9/iterations, times[3]*1e9/iterations);
+	}
+	return ok ? 0 : 1;
+}
@@ -130,6 +130,10 @@ public:
 	void Acquire(){
 		dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER);
 	}
+
+	bool TryAcquire(){
+		return dispatch_semaphore_wait(sem, DISPATCH_TIME_NOW)==0;
+	}
 	
 	void Release(){
 		dispatch_semaphore_signal(sem);
@@ -165,6 +169,10 @@ public:
 		sem_wait(&sem);
 	}
 
+	bool TryAcquire(){
+		return sem_trywait(&sem)==0;
+	}
+
 	void Release(){
 		sem_post(&sem);
 	}
@@ -320,6 +328,14 @@ public:
 		ReleaseSemaphore(h, 1, NULL);
 	}
 
+	bool TryAcquire(){
+#if !defined(WINAPI_FAMILY) || WINAPI_FAMILY!=WINAPI_FAMILY_PHONE_APP
+		return WaitForSingleObject(h, 0)==WAIT_OBJECT_0;
+#else
+		return WaitForSingleObjectEx(h, 0, false)==WAIT_OBJECT_0;
+#endif
+	}
+
 	void Acquire(int count){
 		for(int i=0;i<count;i++)
 			Acquire();
@@ -95,12 +95,7 @@ void ScreamCongestionController::AdjustQDelayTarget(float qdelay){
 	qdelayNormHist.Add(qdelayNorm);
 
 	float qdelayNormAvg=qdelayNormHist.Average();
-	float qdelayNormVar=0.0;
-	for(uint32_t i=0;i<qdelayNormHist.Size();i++){
-		float tmp=qdelayNormHist[i]-qdelayNormAvg;
-		qdelayNormVar+=tmp*tmp;
-	}
-	qdelayNormVar/=qdelayNormHist.Size();
+	float qdelayNormVar=qdelayNormHist.Variance();
 
 	float newTarget=qdelayNormAvg+sqrt(qdelayNormVar);
 	newTarget*=QDELAY_TARGET_LO;
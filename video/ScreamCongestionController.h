@@ -40,7 +40,7 @@ namespace tgvoip{
 			HistoricBuffer<float, 20> qdelayFractionHist;
 			float qdelayTrend=0.0f;
 			float qdelayTrendMem=0.0f;
-			HistoricBuffer<float, 100> qdelayNormHist;
+			AggregatingHistoricBuffer<float, 100> qdelayNormHist;
 			bool inFastIncrease=true;
 			uint32_t cwnd;
 			uint32_t bytesNewlyAcked=0;
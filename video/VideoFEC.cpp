@@ -5,10 +5,63 @@
 #include "VideoFEC.h"
 #include "../logging.h"
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#if defined(USE_SSSE3) || defined(USE_NEON)
+#include "cm256/cm256.h"
+#endif
+
+// SSE2 and NEON are part of the baseline on x86-64 and arm64, so these don't need any extra compiler flags
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#define TGVOIP_XOR_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TGVOIP_XOR_NEON
+#include <arm_neon.h>
+#endif
 
 using namespace tgvoip;
 using namespace tgvoip::video;
 
+// dst^=src
+// Deliberately not gf256_add_mem: gf256.cpp is built with -mssse3, and parity FEC has to work on any CPU.
+static void XorBytes(uint8_t* dst, const uint8_t* src, size_t len){
+	size_t i=0;
+#if defined(TGVOIP_XOR_SSE2)
+	for(;i+32<=len;i+=32){
+		__m128i d0=_mm_loadu_si128((const __m128i*)(dst+i));
+		__m128i d1=_mm_loadu_si128((const __m128i*)(dst+i+16));
+		__m128i s0=_mm_loadu_si128((const __m128i*)(src+i));
+		__m128i s1=_mm_loadu_si128((const __m128i*)(src+i+16));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_xor_si128(d0, s0));
+		_mm_storeu_si128((__m128i*)(dst+i+16), _mm_xor_si128(d1, s1));
+	}
+	for(;i+16<=len;i+=16){
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_xor_si128(_mm_loadu_si128((const __m128i*)(dst+i)), _mm_loadu_si128((const __m128i*)(src+i))));
+	}
+#elif defined(TGVOIP_XOR_NEON)
+	for(;i+32<=len;i+=32){
+		uint8x16_t d0=vld1q_u8(dst+i);
+		uint8x16_t d1=vld1q_u8(dst+i+16);
+		vst1q_u8(dst+i, veorq_u8(d0, vld1q_u8(src+i)));
+		vst1q_u8(dst+i+16, veorq_u8(d1, vld1q_u8(src+i+16)));
+	}
+	for(;i+16<=len;i+=16){
+		vst1q_u8(dst+i, veorq_u8(vld1q_u8(dst+i), vld1q_u8(src+i)));
+	}
+#endif
+	for(;i+8<=len;i+=8){
+		uint64_t d, s;
+		memcpy(&d, dst+i, 8);
+		memcpy(&s, src+i, 8);
+		d^=s;
+		memcpy(dst+i, &d, 8);
+	}
+	for(;i<len;i++){
+		dst[i]^=src[i];
+	}
+}
+
 Buffer ParityFEC::Encode(std::vector<Buffer>& packets){
 	size_t maxSize=0;
 
@@ -19,15 +72,14 @@ Buffer ParityFEC::Encode(std::vector<Buffer>& packets){
 	uint8_t* _result=*result;
 	memset(_result, 0, result.Length());
 	for(Buffer& pkt:packets){
-		for(size_t i=0;i<pkt.Length();i++){
-			_result[i] ^= pkt[i];
-		}
+		if(!pkt.IsEmpty())
+			XorBytes(_result, *pkt, pkt.Length());
 		uint16_t len=(uint16_t)pkt.Length();
 		_result[maxSize] ^= (uint8_t)len;
 		_result[maxSize+1] ^= (uint8_t)(len >> 8);
 	}
 
-	return std::move(result);
+	return result;
 }
 
 Buffer ParityFEC::Decode(std::vector<Buffer>& dataPackets, Buffer &fecPacket){
@@ -40,6 +92,8 @@ Buffer ParityFEC::Decode(std::vector<Buffer>& dataPackets, Buffer &fecPacket){
 		LOGE("ParityFEC: FEC packet too small (%u, expected >=%u)", (unsigned int)fecPacket.Length(), (unsigned int)maxSize+2);
 		return Buffer();
 	}
+	// the lost packet may well have been the longest one, and the lengths are after that
+	maxSize=fecPacket.Length()-2;
 	Buffer result=Buffer::CopyOf(fecPacket);
 	uint8_t* _result=*result;
 	unsigned int emptyCount=0;
@@ -48,9 +102,7 @@ Buffer ParityFEC::Decode(std::vector<Buffer>& dataPackets, Buffer &fecPacket){
 			emptyCount++;
 			continue;
 		}
-		for(size_t i=0;i<pkt.Length();i++){
-			_result[i] ^= pkt[i];
-		}
+		XorBytes(_result, *pkt, pkt.Length());
 		uint16_t len=(uint16_t)pkt.Length();
 		_result[maxSize] ^= (uint8_t)len;
 		_result[maxSize+1] ^= (uint8_t)(len >> 8);
@@ -65,8 +117,150 @@ Buffer ParityFEC::Decode(std::vector<Buffer>& dataPackets, Buffer &fecPacket){
 		LOGE("ParityFEC: incorrect length %u", len);
 		return Buffer();
 	}
-	LOGV("ParityFEC decoded packet size %u", len);
 
 	result.Resize(len);
-	return std::move(result);
+	return result;
+}
+
+#pragma mark - CM256FEC
+
+#if defined(USE_SSSE3) || defined(USE_NEON)
+static CM256& GetCM256(){
+	static CM256 cm256;
+	return cm256;
+}
+#endif
+
+bool CM256FEC::IsSupported(){
+#if defined(USE_SSSE3) || defined(USE_NEON)
+	return GetCM256().isInitialized();
+#else
+	return false;
+#endif
+}
+
+std::vector<Buffer> CM256FEC::Encode(std::vector<Buffer>& packets, unsigned int recoveryCount){
+	std::vector<Buffer> result;
+#if defined(USE_SSSE3) || defined(USE_NEON)
+	if(packets.empty() || recoveryCount==0 || packets.size()+recoveryCount>256 || !IsSupported())
+		return result;
+	size_t maxSize=0;
+	for(Buffer& pkt:packets){
+		maxSize=std::max(maxSize, pkt.Length());
+	}
+	size_t blockSize=maxSize+2; // add 2 bytes for length, like ParityFEC
+
+	// cm256 wants all the blocks to be the same size, so the originals are padded with zeros and get the length at the end
+	Buffer originals(blockSize*packets.size());
+	memset(*originals, 0, originals.Length());
+	std::vector<CM256::cm256_block> blocks(packets.size());
+	for(size_t i=0;i<packets.size();i++){
+		uint8_t* block=*originals+blockSize*i;
+		Buffer& pkt=packets[i];
+		if(!pkt.IsEmpty())
+			memcpy(block, *pkt, pkt.Length());
+		block[maxSize]=(uint8_t)pkt.Length();
+		block[maxSize+1]=(uint8_t)(pkt.Length() >> 8);
+		blocks[i].Block=block;
+		blocks[i].Index=(unsigned char)i;
+	}
+
+	CM256::cm256_encoder_params params;
+	params.OriginalCount=(int)packets.size();
+	params.RecoveryCount=(int)recoveryCount;
+	params.BlockBytes=(int)blockSize;
+	Buffer recovery(blockSize*recoveryCount);
+	if(GetCM256().cm256_encode(params, blocks.data(), *recovery)!=0){
+		LOGE("CM256FEC: encoding %u packets failed", (unsigned int)packets.size());
+		return result;
+	}
+	for(unsigned int i=0;i<recoveryCount;i++){
+		Buffer block(blockSize);
+		block.CopyFrom(*recovery+blockSize*i, 0, blockSize);
+		result.push_back(std::move(block));
+	}
+#endif
+	return result;
+}
+
+bool CM256FEC::Decode(std::vector<Buffer>& dataPackets, std::vector<std::pair<unsigned int, Buffer*>>& recoveryPackets, unsigned int recoveryCount){
+#if defined(USE_SSSE3) || defined(USE_NEON)
+	unsigned int lostCount=0;
+	for(Buffer& pkt:dataPackets){
+		if(pkt.IsEmpty())
+			lostCount++;
+	}
+	if(lostCount==0)
+		return true;
+	if(recoveryPackets.size()<lostCount || dataPackets.size()+recoveryCount>256 || !IsSupported())
+		return false;
+	size_t blockSize=recoveryPackets[0].second->Length();
+	if(blockSize<2){
+		LOGE("CM256FEC: recovery block too small (%u)", (unsigned int)blockSize);
+		return false;
+	}
+	size_t maxSize=blockSize-2;
+	for(Buffer& pkt:dataPackets){
+		if(pkt.Length()>maxSize){
+			LOGE("CM256FEC: packet size %u doesn't fit into recovery block size %u", (unsigned int)pkt.Length(), (unsigned int)blockSize);
+			return false;
+		}
+	}
+
+	// every lost packet is replaced by a recovery block, which cm256 then turns into that packet in place
+	std::vector<CM256::cm256_block> blocks;
+	Buffer blockData(blockSize*dataPackets.size());
+	memset(*blockData, 0, blockData.Length());
+	std::vector<std::pair<unsigned int, Buffer*>>::iterator recoveryPkt=recoveryPackets.begin();
+	for(size_t i=0;i<dataPackets.size();i++){
+		uint8_t* block=*blockData+blockSize*i;
+		Buffer& pkt=dataPackets[i];
+		CM256::cm256_block b;
+		b.Block=block;
+		if(pkt.IsEmpty()){
+			while(recoveryPkt!=recoveryPackets.end() && (recoveryPkt->first>=recoveryCount || recoveryPkt->second->Length()!=blockSize))
+				++recoveryPkt;
+			if(recoveryPkt==recoveryPackets.end()){
+				LOGD("CM256FEC: %u packets lost, only %u recovery blocks", lostCount, (unsigned int)recoveryPackets.size());
+				return false;
+			}
+			memcpy(block, **recoveryPkt->second, blockSize);
+			b.Index=(unsigned char)(dataPackets.size()+recoveryPkt->first);
+			++recoveryPkt;
+		}else{
+			memcpy(block, *pkt, pkt.Length());
+			block[maxSize]=(uint8_t)pkt.Length();
+			block[maxSize+1]=(uint8_t)(pkt.Length() >> 8);
+			b.Index=(unsigned char)i;
+		}
+		blocks.push_back(b);
+	}
+
+	CM256::cm256_encoder_params params;
+	params.OriginalCount=(int)dataPackets.size();
+	params.RecoveryCount=(int)recoveryCount;
+	params.BlockBytes=(int)blockSize;
+	if(GetCM256().cm256_decode(params, blocks.data())!=0){
+		LOGE("CM256FEC: decoding failed");
+		return false;
+	}
+	for(CM256::cm256_block& b:blocks){
+		Buffer& pkt=dataPackets[b.Index];
+		if(!pkt.IsEmpty())
+			continue;
+		uint8_t* block=(uint8_t*)b.Block;
+		uint16_t len=(uint16_t)block[maxSize] | ((uint16_t)block[maxSize+1] << 8);
+		if(len>maxSize || len==0){
+			LOGE("CM256FEC: incorrect length %u", len);
+			return false;
+		}
+		Buffer recovered(len);
+		recovered.CopyFrom(block, 0, len);
+		pkt=std::move(recovered);
+	}
+	LOGV("CM256FEC recovered %u packets", lostCount);
+	return true;
+#else
+	return false;
+#endif
 }
@@ -16,8 +16,26 @@ namespace tgvoip{
 			static Buffer Decode(std::vector<Buffer>& dataPackets, Buffer& fecPacket);
 		};
 
+		/**
+		 * Cauchy Reed-Solomon FEC on top of video/cm256: any N of the N+R blocks restore the original N packets.
+		 * Only available where the build enables SSSE3 or NEON for cm256; check IsSupported() before using it.
+		 */
 		class CM256FEC{
-
+		public:
+			static bool IsSupported();
+			/**
+			 * Makes recoveryCount recovery blocks for packets. Each one is as long as the longest packet plus 2 bytes for its length.
+			 * packets.size()+recoveryCount must not exceed 256.
+			 * @return the recovery blocks in order of their indices, or an empty vector on failure
+			 */
+			static std::vector<Buffer> Encode(std::vector<Buffer>& packets, unsigned int recoveryCount);
+			/**
+			 * Restores the lost packets, which are the empty buffers in dataPackets, in place.
+			 * @param recoveryPackets recovery blocks received, each with its index in the vector returned by Encode
+			 * @param recoveryCount the total number of recovery blocks made by the sender
+			 * @return true if all the lost packets were restored
+			 */
+			static bool Decode(std::vector<Buffer>& dataPackets, std::vector<std::pair<unsigned int, Buffer*>>& recoveryPackets, unsigned int recoveryCount);
 		};
 	}
 }
@@ -7,11 +7,24 @@
 #include "VideoFEC.h"
 #include "../logging.h"
 #include "../PrivateDefines.h"
+#include "../VoIPServerConfig.h"
+
+// how many FEC groups to remember for deciding whether a lost packet needs a key frame
+#define MAX_FEC_GROUPS 16
+// an unacknowledged fragment is considered lost once this many fragments of the same stream sent after it are acknowledged...
+#define RTX_REORDER_THRESHOLD 3
+// ...and its own ack is later than the RTT plus this share of it
+#define RTX_REORDER_WINDOW 0.25
+// PacketReassembler gives up on an incomplete frame once this many newer frames have arrived
+#define RTX_RECEIVER_FRAME_WINDOW 3
+// how much unused retransmission budget can accumulate
+#define RTX_MAX_BUDGET_SECONDS 0.5
 
 using namespace tgvoip;
 using namespace tgvoip::video;
 
 VideoPacketSender::VideoPacketSender(VoIPController* controller, VideoSource* videoSource, std::shared_ptr<VoIPController::Stream> stream) : PacketSender(controller), stm(stream){
+	rtxMaxBitrateShare=ServerConfig::GetSharedInstance()->GetDouble("video_rtx_max_bitrate_share", 0.1);
 	SetSource(videoSource);
 }
 
@@ -20,30 +33,41 @@ VideoPacketSender::~VideoPacketSender(){
 
 void VideoPacketSender::PacketAcknowledged(uint32_t seq, double sendTime, double ackTime, uint8_t type, uint32_t size){
 	uint32_t bytesNewlyAcked=0;
-	//if(!videoKeyframeRequested){
-		// video frames are stored in sentVideoFrames in order of increasing numbers
-		// so if a frame (or part of it) is acknowledged but isn't sentVideoFrames[0], we know there was a packet loss
-		for(SentVideoFrame& f:sentVideoFrames){
-			for(vector<uint32_t>::iterator s=f.unacknowledgedPackets.begin(); s!=f.unacknowledgedPackets.end();){
-				//RecentOutgoingPacket* opkt=GetRecentOutgoingPacket(*s);
-				if(/*opkt && opkt->ackTime!=0.0*/*s==seq){
-					s=f.unacknowledgedPackets.erase(s);
-					//newlyAckedVideoBytes+=opkt->size;
-                    bytesNewlyAcked=size;
-                    break;
-				}else{
-					++s;
-				}
-			}
+	std::map<uint32_t, InFlightFragment>::iterator acked=inFlightFragments.find(seq);
+	if(acked!=inFlightFragments.end()){
+		InFlightFragment ref=acked->second;
+		inFlightFragments.erase(acked);
+		bytesNewlyAcked=size;
+		SentVideoFrame* f=GetSentFrame(ref.frameSeq);
+		if(f && !f->fragments[ref.index].done)
+			FragmentDone(*f, f->fragments[ref.index]);
+
+		// acks are processed oldest first, so fragments sent before this one that still aren't acknowledged are probably lost.
+		// Only this stream's packets count, the seqs in between are shared with audio, and the fragments of a frame are sent
+		// all at once, so they are only given up on after a while, otherwise mere reordering would trigger retransmissions.
+		double lostBefore=VoIPController::GetCurrentTime()-RTTHistory().Average(5)*(1.0+RTX_REORDER_WINDOW);
+		std::vector<uint32_t> lostSeqs;
+		for(std::map<uint32_t, InFlightFragment>::iterator older=inFlightFragments.begin();older!=inFlightFragments.end() && (int32_t)(older->first-seq)<0;++older){
+			older->second.laterAcks++;
+			if(older->second.laterAcks>=RTX_REORDER_THRESHOLD && older->second.sendTime<lostBefore)
+				lostSeqs.push_back(older->first);
 		}
-		for(vector<SentVideoFrame>::iterator f=sentVideoFrames.begin();f!=sentVideoFrames.end();){
-			if(f->unacknowledgedPackets.empty() && f->fragmentsInQueue==0){
-					f=sentVideoFrames.erase(f);
-					continue;
+		// sending may report other packets lost, so everything is looked up again
+		for(uint32_t lostSeq:lostSeqs){
+			std::map<uint32_t, InFlightFragment>::iterator older=inFlightFragments.find(lostSeq);
+			if(older==inFlightFragments.end())
+				continue;
+			SentVideoFrame* of=GetSentFrame(older->second.frameSeq);
+			if(!of || of->fragments[older->second.index].nacked)
+				continue;
+			SentFragment& frag=of->fragments[older->second.index];
+			uint32_t lostSize=static_cast<uint32_t>(frag.data.Length());
+			if(RetransmitFragment(*of, frag, older->second.index)){
+				videoPacketLossCount++;
+				videoCongestionControl.ProcessPacketLost(lostSize);
 			}
-			++f;
 		}
-	//}
+	}
 	if(bytesNewlyAcked){
 		float _sendTime=(float)(sendTime-GetConnectionInitTime());
 		float recvTime=(float)ackTime;
@@ -55,28 +79,120 @@ void VideoPacketSender::PacketAcknowledged(uint32_t seq, double sendTime, double
 }
 
 void VideoPacketSender::PacketLost(uint32_t seq, uint8_t type, uint32_t size){
-	if(type==PKT_STREAM_EC)
+	if(type==PKT_STREAM_EC){
+		for(FecGroup& group:fecGroups){
+			if(std::find(group.fecPacketSeqs.begin(), group.fecPacketSeqs.end(), seq)!=group.fecPacketSeqs.end()){
+				FecGroupPacketLost(group.id);
+				break;
+			}
+		}
 		return;
+	}
 	LOGW("VideoPacketSender::PacketLost: %u (size %u)", seq, size);
-	//LOGI("frame count %u", (unsigned int)sentVideoFrames.size());
-	for(std::vector<SentVideoFrame>::iterator f=sentVideoFrames.begin();f!=sentVideoFrames.end();++f){
-		std::vector<uint32_t>::iterator pkt=std::find(f->unacknowledgedPackets.begin(), f->unacknowledgedPackets.end(), seq);
-		if(pkt!=f->unacknowledgedPackets.end()){
-			LOGW("Lost packet belongs to frame %u", f->seq);
-			videoPacketLossCount++;
-			videoCongestionControl.ProcessPacketLost(size);
-			if(!videoKeyframeRequested){
-				videoKeyframeRequested=true;
-				source->RequestKeyFrame();
-			}
-			f->unacknowledgedPackets.erase(pkt);
-			if(f->unacknowledgedPackets.empty() && f->fragmentsInQueue==0){
-				sentVideoFrames.erase(f);
-			}
+	std::map<uint32_t, InFlightFragment>::iterator lost=inFlightFragments.find(seq);
+	if(lost==inFlightFragments.end())
+		return;
+	InFlightFragment ref=lost->second;
+	inFlightFragments.erase(lost);
+	SentVideoFrame* f=GetSentFrame(ref.frameSeq);
+	if(!f)
+		return;
+	SentFragment& frag=f->fragments[ref.index];
+	LOGW("Lost packet belongs to frame %u", f->seq);
+	// a retransmitted original was already counted as lost when it was retransmitted
+	if(!frag.retransmitted || seq!=frag.seq){
+		videoPacketLossCount++;
+		videoCongestionControl.ProcessPacketLost(size);
+	}
+	if(!frag.nacked && RetransmitFragment(*f, frag, ref.index))
+		return;
+	// the other transmission may still make it
+	if(frag.retransmitted && inFlightFragments.find(seq==frag.seq ? frag.rtxSeq : frag.seq)!=inFlightFragments.end())
+		return;
+	FecGroupPacketLost(f->fecGroup);
+	FragmentDone(*f, frag);
+}
+
+VideoPacketSender::SentVideoFrame* VideoPacketSender::GetSentFrame(uint32_t seq){
+	std::map<uint32_t, SentVideoFrame>::iterator f=sentVideoFrames.find(seq);
+	if(f==sentVideoFrames.end())
+		return NULL;
+	return &f->second;
+}
+
+void VideoPacketSender::FragmentDone(SentVideoFrame& frame, SentFragment& fragment){
+	fragment.done=true;
+	inFlightFragments.erase(fragment.seq);
+	if(fragment.retransmitted)
+		inFlightFragments.erase(fragment.rtxSeq);
+	fragment.data=Buffer();
+	frame.unacknowledgedCount--;
+	if(frame.unacknowledgedCount==0 && frame.fragmentsInQueue==0)
+		sentVideoFrames.erase(frame.seq);
+}
+
+void VideoPacketSender::FecGroupPacketLost(uint32_t groupID){
+	for(FecGroup& group:fecGroups){
+		if(group.id!=groupID)
+			continue;
+		group.lostCount++;
+		if(!group.sent) // SendFEC() will check
+			return;
+		if(group.lostCount<=group.recoveryCount){
+			LOGD("Lost packet can be recovered by FEC (group %u: %u lost, %u recovery packets)", group.id, group.lostCount, group.recoveryCount);
 			return;
 		}
+		break;
+	}
+	if(!videoKeyframeRequested){
+		videoKeyframeRequested=true;
+		source->RequestKeyFrame();
 	}
-	//abort();
+}
+
+bool VideoPacketSender::RetransmitFragment(SentVideoFrame& frame, SentFragment& fragment, uint32_t index){
+	fragment.nacked=true;
+	if(fragment.data.IsEmpty() || avgFrameInterval==0.0)
+		return false;
+	double currentTime=VoIPController::GetCurrentTime();
+	double rtt=RTTHistory().Average(5);
+	// the retransmission and the newer frames take the same path, so it arrives in time if it's sent before the frame that makes
+	// the receiver give up on this one; leave some room for jitter. When the RTT alone is longer than that, loss is detected too late anyway
+	double deadline=frame.sendTime+RTX_RECEIVER_FRAME_WINDOW*avgFrameInterval;
+	if(rtt>=RTX_RECEIVER_FRAME_WINDOW*avgFrameInterval || currentTime+rtt*0.25>deadline){
+		LOGV("Not retransmitting fragment of frame %u: %.0f ms too late, rtt %.0f ms", frame.seq, (currentTime+rtt*0.25-deadline)*1000.0, rtt*1000.0);
+		return false;
+	}
+
+	// a share of what the congestion controller allows, so that retransmissions never push the sending rate much above it
+	double bytesPerSecond=videoCongestionControl.GetBitrate()/8.0*rtxMaxBitrateShare;
+	if(lastRtxBudgetUpdate!=0.0)
+		rtxBudget=std::min(rtxBudget+(currentTime-lastRtxBudgetUpdate)*bytesPerSecond, std::max(bytesPerSecond*RTX_MAX_BUDGET_SECONDS, 1500.0));
+	lastRtxBudgetUpdate=currentTime;
+	if(rtxBudget<fragment.data.Length()){
+		LOGV("Not retransmitting fragment of frame %u: over budget", frame.seq);
+		return false;
+	}
+	rtxBudget-=fragment.data.Length();
+
+	size_t len=fragment.data.Length();
+	VoIPController::PendingOutgoingPacket p{
+			0,
+			PKT_STREAM_DATA,
+			len,
+			std::move(fragment.data),
+			0
+	};
+	fragment.data=Buffer();
+	IncrementUnsentStreamPackets();
+	uint32_t seq=SendPacket(std::move(p));
+	videoCongestionControl.ProcessPacketSent(static_cast<uint32_t>(len));
+	retransmittedPacketCount++;
+	LOGD("Retransmitted fragment of frame %u: seq %u -> %u (%u retransmissions total)", frame.seq, fragment.seq, seq, retransmittedPacketCount);
+	fragment.rtxSeq=seq;
+	fragment.retransmitted=true;
+	inFlightFragments[seq]=InFlightFragment{frame.seq, index, 0, currentTime};
+	return true;
 }
 
 void VideoPacketSender::SetSource(VideoSource *source){
@@ -118,6 +234,11 @@ void VideoPacketSender::SendFrame(const Buffer &_frame, uint32_t flags, uint32_t
 
 		if(firstVideoFrameTime==0.0)
 			firstVideoFrameTime=currentTime;
+		if(lastFrameTime!=0.0){
+			double interval=currentTime-lastFrameTime;
+			avgFrameInterval=avgFrameInterval==0.0 ? interval : (avgFrameInterval*0.9+interval*0.1);
+		}
+		lastFrameTime=currentTime;
 
 		videoCongestionControl.UpdateMediaRate(static_cast<uint32_t>(frame.Length()));
 		uint32_t bitrate=videoCongestionControl.GetBitrate();
@@ -183,10 +304,19 @@ void VideoPacketSender::SendFrame(const Buffer &_frame, uint32_t flags, uint32_t
 		size_t segmentCount=totalLength/1024;
 		if(totalLength%1024>0)
 			segmentCount++;
+		if(fecFrameCount==0){
+			fecGroupFrameCount=GetFecController().GetVideoFramesPerGroup();
+			fecGroups.push_back(FecGroup{++fecGroupID, 0, 0, false});
+			if(fecGroups.size()>MAX_FEC_GROUPS)
+				fecGroups.erase(fecGroups.begin());
+		}
 		SentVideoFrame sentFrame;
 		sentFrame.seq=frameSeq;
+		sentFrame.fecGroup=fecGroupID;
 		sentFrame.fragmentCount=static_cast<uint32_t>(segmentCount);
+		sentFrame.unacknowledgedCount=static_cast<uint32_t>(segmentCount);
 		sentFrame.fragmentsInQueue=0;//static_cast<uint32_t>(segmentCount);
+		sentFrame.sendTime=currentTime;
 		size_t offset=0;
 		size_t packetSize=totalLength/segmentCount;
 		for(size_t seg=0; seg<segmentCount; seg++){
@@ -248,6 +378,9 @@ void VideoPacketSender::SendFrame(const Buffer &_frame, uint32_t flags, uint32_t
 			offset+=len;
 
 			Buffer packetData(std::move(pkt));
+			Buffer rtxData;
+			if(rtxMaxBitrateShare>0.0)
+				rtxData=Buffer::CopyOf(packetData);
 
 			VoIPController::PendingOutgoingPacket p{
 					/*.seq=*/0,
@@ -259,23 +392,49 @@ void VideoPacketSender::SendFrame(const Buffer &_frame, uint32_t flags, uint32_t
 			IncrementUnsentStreamPackets();
 			uint32_t seq=SendPacket(std::move(p));
 			videoCongestionControl.ProcessPacketSent(static_cast<unsigned int>(pkt.GetLength()));
-			sentFrame.unacknowledgedPackets.push_back(seq);
+			inFlightFragments[seq]=InFlightFragment{sentFrame.seq, static_cast<uint32_t>(seg), 0, currentTime};
+			sentFrame.fragments.push_back(SentFragment{seq, 0, false, false, false, std::move(rtxData)});
 			//packetQueue.Put(QueuedPacket{std::move(p), sentFrame.seq});
 		}
 		fecFrameCount++;
-		if(fecFrameCount>=3){
-			Buffer fecPacket=ParityFEC::Encode(packetsForFEC);
+		fecFramePartCounts.push_back(static_cast<uint32_t>(segmentCount));
+		GetFecController().VideoFrameSent(static_cast<unsigned int>(segmentCount));
+		if(fecFrameCount>=fecGroupFrameCount){
+			SendFEC();
+		}
+		sentVideoFrames[sentFrame.seq]=std::move(sentFrame);
+	});
+}
+
+void VideoPacketSender::SendFEC(){
+	FecGroup& group=fecGroups.back();
+	group.sent=true;
+	bool cm256Available=GetProtocolInfo().videoFecCM256Supported && CM256FEC::IsSupported();
+	FecController::VideoFecParams fec=GetFecController().GetVideoFecParams(static_cast<unsigned int>(packetsForFEC.size()), cm256Available);
+	std::vector<Buffer> recoveryPackets;
+	unsigned int recoveryCount=fec.recoveryCount;
+	if(fec.scheme==FEC_SCHEME_CM256 && recoveryCount>0)
+		recoveryPackets=CM256FEC::Encode(packetsForFEC, recoveryCount);
 
-			packetsForFEC.clear();
-			fecFrameCount=0;
-			LOGV("FEC packet length: %u", (unsigned int) fecPacket.Length());
+	if(recoveryCount==0){
+		LOGV("Not sending FEC for %u packets", (unsigned int) packetsForFEC.size());
+	}else if(!recoveryPackets.empty()){
+		// each CM256 packet also carries the fragment counts of the frames it covers so that the receiver
+		// could put the fragments in the right places even if an entire frame is lost
+		for(unsigned int i=0;i<recoveryPackets.size();i++){
+			Buffer& block=recoveryPackets[i];
 			BufferOutputStream out(1500);
 			out.WriteByte(stm->id);
 			out.WriteByte((uint8_t) frameSeq);
-			out.WriteByte(FEC_SCHEME_XOR);
-			out.WriteByte(3);
-			out.WriteInt16((int16_t) fecPacket.Length());
-			out.WriteBytes(fecPacket);
+			out.WriteByte(FEC_SCHEME_CM256);
+			out.WriteByte((uint8_t) fecFrameCount);
+			out.WriteInt16((int16_t) (2+fecFramePartCounts.size()+block.Length()));
+			out.WriteByte((uint8_t) i);
+			out.WriteByte((uint8_t) recoveryCount);
+			for(uint32_t partCount:fecFramePartCounts){
+				out.WriteByte((uint8_t) partCount);
+			}
+			out.WriteBytes(block);
 
 			VoIPController::PendingOutgoingPacket p{
 					0,
@@ -284,10 +443,39 @@ void VideoPacketSender::SendFrame(const Buffer &_frame, uint32_t flags, uint32_t
 					Buffer(std::move(out)),
 					0
 			};
-			uint32_t seq=SendPacket(std::move(p));
+			group.fecPacketSeqs.push_back(SendPacket(std::move(p)));
 		}
-		sentVideoFrames.push_back(sentFrame);
-	});
+		group.recoveryCount=recoveryCount;
+		LOGV("Sent %u CM256 FEC packets for %u packets, length %u", recoveryCount, (unsigned int) packetsForFEC.size(), (unsigned int) recoveryPackets[0].Length());
+	}else{
+		Buffer fecPacket=ParityFEC::Encode(packetsForFEC);
+		LOGV("FEC packet length: %u", (unsigned int) fecPacket.Length());
+		BufferOutputStream out(1500);
+		out.WriteByte(stm->id);
+		out.WriteByte((uint8_t) frameSeq);
+		out.WriteByte(FEC_SCHEME_XOR);
+		out.WriteByte((uint8_t) fecFrameCount);
+		out.WriteInt16((int16_t) fecPacket.Length());
+		out.WriteBytes(fecPacket);
+
+		VoIPController::PendingOutgoingPacket p{
+				0,
+				PKT_STREAM_EC,
+				out.GetLength(),
+				Buffer(std::move(out)),
+				0
+		};
+		group.fecPacketSeqs.push_back(SendPacket(std::move(p)));
+		group.recoveryCount=1;
+	}
+	packetsForFEC.clear();
+	fecFramePartCounts.clear();
+	fecFrameCount=0;
+
+	if(group.lostCount>group.recoveryCount && !videoKeyframeRequested){
+		videoKeyframeRequested=true;
+		source->RequestKeyFrame();
+	}
 }
 
 int VideoPacketSender::GetVideoResolutionForCurrentBitrate(){
@@ -8,6 +8,7 @@
 #include "../PacketSender.h"
 #include "../Buffers.h"
 #include "../threading.h"
+#include <map>
 #include <memory>
 #include <stdint.h>
 #include <vector>
@@ -29,11 +30,36 @@ namespace tgvoip{
 			}
 
 		private:
+			struct SentFragment{
+				uint32_t seq;
+				uint32_t rtxSeq; // valid if retransmitted
+				bool retransmitted;
+				bool nacked; // already considered for retransmission
+				bool done; // acknowledged or given up on
+				Buffer data; // the packet as sent, empty if it can't be retransmitted
+			};
 			struct SentVideoFrame{
 				uint32_t seq;
 				uint32_t fragmentCount;
-				std::vector<uint32_t> unacknowledgedPackets;
+				uint32_t unacknowledgedCount; // fragments that aren't done yet
 				uint32_t fragmentsInQueue;
+				uint32_t fecGroup;
+				double sendTime;
+				std::vector<SentFragment> fragments;
+			};
+			struct FecGroup{
+				uint32_t id;
+				uint32_t recoveryCount; // how many lost packets it can repair
+				uint32_t lostCount;
+				bool sent;
+				std::vector<uint32_t> fecPacketSeqs;
+			};
+			// a transmission of a fragment that is neither acknowledged nor lost yet
+			struct InFlightFragment{
+				uint32_t frameSeq;
+				uint32_t index;
+				uint32_t laterAcks; // fragments of this stream sent after this one and acknowledged
+				double sendTime;
 			};
 			struct QueuedPacket{
 				VoIPController::PendingOutgoingPacket packet;
@@ -41,6 +67,22 @@ namespace tgvoip{
 			};
 
 			void SendFrame(const Buffer& frame, uint32_t flags, uint32_t rotation);
+			void SendFEC();
+			void FecGroupPacketLost(uint32_t groupID);
+			/**
+			 * Sends the fragment again if it can still reach the receiver in time and the budget allows.
+			 * The original transmission stays in flight, an ack for either one means the fragment was delivered.
+			 * Every fragment is only retransmitted once.
+			 */
+			bool RetransmitFragment(SentVideoFrame& frame, SentFragment& fragment, uint32_t index);
+			/**
+			 * @return the frame with this seq if it still has fragments in flight, or NULL
+			 */
+			SentVideoFrame* GetSentFrame(uint32_t seq);
+			/**
+			 * Stops tracking the fragment once it's acknowledged or given up on. Removes the frame when it was the last one.
+			 */
+			void FragmentDone(SentVideoFrame& frame, SentFragment& fragment);
 			int GetVideoResolutionForCurrentBitrate();
 
 			VideoSource* source=NULL;
@@ -48,7 +90,8 @@ namespace tgvoip{
 			video::ScreamCongestionController videoCongestionControl;
 			double firstVideoFrameTime=0.0;
 			uint32_t videoFrameCount=0;
-			std::vector<SentVideoFrame> sentVideoFrames;
+			std::map<uint32_t, SentVideoFrame> sentVideoFrames; // by seq, the ones that still have fragments in flight
+			std::map<uint32_t, InFlightFragment> inFlightFragments; // by seq
 			bool videoKeyframeRequested=false;
 			uint32_t sendVideoPacketID=MessageThread::INVALID_ID;
 			uint32_t videoPacketLossCount=0;
@@ -57,8 +100,19 @@ namespace tgvoip{
 			double sourceChangeTime=0.0;
 
 			std::vector<Buffer> packetsForFEC;
+			std::vector<uint32_t> fecFramePartCounts;
 			size_t fecFrameCount=0;
 			uint32_t frameSeq=0;
+			std::vector<FecGroup> fecGroups;
+			uint32_t fecGroupID=0;
+			unsigned int fecGroupFrameCount=3;
+
+			double lastFrameTime=0.0;
+			double avgFrameInterval=0.0;
+			double rtxMaxBitrateShare;
+			double rtxBudget=0.0; // in bytes
+			double lastRtxBudgetUpdate=0.0;
+			uint32_t retransmittedPacketCount=0;
 		};
 	}
 }